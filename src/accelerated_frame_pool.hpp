@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+
+#include <windows.h>
+#include <d3d11_1.h>
+#include <wrl/client.h>
+
+#include <SDL3/SDL.h>
+
+// A pool of runner-owned shared textures that accelerated frames are copied
+// into, so OnAcceleratedPaint can return without waiting for the client.
+//
+// CEF's texture is only valid until OnAcceleratedPaint returns. Copy() copies
+// it on the GPU into a free slot and waits for that copy, not for the client,
+// to finish; the client is then handed the slot's NT handle instead of
+// CEF's. As with SharedFrameRing, a slot stays in use until the caller
+// Release()s it on the client's acknowledgement, which may come in any
+// order, and a frame the caller stopped waiting for keeps its slot. The
+// caller checks FreeSlot() first and drops the frame while there is none.
+//
+// A slot's texture is recreated whenever a frame of another size or format
+// is copied into it, so view and popup frames can share a pool.
+//
+// All pools share one D3D11 device on the default adapter, which is the one
+// CEF's GPU process renders on unless told otherwise. Not thread safe; used
+// from the CEF UI thread only.
+class AcceleratedFramePool {
+ public:
+  AcceleratedFramePool() = default;
+  ~AcceleratedFramePool() { Close(); }
+  AcceleratedFramePool(const AcceleratedFramePool&) = delete;
+  AcceleratedFramePool& operator=(const AcceleratedFramePool&) = delete;
+
+  // Sets the number of slots. Textures are created on first use.
+  void Open(int slotCount) {
+    Close();
+    slots.resize(slotCount);
+    nextSlot = 0;
+  }
+
+  void Close() {
+    for (Slot& slot : slots) {
+      // A client that opened the texture keeps its own reference.
+      if (slot.sharedHandle != nullptr) {
+        CloseHandle(slot.sharedHandle);
+      }
+    }
+    slots.clear();
+  }
+
+  bool IsOpen() const { return !slots.empty(); }
+
+  // The slot the next Copy() goes to, or -1 while every slot is in use.
+  int FreeSlot() const {
+    int slotCount = static_cast<int>(slots.size());
+    for (int i = 0; i < slotCount; i++) {
+      int slot = (nextSlot + i) % slotCount;
+      if (!slots[slot].inUse) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  // Copies the texture behind CEF's |source| handle into a free slot, marks
+  // it in use and returns its index, or -1 if there is no free slot or the
+  // copy failed.
+  int Copy(HANDLE source) {
+    int slot = FreeSlot();
+    Gpu* gpu = SharedGpu();
+    if (slot < 0 || gpu == nullptr) {
+      return -1;
+    }
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> frame;
+    HRESULT result = gpu->device->OpenSharedResource1(source, IID_PPV_ARGS(&frame));
+    if (FAILED(result)) {
+      SDL_Log("AcceleratedFramePool: OpenSharedResource1 failed: 0x%08lx", result);
+      return -1;
+    }
+    D3D11_TEXTURE2D_DESC desc;
+    frame->GetDesc(&desc);
+    Slot& target = slots[slot];
+    if (!target.texture || desc.Width != target.width || desc.Height != target.height ||
+        desc.Format != target.format) {
+      if (!CreateTexture(gpu->device.Get(), desc, target)) {
+        return -1;
+      }
+    }
+
+    gpu->context->CopyResource(target.texture.Get(), frame.Get());
+    gpu->context->End(gpu->copied.Get());
+    // CEF may draw into its texture again as soon as the paint callback
+    // returns, so the copy has to be done by then. This waits on the GPU
+    // only, for well under a millisecond at 1080p.
+    while ((result = gpu->context->GetData(gpu->copied.Get(), nullptr, 0, 0)) == S_FALSE) {
+      SwitchToThread();
+    }
+    if (FAILED(result)) {
+      SDL_Log("AcceleratedFramePool: waiting for the copy failed: 0x%08lx", result);
+      return -1;
+    }
+
+    target.inUse = true;
+    nextSlot = (slot + 1) % static_cast<int>(slots.size());
+    return slot;
+  }
+
+  // Frees a slot once the client is done with the frame copied into it.
+  void Release(int slot) {
+    if (slot >= 0 && slot < static_cast<int>(slots.size())) {
+      slots[slot].inUse = false;
+    }
+  }
+
+  // Frees every slot, for when the client that held them is gone.
+  void ReleaseAll() {
+    for (Slot& slot : slots) {
+      slot.inUse = false;
+    }
+  }
+
+  // NT handle to the slot's texture, owned by the pool; duplicate it into
+  // the client's process.
+  HANDLE SharedHandle(int slot) const { return slots[slot].sharedHandle; }
+
+ private:
+  struct Slot {
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+    HANDLE sharedHandle = nullptr;
+    UINT width = 0;
+    UINT height = 0;
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    bool inUse = false;
+  };
+
+  struct Gpu {
+    Microsoft::WRL::ComPtr<ID3D11Device1> device;
+    Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+    // Signalled once the last copy has completed.
+    Microsoft::WRL::ComPtr<ID3D11Query> copied;
+  };
+
+  // The device all pools copy on, created on first use; null if that
+  // failed.
+  static Gpu* SharedGpu() {
+    static Gpu gpu;
+    static bool created = false;
+    if (!created) {
+      created = true;
+      Microsoft::WRL::ComPtr<ID3D11Device> device;
+      HRESULT result = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr,
+                                         D3D11_CREATE_DEVICE_BGRA_SUPPORT, nullptr, 0,
+                                         D3D11_SDK_VERSION, &device, nullptr, &gpu.context);
+      if (SUCCEEDED(result)) {
+        result = device.As(&gpu.device);
+      }
+      D3D11_QUERY_DESC queryDesc = {D3D11_QUERY_EVENT, 0};
+      if (SUCCEEDED(result)) {
+        result = gpu.device->CreateQuery(&queryDesc, &gpu.copied);
+      }
+      if (FAILED(result)) {
+        SDL_Log("AcceleratedFramePool: creating the D3D11 device failed: 0x%08lx", result);
+        gpu = Gpu();
+      }
+    }
+    return gpu.device ? &gpu : nullptr;
+  }
+
+  static bool CreateTexture(ID3D11Device1* device,
+                            const D3D11_TEXTURE2D_DESC& frameDesc,
+                            Slot& slot) {
+    if (slot.sharedHandle != nullptr) {
+      CloseHandle(slot.sharedHandle);
+      slot.sharedHandle = nullptr;
+    }
+    slot.texture.Reset();
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = frameDesc.Width;
+    desc.Height = frameDesc.Height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = frameDesc.Format;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
+    HRESULT result = device->CreateTexture2D(&desc, nullptr, &slot.texture);
+    Microsoft::WRL::ComPtr<IDXGIResource1> resource;
+    if (SUCCEEDED(result)) {
+      result = slot.texture.As(&resource);
+    }
+    if (SUCCEEDED(result)) {
+      result = resource->CreateSharedHandle(
+          nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr,
+          &slot.sharedHandle);
+    }
+    if (FAILED(result)) {
+      SDL_Log("AcceleratedFramePool: creating a %ux%u slot texture failed: 0x%08lx",
+              desc.Width, desc.Height, result);
+      slot.texture.Reset();
+      slot.sharedHandle = nullptr;
+      return false;
+    }
+    slot.width = desc.Width;
+    slot.height = desc.Height;
+    slot.format = desc.Format;
+    return true;
+  }
+
+  std::vector<Slot> slots;
+  int nextSlot = 0;
+};
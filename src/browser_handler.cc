@@ -1,19 +1,31 @@
 ﻿#include "browser_handler.h"
 #include "browser_process_handler.h"
+#include "pixel_kernels.h"
+#include "process_messages.hpp"
 #include "rpc.hpp"
 #include <rpc.h>
 #include <SDL3/sdl.h>
 #include <include/cef_scheme.h>
+#include <include/base/cef_bind.h>
+#include <include/wrapper/cef_closure_task.h>
 
 #include <windows.h>
 
 using json = nlohmann::json;
 
-BrowserHandler::BrowserHandler(BrowserProcessHandler* browserProcessHandler, CefRect pageRectangle)
+BrowserHandler::BrowserHandler(BrowserProcessHandler* browserProcessHandler,
+                               CefRect pageRectangle,
+                               PaintOptions paintOptions)
     : browserProcessHandler(browserProcessHandler),
       pageRectangle(pageRectangle),
+      paintOptions(paintOptions),
       popupRectangle(NULL),
-      popupVisible(false) {}
+      popupVisible(false),
+      evalMutex(SDL_CreateMutex()) {}
+
+BrowserHandler::~BrowserHandler() {
+  SDL_DestroyMutex(evalMutex);
+}
 
 CefRefPtr<CefBrowser> BrowserHandler::GetBrowser() {
   return this->browser;
@@ -23,6 +35,71 @@ void BrowserHandler::SetBrowser(CefRefPtr<CefBrowser> browser_) {
   this->browser = browser_;
 }
 
+void BrowserHandler::SetCreatedCallback(CreatedCallback callback) {
+  createdCallback = std::move(callback);
+}
+
+void BrowserHandler::SetPooled() {
+  pooled = true;
+}
+
+void BrowserHandler::Claim(CefRect pageRectangle, PaintOptions paintOptions) {
+  this->pageRectangle = pageRectangle;
+  this->paintOptions = paintOptions;
+  pooled = false;
+}
+
+void BrowserHandler::SetHibernated(bool hibernated) {
+  this->hibernated = hibernated;
+}
+
+void BrowserHandler::RestoreScrollOnLoad(int x, int y) {
+  pendingScroll = CefPoint(x, y);
+}
+
+void BrowserHandler::TrackFirstPaint(Uint64 requestNs, LatencyStats& stats) {
+  firstPaintRequestNs = requestNs;
+  firstPaintStats = &stats;
+  addressCommitted = false;
+}
+
+void BrowserHandler::ExpectEvalResponse(const UUID& evalId) {
+  SDL_LockMutex(evalMutex);
+  outstandingEvals.insert(evalId);
+  SDL_UnlockMutex(evalMutex);
+}
+
+bool BrowserHandler::TakeEvalResponse(const UUID& evalId) {
+  SDL_LockMutex(evalMutex);
+  bool expected = outstandingEvals.erase(evalId) > 0;
+  SDL_UnlockMutex(evalMutex);
+  return expected;
+}
+
+void BrowserHandler::FailOutstandingEvals(int browserId, const std::string& reason) {
+  std::unordered_set<UUID> failed;
+  SDL_LockMutex(evalMutex);
+  failed.swap(outstandingEvals);
+  SDL_UnlockMutex(evalMutex);
+  for (const UUID& evalId : failed) {
+    EvalJavaScriptResponse response = {};
+    response.id = evalId;
+    response.browserId = browserId;
+    response.success = false;
+    response.error = EvalJavaScriptError{};
+    response.error->message = reason;
+    browserProcessHandler->SendMessage(response);
+  }
+}
+
+void BrowserHandler::OnFrameSent() {
+  if (firstPaintRequestNs == 0 || !addressCommitted) {
+    return;
+  }
+  firstPaintStats->Record(SDL_GetTicksNS() - firstPaintRequestNs);
+  firstPaintRequestNs = 0;
+}
+
 CefRefPtr<CefRenderHandler> BrowserHandler::GetRenderHandler() {
   return this;
 }
@@ -31,6 +108,70 @@ CefRefPtr<CefDisplayHandler> BrowserHandler::GetDisplayHandler() {
   return this;
 }
 
+CefRefPtr<CefLifeSpanHandler> BrowserHandler::GetLifeSpanHandler() {
+  return this;
+}
+
+CefRefPtr<CefLoadHandler> BrowserHandler::GetLoadHandler() {
+  return this;
+}
+
+CefRefPtr<CefRequestHandler> BrowserHandler::GetRequestHandler() {
+  return this;
+}
+
+void BrowserHandler::OnAfterCreated(CefRefPtr<CefBrowser> browser_) {
+  this->browser = browser_;
+  if (createdCallback) {
+    CreatedCallback callback = std::move(createdCallback);
+    createdCallback = nullptr;
+    callback(browser_);
+  }
+}
+
+// The renderer answers evals in a page it unloads itself, but not when the
+// page moves to another renderer, whose frame the answer cannot reach.
+// Whatever is still outstanding once a new main frame document commits is
+// answered here; the renderer's answers that come later are dropped.
+void BrowserHandler::OnLoadStart(CefRefPtr<CefBrowser> browser_,
+                                 CefRefPtr<CefFrame> frame,
+                                 TransitionType transition_type) {
+  if (frame->IsMain()) {
+    FailOutstandingEvals(browser_->GetIdentifier(),
+                         "page navigated away before the eval finished");
+  }
+}
+
+void BrowserHandler::OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser_,
+                                               TerminationStatus status,
+                                               int error_code,
+                                               const CefString& error_string) {
+  SDL_Log("Render process terminated; id=%d status=%d error=%d %s",
+          browser_->GetIdentifier(), status, error_code, error_string.ToString().c_str());
+  FailOutstandingEvals(browser_->GetIdentifier(),
+                       "render process terminated before the eval finished");
+}
+
+void BrowserHandler::OnLoadEnd(CefRefPtr<CefBrowser> browser_,
+                               CefRefPtr<CefFrame> frame,
+                               int httpStatusCode) {
+  if (!frame->IsMain() || !pendingScroll.has_value() || IsSilent()) {
+    return;
+  }
+  frame->ExecuteJavaScript("window.scrollTo(" + std::to_string(pendingScroll->x) +
+                               ", " + std::to_string(pendingScroll->y) + ");",
+                           frame->GetURL(), 0);
+  pendingScroll.reset();
+}
+
+void BrowserHandler::OnBeforeClose(CefRefPtr<CefBrowser> browser_) {
+  FailOutstandingEvals(browser_->GetIdentifier(), "browser closed before the eval finished");
+  browserProcessHandler->OnBrowserClosed(browser_->GetIdentifier());
+  frameRing.Close();
+  // The browser holds a reference to this handler; drop ours so both go.
+  browser = nullptr;
+}
+
 bool BrowserHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser_,
                                  CefRefPtr<CefFrame> frame,
                                  CefProcessId source_process,
@@ -40,19 +181,89 @@ bool BrowserHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser_,
   if (!args || args->GetSize() == 0) {
     return false;
   }
+  // Answers to client requests go out even while the browser is silent:
+  // hibernating it cancels its pending evals, and the client is waiting.
+  if (name == process_messages::kOnEval) {
+    std::optional<EvalJavaScriptResponse> response =
+        process_messages::ReadEvalResponse(args);
+    if (!response.has_value()) {
+      SDL_Log("BrowserHandler: malformed %s message", process_messages::kOnEval);
+      return true;
+    }
+    if (!TakeEvalResponse(response->id)) {
+      // Already answered when its page went away.
+      return true;
+    }
+    if (response->result.has_value()) {
+      response->result = browserProcessHandler->EncodeEvalResult(response->result.value());
+    }
+    browserProcessHandler->SendMessage(response.value());
+    return true;
+  }
+  if (name == process_messages::kOnEvalBatch) {
+    std::optional<EvalBatchResponse> response =
+        process_messages::ReadEvalBatchResponse(args);
+    if (!response.has_value()) {
+      SDL_Log("BrowserHandler: malformed %s message", process_messages::kOnEvalBatch);
+      return true;
+    }
+    for (EvalBatchResult& result : response->results) {
+      if (result.result.has_value()) {
+        result.result = browserProcessHandler->EncodeEvalResult(result.result.value());
+      }
+    }
+    browserProcessHandler->SendMessage(response.value());
+    return true;
+  }
+  if (name == process_messages::kOnRegisterFunction) {
+    std::optional<RegisterFunctionResponse> response =
+        process_messages::ReadRegisterFunctionResponse(args);
+    if (!response.has_value()) {
+      SDL_Log("BrowserHandler: malformed %s message",
+              process_messages::kOnRegisterFunction);
+      return true;
+    }
+    browserProcessHandler->SendMessage(response.value());
+    return true;
+  }
+  if (name == process_messages::kOnInvokeFunction) {
+    std::optional<InvokeFunctionResponse> response =
+        process_messages::ReadInvokeFunctionResponse(args);
+    if (!response.has_value()) {
+      SDL_Log("BrowserHandler: malformed %s message",
+              process_messages::kOnInvokeFunction);
+      return true;
+    }
+    browserProcessHandler->SendMessage(response.value());
+    return true;
+  }
+  if (name == process_messages::kOnMemoryUsage) {
+    if (args->GetSize() >= 4) {
+      MemoryGovernor::SavedPage page;
+      page.url = frame->GetURL().ToString();
+      page.scrollX = args->GetInt(2);
+      page.scrollY = args->GetInt(3);
+      browserProcessHandler->OnMemorySample(browser_->GetIdentifier(), args->GetInt(0),
+                                            static_cast<uint64_t>(args->GetDouble(1)),
+                                            page);
+    }
+    return true;
+  }
   const bool is_known_message = (name == "RenderProcessHandler.OnNavigate") ||
                                 (name == "RenderProcessHandler.OnMouseOver") ||
                                 (name == "RenderProcessHandler.OnMessage") ||
                                 (name == "RenderProcessHandler.OnFocus") ||
-                                (name == "RenderProcessHandler.OnFocusOut") ||
-                                (name == "RenderProcessHandler.OnEval");
+                                (name == "RenderProcessHandler.OnFocusOut");
 
   if (!is_known_message) {
     return false;
   }
+  if (IsSilent()) {
+    return true;
+  }
   if (args->GetType(0) == VTYPE_STRING) {
     std::string payload = args->GetString(0).ToString();
-    browserProcessHandler->BrowserProcessHandler::SendMessage(payload);
+    browserProcessHandler->ForwardJsonMessage(payload);
     return true;
   }
   return false;
@@ -69,11 +280,159 @@ void BrowserHandler::OnPaint(CefRefPtr<CefBrowser> browser_,
                              const void* buffer,
                              int width,
                              int height) {
-  SDL_Log(
-      "WARNING: BrowserHandler::OnPaint() was called, which means that this "
-      "browser (id: %d) was set up incorrectly, or your machine does not have a "
-      "GPU compatible with Chromium's hardware-accelerated rendering.",
-      browser_->GetIdentifier());
+  if (IsSilent()) {
+    return;
+  }
+  if (!paintOptions.softwareRendering) {
+    SDL_Log(
+        "WARNING: BrowserHandler::OnPaint() was called, which means that this "
+        "browser (id: %d) was set up incorrectly, or your machine does not have a "
+        "GPU compatible with Chromium's hardware-accelerated rendering.",
+        browser_->GetIdentifier());
+    return;
+  }
+  if (type != PET_VIEW) {
+    // Popup widgets are not forwarded in software mode yet.
+    return;
+  }
+
+  CefRect surface(0, 0, width, height);
+  std::vector<CefRect> damage =
+      SimplifyDirtyRects(dirtyRects, surface, paintOptions.maxDirtyRects);
+  DirtyRectStats& damageStats = browserProcessHandler->GetDirtyRectStats();
+  if (paintOptions.skipUnchangedTiles) {
+    uint64_t tilesUnchanged = 0;
+    damage = tileHashes.Filter(static_cast<const uint8_t*>(buffer),
+                               static_cast<size_t>(width) * 4, width, height, damage,
+                               paintOptions.maxDirtyRects, tilesUnchanged);
+    damageStats.tilesUnchanged += tilesUnchanged;
+  }
+  if (damage.empty() && paintOptions.skipEmptyFrames) {
+    damageStats.skippedEmpty++;
+    return;
+  }
+
+  int browserId = browser_->GetIdentifier();
+  if (!frameRing.Matches(width, height)) {
+    int slotCount = browserProcessHandler->GetPaintFlowControl().FramesInFlight() + 1;
+    if (!frameRing.Create(SharedFrameRingName(browserId, ++frameRingGeneration),
+                          width, height, slotCount, paintOptions.thumbnailScale)) {
+      return;
+    }
+    ringSlots.clear();
+  }
+  ReleaseStaleRingSlots();
+  if (frameRing.FreeSlot() < 0) {
+    frameRing.Drop(damage, paintOptions.maxDirtyRects);
+    DropRingFull();
+    return;
+  }
+
+  UUID id;
+  UuidCreate(&id);
+  if (!AdmitFrame(browserId, id)) {
+    frameRing.Drop(damage, paintOptions.maxDirtyRects);
+    return;
+  }
+
+  std::vector<CefRect> copied;
+  SoftwareFrameEvent message;
+  message.id = id;
+  message.browserId = browserId;
+  message.frameNumber = ++softwareFrameNumber;
+  message.sharedMemoryName = frameRing.Name();
+  message.slot = frameRing.Write(buffer, damage, paintOptions.maxDirtyRects, copied);
+  ringSlots[id] = message.slot;
+  ProcessSlot(message.slot, buffer, copied);
+  tileHashes.Commit();
+  message.slotCount = frameRing.SlotCount();
+  message.width = width;
+  message.height = height;
+  message.stride = frameRing.Stride();
+  message.slotSize = frameRing.SlotSize();
+  message.pixelFormat = paintOptions.rgba ? "rgba" : "bgra";
+  message.straightAlpha = paintOptions.straightAlpha;
+  message.thumbnailScale = frameRing.ThumbnailScale();
+  message.thumbnailOffset = frameRing.ThumbnailOffset();
+  message.thumbnailWidth = frameRing.ThumbnailWidth();
+  message.thumbnailHeight = frameRing.ThumbnailHeight();
+  message.thumbnailStride = frameRing.ThumbnailStride();
+  damageStats.Record(dirtyRects.size(), damage, surface);
+  message.dirtyRects = std::move(damage);
+  browserProcessHandler->SendMessage(message);
+  OnFrameSent();
+}
+
+void BrowserHandler::ProcessSlot(int slot,
+                                 const void* buffer,
+                                 const std::vector<CefRect>& copied) {
+  auto convert = [this](uint8_t* pixels, size_t stride, int width, int height) {
+    if (paintOptions.straightAlpha) {
+      pixel_kernels::Unpremultiply(pixels, stride, width, height);
+    }
+    if (paintOptions.rgba) {
+      pixel_kernels::SwapRedBlue(pixels, stride, width, height);
+    }
+  };
+
+  size_t stride = frameRing.Stride();
+  uint8_t* pixels = frameRing.SlotPixels(slot);
+  for (const CefRect& rect : copied) {
+    convert(pixels + rect.y * stride + static_cast<size_t>(rect.x) * 4, stride,
+            rect.width, rect.height);
+  }
+
+  int scale = frameRing.ThumbnailScale();
+  if (scale != 2 && scale != 4) {
+    return;
+  }
+  // Downscale from the untouched premultiplied source, block-aligned.
+  const uint8_t* source = static_cast<const uint8_t*>(buffer);
+  size_t thumbnailStride = frameRing.ThumbnailStride();
+  uint8_t* thumbnail = frameRing.SlotThumbnail(slot);
+  for (const CefRect& rect : copied) {
+    int left = rect.x / scale;
+    int top = rect.y / scale;
+    int right = std::min(frameRing.ThumbnailWidth(),
+                         (rect.x + rect.width + scale - 1) / scale);
+    int bottom = std::min(frameRing.ThumbnailHeight(),
+                          (rect.y + rect.height + scale - 1) / scale);
+    if (right <= left || bottom <= top) {
+      continue;
+    }
+    const uint8_t* src =
+        source + (top * scale) * stride + static_cast<size_t>(left * scale) * 4;
+    uint8_t* dst = thumbnail + top * thumbnailStride + static_cast<size_t>(left) * 4;
+    int srcWidth = (right - left) * scale;
+    int srcHeight = (bottom - top) * scale;
+    if (scale == 2) {
+      pixel_kernels::DownscaleHalf(src, stride, srcWidth, srcHeight, dst, thumbnailStride);
+    } else {
+      pixel_kernels::DownscaleQuarter(src, stride, srcWidth, srcHeight, dst, thumbnailStride);
+    }
+    convert(dst, thumbnailStride, right - left, bottom - top);
+  }
+}
+
+bool BrowserHandler::AdmitFrame(int browserId, const UUID& frameId) {
+  // Never block the UI thread on the client. Once the browser has its
+  // window of unacknowledged frames out, later frames are dropped and a
+  // single repaint follows when the client catches up.
+  PaintFlowControl& flowControl = browserProcessHandler->GetPaintFlowControl();
+  switch (flowControl.TryBegin(browserId, frameId, SDL_GetTicksNS())) {
+    case PaintFlowControl::Admission::Send:
+      return true;
+    case PaintFlowControl::Admission::DropFirst:
+      CefPostDelayedTask(
+          TID_UI,
+          base::BindOnce(&BrowserHandler::RetryDroppedPaint,
+                         CefRefPtr<BrowserHandler>(this)),
+          static_cast<int64_t>(flowControl.AckTimeoutNs() / SDL_NS_PER_MS));
+      return false;
+    case PaintFlowControl::Admission::Drop:
+    default:
+      return false;
+  }
 }
 
 void BrowserHandler::OnAcceleratedPaint(
@@ -81,26 +440,64 @@ void BrowserHandler::OnAcceleratedPaint(
     PaintElementType type,
     const RectList& dirtyRects,
     const CefAcceleratedPaintInfo& info) {
+  if (IsSilent()) {
+    return;
+  }
+  // Popups are not clipped; their rect is not tracked reliably.
+  CefRect surface = type == PET_VIEW
+                        ? CefRect(0, 0, pageRectangle.width, pageRectangle.height)
+                        : CefRect(0, 0, 0, 0);
+  std::vector<CefRect> damage =
+      SimplifyDirtyRects(dirtyRects, surface, paintOptions.maxDirtyRects);
+  DirtyRectStats& damageStats = browserProcessHandler->GetDirtyRectStats();
+  if (damage.empty() && paintOptions.skipEmptyFrames) {
+    damageStats.skippedEmpty++;
+    return;
+  }
+
+  int browserId = browser_->GetIdentifier();
+  if (!texturePool.IsOpen()) {
+    texturePool.Open(browserProcessHandler->GetPaintFlowControl().FramesInFlight() + 1);
+  }
+  ReleaseStaleRingSlots();
+  if (texturePool.FreeSlot() < 0) {
+    // Unlike the frame ring, a texture slot is copied whole, so a dropped
+    // frame leaves no stale damage behind.
+    DropRingFull();
+    return;
+  }
+
   UUID id;
   UuidCreate(&id);
+  if (!AdmitFrame(browserId, id)) {
+    return;
+  }
+
   AcceleratedPaintEvent message;
   message.id = id;
-  message.browserId = browser_->GetIdentifier();
+  message.browserId = browserId;
   message.elementType = type;
   message.format = info.format;
+  damageStats.Record(dirtyRects.size(), damage, surface);
+  message.dirtyRects = std::move(damage);
 
-  // Duplicate the shared texture handle into the application process
-  // (hardcoded PID = 1 for now) before sending it.
-  HANDLE sourceHandle = info.shared_texture_handle;
+  // CEF's texture is gone once this returns, so the client is handed a
+  // runner-owned copy, duplicated into its process, and the slot is held
+  // until the frame is acknowledged.
+  int slot = texturePool.Copy(info.shared_texture_handle);
   std::optional<HANDLE> applicationProcessHandle =
       browserProcessHandler->GetClientProcessHandle();
-  if (!applicationProcessHandle.has_value()) {
+  if (slot < 0) {
+    SDL_Log("Error copying shared texture; browser id=%d", browserId);
+  } else if (!applicationProcessHandle.has_value()) {
     SDL_Log("Error duplicating shared texture: Application process handle not initialized");
+    texturePool.Release(slot);
   } else {
+    textureSlots[id] = slot;
     HANDLE applicationHandle = applicationProcessHandle.value();
     HANDLE duplicateHandle = NULL;
     if (!DuplicateHandle(GetCurrentProcess(),
-                         sourceHandle,
+                         texturePool.SharedHandle(slot),
                          applicationHandle,
                          &duplicateHandle,
                          0,
@@ -111,9 +508,83 @@ void BrowserHandler::OnAcceleratedPaint(
       message.sharedTextureHandle = reinterpret_cast<uintptr_t>(duplicateHandle);
     }
   }
-  json j = message;
-  browserProcessHandler->SendMessage(j.dump());
-  browserProcessHandler->WaitForResponse<Acknowledgement>(id);
+  browserProcessHandler->SendMessage(message);
+  OnFrameSent();
+}
+
+bool BrowserHandler::ReleaseStaleRingSlots() {
+  uint64_t connection = browserProcessHandler->GetConnectionGeneration();
+  if (connection == ringConnection) {
+    return false;
+  }
+  ringConnection = connection;
+  frameRing.ReleaseAll();
+  ringSlots.clear();
+  texturePool.ReleaseAll();
+  textureSlots.clear();
+  return true;
+}
+
+void BrowserHandler::DropRingFull() {
+  // The client still reads every slot, including any whose frames timed
+  // out. Repaint when one is acknowledged.
+  browserProcessHandler->GetPaintFlowControl().CountRingFull();
+  if (!ringRepaintPending) {
+    ringRepaintPending = true;
+    CefPostDelayedTask(
+        TID_UI,
+        base::BindOnce(&BrowserHandler::RetryRingFull, CefRefPtr<BrowserHandler>(this)),
+        static_cast<int64_t>(
+            browserProcessHandler->GetPaintFlowControl().AckTimeoutNs() / SDL_NS_PER_MS));
+  }
+}
+
+void BrowserHandler::OnFrameAcknowledged(const UUID& frameId, bool repaint) {
+  auto it = ringSlots.find(frameId);
+  if (it != ringSlots.end()) {
+    frameRing.Release(it->second);
+    ringSlots.erase(it);
+  }
+  it = textureSlots.find(frameId);
+  if (it != textureSlots.end()) {
+    texturePool.Release(it->second);
+    textureSlots.erase(it);
+  }
+  if (ringRepaintPending && (frameRing.FreeSlot() >= 0 || texturePool.FreeSlot() >= 0)) {
+    ringRepaintPending = false;
+    repaint = true;
+  }
+  if (repaint && browser) {
+    browser->GetHost()->Invalidate(PET_VIEW);
+  }
+}
+
+void BrowserHandler::RetryRingFull() {
+  if (!browser || !ringRepaintPending) {
+    return;
+  }
+  // A live client frees slots by acknowledging frames; only a disconnect
+  // leaves them held for good.
+  if (ReleaseStaleRingSlots()) {
+    ringRepaintPending = false;
+    browser->GetHost()->Invalidate(PET_VIEW);
+    return;
+  }
+  CefPostDelayedTask(
+      TID_UI,
+      base::BindOnce(&BrowserHandler::RetryRingFull, CefRefPtr<BrowserHandler>(this)),
+      static_cast<int64_t>(
+          browserProcessHandler->GetPaintFlowControl().AckTimeoutNs() / SDL_NS_PER_MS));
+}
+
+void BrowserHandler::RetryDroppedPaint() {
+  if (!browser) {
+    return;
+  }
+  if (browserProcessHandler->GetPaintFlowControl().TakeRepaint(
+          browser->GetIdentifier())) {
+    browser->GetHost()->Invalidate(PET_VIEW);
+  }
 }
 
 
@@ -142,26 +613,33 @@ void BrowserHandler::OnPopupSize(CefRefPtr<CefBrowser> browser_,
 void BrowserHandler::OnAddressChange(CefRefPtr<CefBrowser> browser_,
                                     CefRefPtr<CefFrame> frame,
                                     const CefString& url) {
+  if (IsSilent()) {
+    return;
+  }
+  if (frame->IsMain()) {
+    addressCommitted = true;
+  }
   UUID id;
   UuidCreate(&id);
   AddressChangeEvent message;
   message.id = id;
   message.browserId = browser_->GetIdentifier();
   message.url = url.ToString();
-  json j = message;
-  browserProcessHandler->SendMessage(j.dump());
+  browserProcessHandler->SendMessage(message);
 }
 
 void BrowserHandler::OnTitleChange(CefRefPtr<CefBrowser> browser_,
                                    const CefString& title) {
+  if (IsSilent()) {
+    return;
+  }
   UUID id;
   UuidCreate(&id);
   TitleChangeEvent message;
   message.id = id;
   message.browserId = browser_->GetIdentifier();
   message.title = title.ToString();
-  json j = message;
-  browserProcessHandler->SendMessage(j.dump());
+  browserProcessHandler->SendMessage(message);
 }
 
 bool BrowserHandler::OnConsoleMessage(CefRefPtr<CefBrowser> browser_,
@@ -169,6 +647,9 @@ bool BrowserHandler::OnConsoleMessage(CefRefPtr<CefBrowser> browser_,
                                       const CefString& message,
                                       const CefString& source,
                                       int line) {
+  if (IsSilent()) {
+    return false;
+  }
   UUID id;
   UuidCreate(&id);
   ConsoleMessageEvent msg;
@@ -178,27 +659,31 @@ bool BrowserHandler::OnConsoleMessage(CefRefPtr<CefBrowser> browser_,
   msg.message = message.ToString();
   msg.source = source.ToString();
   msg.line = line;
-  json j = msg;
-  browserProcessHandler->SendMessage(j.dump());
+  browserProcessHandler->SendMessage(msg);
   return true;
 }
 
 void BrowserHandler::OnLoadingProgressChange(CefRefPtr<CefBrowser> browser_,
                                               double progress) {
+  if (IsSilent()) {
+    return;
+  }
   UUID id;
   UuidCreate(&id);
   LoadingProgressChangeEvent message;
   message.id = id;
   message.browserId = browser_->GetIdentifier();
   message.progress = progress;
-  json j = message;
-  browserProcessHandler->SendMessage(j.dump());
+  browserProcessHandler->SendMessage(message);
 }
 
 bool BrowserHandler::OnCursorChange(CefRefPtr<CefBrowser> browser_,
                                     CefCursorHandle cursor,
                                     cef_cursor_type_t type,
                                     const CefCursorInfo& custom_cursor_info) {
+  if (IsSilent()) {
+    return false;
+  }
   UUID id;
   UuidCreate(&id);
   CursorChangeEvent message;
@@ -206,7 +691,6 @@ bool BrowserHandler::OnCursorChange(CefRefPtr<CefBrowser> browser_,
   message.browserId = browser_->GetIdentifier();
   message.cursorHandle = reinterpret_cast<uintptr_t>(cursor);
   message.cursorType = static_cast<int>(type);
-  json j = message;
-  browserProcessHandler->SendMessage(j.dump());
+  browserProcessHandler->SendMessage(message);
   return true;
 }
\ No newline at end of file
@@ -4,24 +4,80 @@
 
 #pragma once
 
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "include/cef_client.h"
+#include "accelerated_frame_pool.hpp"
 #include "browser_process_handler.h"
+#include "dirty_rects.hpp"
+#include "guid_ext.hpp"
+#include "latency_stats.hpp"
+#include "shared_frame_ring.hpp"
 #include "thread_safe_queue.hpp"
 #include "rpc.hpp"
 
-class BrowserHandler : public CefClient, CefRenderHandler, CefDisplayHandler  {
+// Per-browser paint settings, taken from the CreateBrowserRequest.
+struct PaintOptions {
+  size_t maxDirtyRects = kDefaultMaxDirtyRects;
+  bool skipEmptyFrames = false;
+  bool softwareRendering = false;
+  // Pixel processing applied to software frames before they are published.
+  bool rgba = false;
+  bool straightAlpha = false;
+  int thumbnailScale = 0;
+  bool skipUnchangedTiles = false;
+};
+
+class BrowserHandler : public CefClient,
+                       CefRenderHandler,
+                       CefDisplayHandler,
+                       CefLifeSpanHandler,
+                       CefLoadHandler,
+                       CefRequestHandler {
  public:
-  BrowserHandler(BrowserProcessHandler* browserProcessHandler, CefRect pageRectangle);
+  // Receives the browser once CEF has created it.
+  using CreatedCallback = std::function<void(CefRefPtr<CefBrowser> browser)>;
+
+  BrowserHandler(BrowserProcessHandler* browserProcessHandler,
+                 CefRect pageRectangle,
+                 PaintOptions paintOptions);
+  ~BrowserHandler();
 
   CefRefPtr<CefBrowser> GetBrowser();
   void SetBrowser(CefRefPtr<CefBrowser> browser);
-  void Eval(EvalJavaScriptRequest evalRequest);
+  void SetCreatedCallback(CreatedCallback callback);
+  // Records an eval about to be sent to the renderer, so that it is
+  // answered even if the renderer never does.
+  void ExpectEvalResponse(const UUID& evalId);
+  // Repaints if frames were dropped and no acknowledgement has arrived since.
+  void RetryDroppedPaint();
+  // The client is done with a software frame: frees its frame ring slot and
+  // repaints if |repaint| or if frames were dropped for want of a slot.
+  void OnFrameAcknowledged(const UUID& frameId, bool repaint);
+  // A pooled browser is hidden and sends nothing to the client until it is
+  // claimed for a CreateBrowserRequest.
+  void SetPooled();
+  void Claim(CefRect pageRectangle, PaintOptions paintOptions);
+  // A hibernated browser shows about:blank in place of its page and, like a
+  // pooled one, sends nothing to the client.
+  void SetHibernated(bool hibernated);
+  // Scrolls to (|x|, |y|) once the next main frame load ends.
+  void RestoreScrollOnLoad(int x, int y);
+  // Records the time from |requestNs| to the first frame after the main
+  // frame's next address change in |stats|.
+  void TrackFirstPaint(Uint64 requestNs, LatencyStats& stats);
 
   // CefClient:
   CefRefPtr<CefRenderHandler> GetRenderHandler() override;
   CefRefPtr<CefDisplayHandler> GetDisplayHandler() override;
+  CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override;
+  CefRefPtr<CefLoadHandler> GetLoadHandler() override;
+  CefRefPtr<CefRequestHandler> GetRequestHandler() override;
   bool OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
                                 CefRefPtr<CefFrame> frame,
                                 CefProcessId source_process,
@@ -67,12 +123,79 @@ class BrowserHandler : public CefClient, CefRenderHandler, CefDisplayHandler  {
                           cef_cursor_type_t type,
                       const CefCursorInfo& custom_cursor_info) override;
 
+  // CefLifeSpanHandler:
+  void OnAfterCreated(CefRefPtr<CefBrowser> browser) override;
+  void OnBeforeClose(CefRefPtr<CefBrowser> browser) override;
+
+  // CefLoadHandler:
+  void OnLoadStart(CefRefPtr<CefBrowser> browser,
+                   CefRefPtr<CefFrame> frame,
+                   TransitionType transition_type) override;
+  void OnLoadEnd(CefRefPtr<CefBrowser> browser,
+                 CefRefPtr<CefFrame> frame,
+                 int httpStatusCode) override;
+
+  // CefRequestHandler:
+  void OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser,
+                                 TerminationStatus status,
+                                 int error_code,
+                                 const CefString& error_string) override;
+
  private:
+  // Applies paint flow control to a frame about to be sent.
+  bool AdmitFrame(int browserId, const UUID& frameId);
+  // True while nothing may be sent to the client for this browser.
+  bool IsSilent() const { return pooled || hibernated; }
+  void OnFrameSent();
+  // Forgets an expected eval. Returns false if it was not expected, i.e. it
+  // was already failed and the renderer's answer is late.
+  bool TakeEvalResponse(const UUID& evalId);
+  // Answers every expected eval with |reason| as its error.
+  void FailOutstandingEvals(int browserId, const std::string& reason);
+  // Frees every frame ring and texture pool slot if the client they were
+  // sent to has disconnected, as their acknowledgements will never come.
+  // Returns whether it did.
+  bool ReleaseStaleRingSlots();
+  // Drops a frame for want of a free slot and arms RetryRingFull().
+  void DropRingFull();
+  // Repaints once slots are freed after a drop for want of one.
+  void RetryRingFull();
+  // Runs the pixel kernels selected in |paintOptions| over the freshly
+  // copied parts of a frame ring slot.
+  void ProcessSlot(int slot, const void* buffer, const std::vector<CefRect>& copied);
+
   BrowserProcessHandler* browserProcessHandler;
   CefRefPtr<CefBrowser> browser;
+  CreatedCallback createdCallback;
   CefRect pageRectangle;
+  PaintOptions paintOptions;
+  // Software rendering only.
+  SharedFrameRing frameRing;
+  TileHashGrid tileHashes;
+  int frameRingGeneration = 0;
+  // Frames holding a ring slot until acknowledged, and the connection they
+  // were sent on.
+  std::unordered_map<UUID, int> ringSlots;
+  uint64_t ringConnection = 0;
+  bool ringRepaintPending = false;
+  uint64_t softwareFrameNumber = 0;
+  // Accelerated rendering only: copies of CEF's textures, and the frames
+  // holding one until acknowledged. Freed along with the ring slots.
+  AcceleratedFramePool texturePool;
+  std::unordered_map<UUID, int> textureSlots;
   CefRect* popupRectangle;
   bool popupVisible;
+  bool pooled = false;
+  bool hibernated = false;
+  std::optional<CefPoint> pendingScroll;
+  // First paint tracking; zero once reported.
+  Uint64 firstPaintRequestNs = 0;
+  LatencyStats* firstPaintStats = nullptr;
+  bool addressCommitted = false;
+  // Evals sent to the renderer and not answered yet. Added to on the RPC
+  // workers, taken from on the UI thread.
+  SDL_Mutex* evalMutex;
+  std::unordered_set<UUID> outstandingEvals;
 
   IMPLEMENT_REFCOUNTING(BrowserHandler);
 };
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <SDL3/sdl.h>
+#include "include/cef_browser.h"
+#include "json.hpp"
+#include "latency_stats.hpp"
+
+using json = nlohmann::json;
+
+// What a warm browser must have in common with a CreateBrowserRequest to
+// serve it: everything that is fixed once a browser exists, including its
+// request context. Paint options, frame rate and position are applied when
+// the browser is claimed.
+struct BrowserPoolKey {
+  int width = 0;
+  int height = 0;
+  bool softwareRendering = false;
+  bool externalBeginFrame = false;
+  std::string partition;
+  bool partitionOnDisk = false;
+
+  bool operator<(const BrowserPoolKey& other) const {
+    return std::tie(width, height, softwareRendering, externalBeginFrame, partition,
+                    partitionOnDisk) <
+           std::tie(other.width, other.height, other.softwareRendering,
+                    other.externalBeginFrame, other.partition, other.partitionOnDisk);
+  }
+
+  std::string ToString() const {
+    std::string s = std::to_string(width) + "x" + std::to_string(height);
+    if (softwareRendering) {
+      s += ",software";
+    }
+    if (externalBeginFrame) {
+      s += ",externalBeginFrame";
+    }
+    if (!partition.empty()) {
+      s += (partitionOnDisk ? ",disk:" : ",memory:") + partition;
+    }
+    return s;
+  }
+};
+
+// Parses a comma-separated list of WxH sizes, e.g. "1280x720,1920x1080".
+// Malformed entries are logged and skipped.
+inline std::vector<BrowserPoolKey> ParseBrowserPoolSizes(const std::string& value) {
+  std::vector<BrowserPoolKey> keys;
+  size_t start = 0;
+  while (start < value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    std::string entry = value.substr(start, end - start);
+    BrowserPoolKey key;
+    if (sscanf(entry.c_str(), "%dx%d", &key.width, &key.height) == 2 &&
+        key.width > 0 && key.height > 0) {
+      keys.push_back(key);
+    } else if (!entry.empty()) {
+      SDL_Log("Ignoring invalid browser pool size '%s'", entry.c_str());
+    }
+    start = end + 1;
+  }
+  return keys;
+}
+
+// Hidden about:blank browsers created ahead of time, so a CreateBrowserRequest
+// can take one and navigate it instead of waiting for a new browser (and
+// possibly a new renderer process).
+//
+// The pool keeps up to Size() warm browsers for every key it has been asked
+// for, up to kMaxKeys keys. The owner creates the browsers: it asks
+// NextDeficit() which key to create one for, then hands the result to Add()
+// or reports the failure with Abandon().
+//
+// The pool itself is used on the CEF UI thread; metrics may be read from
+// any thread.
+class BrowserPool {
+ public:
+  static constexpr size_t kMaxKeys = 8;
+
+  BrowserPool() : mutex(SDL_CreateMutex()) {}
+  ~BrowserPool() { SDL_DestroyMutex(mutex); }
+  BrowserPool(const BrowserPool&) = delete;
+  BrowserPool& operator=(const BrowserPool&) = delete;
+
+  // Number of warm browsers to keep per key; 0 disables the pool.
+  void Configure(int size) { this->size = std::max(0, size); }
+  int Size() const { return size; }
+
+  // Starts keeping browsers warm for |key|. Returns false if the pool is
+  // disabled or already serves kMaxKeys keys.
+  bool Want(const BrowserPoolKey& key) {
+    if (size == 0) {
+      return false;
+    }
+    SDL_LockMutex(mutex);
+    bool wanted = entries.count(key) != 0;
+    if (!wanted && entries.size() < kMaxKeys) {
+      entries[key];
+      wanted = true;
+    }
+    SDL_UnlockMutex(mutex);
+    return wanted;
+  }
+
+  // Takes a warm browser for |key|, or returns nullptr (and starts keeping
+  // |key| warm for next time). Browsers that closed while warm are
+  // discarded, not handed out.
+  CefRefPtr<CefBrowser> Claim(const BrowserPoolKey& key) {
+    if (size == 0) {
+      return nullptr;
+    }
+    Want(key);
+    CefRefPtr<CefBrowser> browser;
+    SDL_LockMutex(mutex);
+    auto it = entries.find(key);
+    while (!browser && it != entries.end() && !it->second.warm.empty()) {
+      browser = it->second.warm.front();
+      it->second.warm.pop_front();
+      if (!browser->IsValid() || !browser->GetHost()) {
+        browser = nullptr;
+        lost++;
+      }
+    }
+    SDL_UnlockMutex(mutex);
+    if (browser) {
+      hits++;
+    } else {
+      misses++;
+    }
+    return browser;
+  }
+
+  // Returns a key that is short of warm browsers, counting it as being
+  // refilled until Add() or Abandon() is called for it.
+  std::optional<BrowserPoolKey> NextDeficit() {
+    std::optional<BrowserPoolKey> key;
+    SDL_LockMutex(mutex);
+    for (auto& it : entries) {
+      if (static_cast<int>(it.second.warm.size()) + it.second.creating < size) {
+        it.second.creating++;
+        key = it.first;
+        break;
+      }
+    }
+    SDL_UnlockMutex(mutex);
+    return key;
+  }
+
+  void Add(const BrowserPoolKey& key, CefRefPtr<CefBrowser> browser) {
+    SDL_LockMutex(mutex);
+    Entry& entry = entries[key];
+    entry.creating = std::max(0, entry.creating - 1);
+    entry.warm.push_back(browser);
+    SDL_UnlockMutex(mutex);
+    created++;
+  }
+
+  void Abandon(const BrowserPoolKey& key) {
+    SDL_LockMutex(mutex);
+    Entry& entry = entries[key];
+    entry.creating = std::max(0, entry.creating - 1);
+    SDL_UnlockMutex(mutex);
+    failed++;
+  }
+
+  // Forgets a warm browser that is closing, e.g. because its renderer
+  // process died. Returns false if it was not in the pool.
+  bool Remove(int browserId) {
+    bool removed = false;
+    SDL_LockMutex(mutex);
+    for (auto& it : entries) {
+      std::deque<CefRefPtr<CefBrowser>>& warm = it.second.warm;
+      auto found = std::find_if(warm.begin(), warm.end(),
+                                [browserId](const CefRefPtr<CefBrowser>& browser) {
+                                  return browser->GetIdentifier() == browserId;
+                                });
+      if (found != warm.end()) {
+        warm.erase(found);
+        removed = true;
+        break;
+      }
+    }
+    SDL_UnlockMutex(mutex);
+    if (removed) {
+      lost++;
+    }
+    return removed;
+  }
+
+  // Time from a CreateBrowserRequest to the first frame of its page.
+  LatencyStats& FirstPaintStats(bool pooled) {
+    return pooled ? pooledLatency : coldLatency;
+  }
+
+  json CollectMetrics() {
+    json warm = json::object();
+    SDL_LockMutex(mutex);
+    for (const auto& it : entries) {
+      warm[it.first.ToString()] = it.second.warm.size();
+    }
+    SDL_UnlockMutex(mutex);
+    return {
+        {"size", size},
+        {"warm", warm},
+        {"hits", hits.load()},
+        {"misses", misses.load()},
+        {"created", created.load()},
+        {"failed", failed.load()},
+        {"lost", lost.load()},
+        {"pooledFirstPaint", pooledLatency.CollectMetrics()},
+        {"coldFirstPaint", coldLatency.CollectMetrics()},
+    };
+  }
+
+ private:
+  struct Entry {
+    std::deque<CefRefPtr<CefBrowser>> warm;
+    int creating = 0;
+  };
+
+  int size = 0;
+  SDL_Mutex* mutex;
+  std::map<BrowserPoolKey, Entry> entries;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> created{0};
+  std::atomic<uint64_t> failed{0};
+  // Warm browsers that closed before being claimed.
+  std::atomic<uint64_t> lost{0};
+  LatencyStats pooledLatency;
+  LatencyStats coldLatency;
+};
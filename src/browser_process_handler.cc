@@ -1,14 +1,18 @@
-﻿#include <iostream>
+﻿#include <algorithm>
+#include <cctype>
+#include <iostream>
 #include <stdio.h>
 #include <thread>
 #include <mutex>
 #include <queue>
 #include <condition_variable>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <windows.h>
 
 #include <include/base/cef_callback.h>
+#include <include/cef_command_line.h>
 #include <include/cef_task.h>
 #include <include/base/cef_bind.h>
 #include <include/wrapper/cef_closure_task.h>
@@ -18,25 +22,119 @@
 
 #include "browser_handler.h"
 #include "browser_process_handler.h"
+#include "command_line_switches.h"
+#include "frame_reader.hpp"
+#include "pixel_kernels.h"
+#include "process_messages.hpp"
 #include "rpc.hpp"
+#include "rpc_dispatcher.hpp"
 #include "thread_safe_queue.hpp"
 #include "guid_ext.hpp"
+#include "wire_encoding.hpp"
 
 using json = nlohmann::json;
 
-const char kEvalMessage[] = "Eval";
+
+// Upper bound on how long the reader sleeps before noticing that the writer
+// thread saw the connection fail.
+const Sint32 kSocketFailureCheckMs = 1000;
+// Slice length used while flushing writes SDL_net had to queue.
+const Sint32 kSocketDrainSliceMs = 10;
+const int kDefaultWindowlessFrameRate = 30;
+// Delay before creating a warm browser, so the refill does not compete
+// with the first paints of the browser that was just handed out.
+const int64_t kBrowserPoolRefillDelayMs = 100;
+// Frame rate of hidden browsers, which only matters once they are shown.
+const int kHiddenWindowlessFrameRate = 1;
+// Chromium's upper bound for windowless_frame_rate.
+const int kMaxWindowlessFrameRate = 60;
+// Weight of the newest interval in the smoothed BeginFrame interval.
+const double kBeginFrameIntervalSmoothing = 0.2;
+// Cap on the number of dispatch workers picked from the core count when
+// --rpc-dispatch-workers is not given.
+const int kMaxDefaultDispatchWorkers = 8;
+
+namespace {
+
+int GetIntSwitch(CefRefPtr<CefCommandLine> commandLine,
+                 const char* name,
+                 int defaultValue) {
+  std::string value = commandLine->GetSwitchValue(name).ToString();
+  if (value.empty()) {
+    return defaultValue;
+  }
+  try {
+    return std::stoi(value);
+  } catch (const std::exception&) {
+    SDL_Log("Ignoring invalid value '%s' for --%s", value.c_str(), name);
+    return defaultValue;
+  }
+}
+
+// Partition names become directory names, so anything but [A-Za-z0-9-] is
+// escaped as _XX (including "_", so distinct names stay distinct).
+std::string PartitionDirectoryName(const std::string& partition) {
+  static const char kHex[] = "0123456789abcdef";
+  std::string name;
+  for (unsigned char c : partition) {
+    if (isalnum(c) || c == '-') {
+      name += static_cast<char>(c);
+    } else {
+      name += '_';
+      name += kHex[c >> 4];
+      name += kHex[c & 15];
+    }
+  }
+  return name;
+}
+
+// Consecutive moves collapse to the latest position. A leave is kept
+// separate from ordinary moves so it is never lost.
+bool CoalesceMouseMove(MouseMoveEvent& pending, const MouseMoveEvent& next) {
+  if (pending.mouseLeave != next.mouseLeave) {
+    return false;
+  }
+  pending = next;
+  return true;
+}
+
+// Consecutive wheel events with the same modifiers accumulate their deltas
+// at the latest position.
+bool CoalesceMouseWheel(MouseWheelEvent& pending, const MouseWheelEvent& next) {
+  if (pending.mouseEvent.modifiers != next.mouseEvent.modifiers) {
+    return false;
+  }
+  pending.id = next.id;
+  pending.mouseEvent = next.mouseEvent;
+  pending.deltaX += next.deltaX;
+  pending.deltaY += next.deltaY;
+  return true;
+}
+
+}  // namespace
 
 BrowserProcessHandler::BrowserProcessHandler()
     : clientProcessHandle(std::nullopt),
+      wireEncoding(WireEncoding::Json),
+      structuredResults(false),
       incomingMessageQueue(),
       outgoingMessageQueue(),
-      responseMapMutex(SDL_CreateMutex()),
       socketServer(NULL),
-      browsers() {}
+      streamSocket(nullptr),
+      streamSocketFailed(false),
+      socketMutex(SDL_CreateMutex()),
+      socketCond(SDL_CreateCondition()),
+      framePacingMutex(SDL_CreateMutex()) {
+  RegisterRpcHandlers();
+}
 
 BrowserProcessHandler::~BrowserProcessHandler() {
-  SDL_DestroyMutex(responseMapMutex);
-  responseMapMutex = nullptr;
+  SDL_DestroyCondition(socketCond);
+  socketCond = nullptr;
+  SDL_DestroyMutex(socketMutex);
+  socketMutex = nullptr;
+  SDL_DestroyMutex(framePacingMutex);
+  framePacingMutex = nullptr;
 }
 
 NET_Server* BrowserProcessHandler::GetSocketServer() {
@@ -44,11 +142,19 @@ NET_Server* BrowserProcessHandler::GetSocketServer() {
 }
 
 CefRefPtr<CefBrowser> BrowserProcessHandler::GetBrowser(int browserId) {
-  auto it = browsers.find(browserId);
-  if (it != browsers.end()) {
-    return it->second;
-  }
-  return nullptr;
+  return browsers.Get(browserId);
+}
+
+PaintFlowControl& BrowserProcessHandler::GetPaintFlowControl() {
+  return paintFlowControl;
+}
+
+DirtyRectStats& BrowserProcessHandler::GetDirtyRectStats() {
+  return dirtyRectStats;
+}
+
+uint64_t BrowserProcessHandler::GetConnectionGeneration() const {
+  return connectionGeneration.load();
 }
 
 CefRefPtr<CefBrowserProcessHandler> BrowserProcessHandler::GetBrowserProcessHandler() {
@@ -71,6 +177,59 @@ void BrowserProcessHandler::OpenClientProcessHandle(int processId) {
 void BrowserProcessHandler::OnContextInitialized() {
   this->CefBrowserProcessHandler::OnContextInitialized();
 
+  CefRefPtr<CefCommandLine> commandLine =
+      CefCommandLine::GetGlobalCommandLine();
+  writerOptions.maxBatchFrames =
+      std::max(1, GetIntSwitch(commandLine, switches::kRpcMaxBatchFrames,
+                               writerOptions.maxBatchFrames));
+  writerOptions.maxBatchBytes = static_cast<size_t>(
+      std::max(1, GetIntSwitch(commandLine, switches::kRpcMaxBatchBytes,
+                               static_cast<int>(writerOptions.maxBatchBytes))));
+  writerOptions.maxLingerMs =
+      std::max(0, GetIntSwitch(commandLine, switches::kRpcMaxLingerMs,
+                               writerOptions.maxLingerMs));
+  paintFlowControl.Configure(
+      GetIntSwitch(commandLine, switches::kPaintFramesInFlight,
+                   PaintFlowControl::kDefaultFramesInFlight),
+      SDL_MS_TO_NS(static_cast<Uint64>(std::max(
+          1, GetIntSwitch(commandLine, switches::kPaintAckTimeoutMs,
+                          static_cast<int>(PaintFlowControl::kDefaultAckTimeoutNs /
+                                           SDL_NS_PER_MS))))));
+  externalBeginFrameDefault =
+      commandLine->HasSwitch(switches::kExternalBeginFrameEnabled);
+  requestContextPerBrowser =
+      commandLine->HasSwitch(switches::kRequestContextPerBrowser);
+  requestContextSharedCache =
+      commandLine->HasSwitch(switches::kRequestContextSharedCache);
+  browserPool.Configure(GetIntSwitch(commandLine, switches::kBrowserPoolSize, 0));
+  for (BrowserPoolKey key : ParseBrowserPoolSizes(
+           commandLine->GetSwitchValue(switches::kBrowserPoolPrewarm).ToString())) {
+    key.externalBeginFrame = externalBeginFrameDefault;
+    browserPool.Want(key);
+  }
+  ScheduleBrowserPoolRefill();
+  memoryGovernor.Configure(
+      static_cast<uint64_t>(std::max(
+          0, GetIntSwitch(commandLine, switches::kRendererMemoryBudgetMb, 0))) *
+      1024 * 1024);
+  memorySampleIntervalMs = std::max(
+      100, GetIntSwitch(commandLine, switches::kMemorySampleIntervalMs,
+                        memorySampleIntervalMs));
+  if (memoryGovernor.BudgetBytes() > 0) {
+    CefPostDelayedTask(TID_UI,
+                       base::BindOnce(&BrowserProcessHandler::SampleMemory,
+                                      CefRefPtr<BrowserProcessHandler>(this)),
+                       memorySampleIntervalMs);
+  }
+  inputCoalescingWindowMs = GetIntSwitch(
+      commandLine, switches::kInputCoalescingWindowMs, inputCoalescingWindowMs);
+  dispatcher.SetCoalescingWindow(
+      [this](int browserId) { return GetInputCoalescingWindowNs(browserId); });
+  int defaultDispatchWorkers =
+      std::clamp(SDL_GetNumLogicalCPUCores() / 2, 1, kMaxDefaultDispatchWorkers);
+  dispatcher.Start(GetIntSwitch(commandLine, switches::kRpcDispatchWorkers,
+                                defaultDispatchWorkers));
+
   if (!SDL_Init(SDL_INIT_EVENTS)) {
     SDL_Log(SDL_GetError());
     abort();
@@ -95,6 +254,12 @@ void BrowserProcessHandler::OnContextInitialized() {
     abort();
   }
 
+  SDL_Thread* writerThread = SDL_CreateThread(RpcWriterThread, "CefRpcWriter", this);
+  if (writerThread == NULL) {
+    SDL_Log("Failed creating RPC writer thread: %s", SDL_GetError());
+    abort();
+  }
+
   SDL_Thread* workerThread = SDL_CreateThread(RpcWorkerThread, "CefRpcWorker", this);
   if (workerThread == NULL) {
     SDL_Log("Failed creating RPC worker thread: %s", SDL_GetError());
@@ -103,170 +268,567 @@ void BrowserProcessHandler::OnContextInitialized() {
 }
 
 void BrowserProcessHandler::CreateBrowserRpc(const CreateBrowserRequest& request) {
+  Uint64 requestNs = SDL_GetTicksNS();
+  BrowserPoolKey key;
+  key.width = request.rectangle.width;
+  key.height = request.rectangle.height;
+  key.softwareRendering = request.softwareRendering;
+  key.externalBeginFrame =
+      request.externalBeginFrame.value_or(externalBeginFrameDefault);
+  key.partition = request.partition.value_or("");
+  key.partitionOnDisk = request.partitionOnDisk;
+  int frameRate = std::clamp(request.frameRate.value_or(kDefaultWindowlessFrameRate),
+                             1, kMaxWindowlessFrameRate);
+
+  PaintOptions paintOptions;
+  if (request.maxDirtyRects.has_value()) {
+    paintOptions.maxDirtyRects =
+        static_cast<size_t>(std::max(1, request.maxDirtyRects.value()));
+  }
+  paintOptions.skipEmptyFrames = request.skipEmptyFrames;
+  paintOptions.softwareRendering = request.softwareRendering;
+  paintOptions.rgba = request.pixelFormat == "rgba";
+  paintOptions.straightAlpha = request.straightAlpha;
+  if (request.thumbnailScale == 2 || request.thumbnailScale == 4) {
+    paintOptions.thumbnailScale = request.thumbnailScale;
+  } else if (request.thumbnailScale != 0) {
+    SDL_Log("CreateBrowserRequest: ignoring unsupported thumbnailScale %d",
+            request.thumbnailScale);
+  }
+  paintOptions.skipUnchangedTiles = request.skipUnchangedTiles;
+
+  CefRefPtr<CefBrowser> browser = browserPool.Claim(key);
+  if (browser) {
+    CefRefPtr<BrowserHandler> client =
+        static_cast<BrowserHandler*>(browser->GetHost()->GetClient().get());
+    client->Claim(request.rectangle, paintOptions);
+    client->TrackFirstPaint(requestNs, browserPool.FirstPaintStats(true));
+    CefRefPtr<CefBrowserHost> host = browser->GetHost();
+    host->SetWindowlessFrameRate(frameRate);
+    host->WasHidden(false);
+    browser->GetMainFrame()->LoadURL(request.url);
+    OnBrowserCreated(request, key, frameRate, true, browser);
+  } else {
+    // The response is sent from OnAfterCreated, so a burst of creations
+    // overlaps instead of queueing behind each other on the UI thread.
+    CefRefPtr<BrowserHandler> client =
+        new BrowserHandler(this, request.rectangle, paintOptions);
+    client->TrackFirstPaint(requestNs, browserPool.FirstPaintStats(false));
+    client->SetCreatedCallback(
+        [this, request, key, frameRate, requestNs](CefRefPtr<CefBrowser> created) {
+          createBrowserLatency.Record(SDL_GetTicksNS() - requestNs);
+          OnBrowserCreated(request, key, frameRate, false, created);
+        });
+    pendingBrowserCreations++;
+    if (!CreateBrowserFor(key, frameRate, request.rectangle, client, request.url)) {
+      SDL_Log("CreateBrowser failed; url=%s", request.url.c_str());
+      pendingBrowserCreations--;
+      CreateBrowserResponse response;
+      response.id = request.id;
+      response.browserId = -1;
+      SendMessage(response);
+    }
+  }
+  ScheduleBrowserPoolRefill();
+  createBrowserUiTime.Record(SDL_GetTicksNS() - requestNs);
+}
+
+void BrowserProcessHandler::OnBrowserCreated(const CreateBrowserRequest& request,
+                                             const BrowserPoolKey& key,
+                                             int frameRate,
+                                             bool fromPool,
+                                             CefRefPtr<CefBrowser> browser) {
+  if (!fromPool) {
+    pendingBrowserCreations--;
+  }
+  int browserId = browser->GetIdentifier();
+  browsers.Add(browserId, browser);
+  memoryGovernor.Track(browserId, SDL_GetTicksNS());
+  SetFramePacing(browserId, key.externalBeginFrame, frameRate);
+  SDL_Log("Created browser on UI thread; id=%d url=%s pooled=%d", browserId,
+          request.url.c_str(), fromPool ? 1 : 0);
+  CreateBrowserResponse response;
+  response.id = request.id;
+  response.browserId = browserId;
+  SendMessage(response);
+}
+
+bool BrowserProcessHandler::CreateBrowserFor(
+    const BrowserPoolKey& key,
+    int frameRate,
+    const CefRect& rectangle,
+    CefRefPtr<BrowserHandler> client,
+    const std::string& url) {
   CefWindowInfo windowInfo;
   windowInfo.SetAsWindowless(nullptr);  // no OS parent
   windowInfo.windowless_rendering_enabled = true;
-  windowInfo.shared_texture_enabled = true;
-  windowInfo.bounds = request.rectangle;
+  windowInfo.shared_texture_enabled = !key.softwareRendering;
+  windowInfo.bounds = rectangle;
+  windowInfo.external_begin_frame_enabled = key.externalBeginFrame;
 
   CefBrowserSettings browserSettings;
-  browserSettings.windowless_frame_rate = 30;
+  browserSettings.windowless_frame_rate = frameRate;
 
-  CefRefPtr<CefRequestContext> requestContext =
-      CefRequestContext::CreateContext(CefRequestContextSettings(), nullptr);
+  CefRefPtr<CefRequestContext> requestContext = GetRequestContext(key);
   CefRefPtr<CefDictionaryValue> extraInfo = CefDictionaryValue::Create();
 
-  CefRefPtr<BrowserHandler> client = new BrowserHandler(this, request.rectangle);
-
-  CefRefPtr<CefBrowser> browser = CefBrowserHost::CreateBrowserSync(
+  return CefBrowserHost::CreateBrowser(
       windowInfo,
       client,
-      request.url,
+      url,
       browserSettings,
       extraInfo, 
       requestContext);
+}
 
-  client->SetBrowser(browser);
+CefRefPtr<CefRequestContext> BrowserProcessHandler::GetRequestContext(
+    const BrowserPoolKey& key) {
+  CefRefPtr<CefRequestContext> globalContext = CefRequestContext::GetGlobalContext();
+  if (key.partition.empty()) {
+    if (!requestContextPerBrowser) {
+      return globalContext;
+    }
+    requestContextsCreated++;
+    if (requestContextSharedCache) {
+      // Private cookies and settings over the global context's storage.
+      return CefRequestContext::CreateContext(globalContext, nullptr);
+    }
+    return CefRequestContext::CreateContext(CefRequestContextSettings(), nullptr);
+  }
 
-  int browserId = -1;
-  if (browser) {
-    browserId = browser->GetIdentifier();
-    browsers[browserId] = browser;
-    SDL_Log("Created browser on UI thread; id=%d url=%s", browserId,
-            request.url.c_str());
-    CreateBrowserResponse response;
-    response.id = request.id;
-    response.browserId = browserId;
-    json j = response;
-    outgoingMessageQueue.push(j.dump());
-  } else {
-    SDL_Log("CreateBrowserSync returned null");
+  auto it = partitions.find(key.partition);
+  if (it != partitions.end()) {
+    if (it->second->GetCachePath().empty() == key.partitionOnDisk) {
+      SDL_Log("Partition '%s' already exists with %s storage", key.partition.c_str(),
+              key.partitionOnDisk ? "in-memory" : "on-disk");
+    }
+    return it->second;
   }
+
+  CefRequestContextSettings settings;
+  if (key.partitionOnDisk) {
+    std::string rootPath = globalContext->GetCachePath().ToString();
+    if (rootPath.empty()) {
+      SDL_Log("Partition '%s': no cache path configured, keeping it in memory",
+              key.partition.c_str());
+    } else {
+      CefString(&settings.cache_path) =
+          rootPath + "\\partitions\\" + PartitionDirectoryName(key.partition);
+    }
+  }
+  CefRefPtr<CefRequestContext> context =
+      CefRequestContext::CreateContext(settings, nullptr);
+  partitions[key.partition] = context;
+  partitionCount = partitions.size();
+  requestContextsCreated++;
+  SDL_Log("Created partition '%s' (%s)", key.partition.c_str(),
+          CefString(&settings.cache_path).empty() ? "in memory" : "on disk");
+  return context;
 }
 
-void BrowserProcessHandler::SendMessage(std::string payload) {
-  outgoingMessageQueue.push(payload);
+void BrowserProcessHandler::ScheduleBrowserPoolRefill() {
+  if (browserPool.Size() == 0 || browserPoolRefillScheduled) {
+    return;
+  }
+  browserPoolRefillScheduled = true;
+  CefPostDelayedTask(TID_UI,
+                     base::BindOnce(&BrowserProcessHandler::RefillBrowserPool,
+                                    CefRefPtr<BrowserProcessHandler>(this)),
+                     kBrowserPoolRefillDelayMs);
 }
 
-template<typename T> T BrowserProcessHandler::WaitForResponse(UUID requestId) {
-  std::unique_ptr<ResponseEntry> entry = std::make_unique<ResponseEntry>();
+// One browser per task, so paints and input of live browsers get to run in
+// between.
+void BrowserProcessHandler::RefillBrowserPool() {
+  browserPoolRefillScheduled = false;
+  std::optional<BrowserPoolKey> key = browserPool.NextDeficit();
+  if (!key.has_value()) {
+    return;
+  }
 
-  // Insert into map under map mutex
-  SDL_LockMutex(responseMapMutex);
-  responseEntries[requestId] = std::move(entry);
-  ResponseEntry* e = responseEntries[requestId].get();
-  SDL_UnlockMutex(responseMapMutex);
+  CefRect rectangle(0, 0, key->width, key->height);
+  PaintOptions paintOptions;
+  paintOptions.softwareRendering = key->softwareRendering;
+  CefRefPtr<BrowserHandler> client = new BrowserHandler(this, rectangle, paintOptions);
+  client->SetPooled();
+  BrowserPoolKey poolKey = key.value();
+  client->SetCreatedCallback([this, poolKey](CefRefPtr<CefBrowser> created) {
+    created->GetHost()->WasHidden(true);
+    browserPool.Add(poolKey, created);
+  });
+  if (!CreateBrowserFor(poolKey, kDefaultWindowlessFrameRate, rectangle, client,
+                        "about:blank")) {
+    // Retried on the next CreateBrowserRequest rather than in a loop.
+    SDL_Log("BrowserPool: failed to create a warm browser for %s",
+            poolKey.ToString().c_str());
+    browserPool.Abandon(poolKey);
+    return;
+  }
+  ScheduleBrowserPoolRefill();
+}
 
-  // Wait for signal
-  SDL_LockMutex(e->mutex);
-  while (!e->ready) {
-    SDL_WaitCondition(e->cond, e->mutex);
+void BrowserProcessHandler::SetFramePacing(int browserId, bool external, int frameRate) {
+  SDL_LockMutex(framePacingMutex);
+  FramePacing& pacing = framePacing[browserId];
+  pacing.external = external;
+  pacing.frameRate = frameRate;
+  SDL_UnlockMutex(framePacingMutex);
+}
+
+// Input is coalesced over one frame interval of the browser, optionally
+// capped by --input-coalescing-window-ms (0 disables coalescing). For a
+// browser paced by the client the interval is the observed time between
+// its BeginFrameRequests.
+Uint64 BrowserProcessHandler::GetInputCoalescingWindowNs(int browserId) {
+  Uint64 frameIntervalNs = SDL_NS_PER_SECOND / kDefaultWindowlessFrameRate;
+  SDL_LockMutex(framePacingMutex);
+  auto it = framePacing.find(browserId);
+  if (it != framePacing.end()) {
+    const FramePacing& pacing = it->second;
+    if (pacing.external && pacing.beginFrameIntervalNs > 0) {
+      frameIntervalNs = pacing.beginFrameIntervalNs;
+    } else if (pacing.frameRate > 0) {
+      frameIntervalNs = SDL_NS_PER_SECOND / pacing.frameRate;
+    }
+  }
+  SDL_UnlockMutex(framePacingMutex);
+  if (inputCoalescingWindowMs < 0) {
+    return frameIntervalNs;
   }
-  SDL_UnlockMutex(e->mutex);
+  return std::min<Uint64>(frameIntervalNs,
+                          SDL_MS_TO_NS(static_cast<Uint64>(inputCoalescingWindowMs)));
+}
 
-  std::string payload;
-  SDL_LockMutex(responseMapMutex);
-  auto it = responseEntries.find(requestId);
-  if (it != responseEntries.end()) {
-    ResponseEntry* entryPtr = it->second.get();
-    SDL_LockMutex(entryPtr->mutex);
-    payload = std::move(entryPtr->payload);
-    SDL_UnlockMutex(entryPtr->mutex);
-    responseEntries.erase(it);
+json BrowserProcessHandler::CollectMetrics() {
+  uint64_t writes = writerStats.writes.load();
+  uint64_t frames = writerStats.frames.load();
+  uint64_t bytes = writerStats.bytes.load();
+  uint64_t messages = writerStats.messages.load();
+  uint64_t batchFrames = writerStats.batchFrames.load();
+  json metrics = json::object();
+  metrics["writer"] = {
+      {"writes", writes},
+      {"frames", frames},
+      {"bytes", bytes},
+      {"messages", messages},
+      {"batchFrames", batchFrames},
+      {"batchedMessages", writerStats.batchedMessages.load()},
+      {"discarded", writerStats.discarded.load()},
+      {"framesPerWrite", writes ? static_cast<double>(frames) / writes : 0.0},
+      {"bytesPerWrite", writes ? static_cast<double>(bytes) / writes : 0.0},
+      {"messagesPerFrame", frames ? static_cast<double>(messages) / frames : 0.0},
+  };
+  metrics["dispatch"] = dispatcher.CollectMetrics();
+  metrics["paint"] = paintFlowControl.CollectMetrics();
+  metrics["damage"] = dirtyRectStats.CollectMetrics();
+  metrics["damage"]["pixelKernels"] = pixel_kernels::Implementation();
+  metrics["responses"] = responses.CollectMetrics();
+  metrics["browsers"] = browsers.CollectMetrics();
+  metrics["pool"] = browserPool.CollectMetrics();
+  metrics["memory"] = memoryGovernor.CollectMetrics();
+  metrics["creation"] = {
+      {"pending", pendingBrowserCreations.load()},
+      {"uiThread", createBrowserUiTime.CollectMetrics()},
+      {"untilCreated", createBrowserLatency.CollectMetrics()},
+  };
+  metrics["requestContexts"] = {
+      {"partitions", partitionCount.load()},
+      {"created", requestContextsCreated.load()},
+  };
+  int externalBrowsers = 0;
+  SDL_LockMutex(framePacingMutex);
+  for (const auto& it : framePacing) {
+    externalBrowsers += it.second.external ? 1 : 0;
   }
-  SDL_UnlockMutex(responseMapMutex);
+  SDL_UnlockMutex(framePacingMutex);
+  metrics["pacing"] = {
+      {"externalBrowsers", externalBrowsers},
+      {"beginFrames", beginFrames.load()},
+  };
+  return metrics;
+}
+
+// Messages are encoded in the connection's encoding as last seen by the
+// writer; it re-encodes those that end up on the other side of a switch.
+void BrowserProcessHandler::SendMessage(const json& message) {
+  // Read the connection first: a new connection resets the encoding before
+  // it bumps the generation, so a message stamped with the new generation is
+  // never encoded for the old connection.
+  uint64_t connection = connectionGeneration.load();
+  WireEncoding encoding = wireEncoding.load();
+  outgoingMessageQueue.push(
+      OutgoingMessage{EncodeMessage(message, encoding), encoding, connection});
+}
+
+// Messages built in the renderer process arrive here as JSON text. They only
+// need re-encoding when the client negotiated a binary encoding.
+json BrowserProcessHandler::EncodeEvalResult(json result) {
+  if (structuredResults.load()) {
+    return result;
+  }
+  return result.dump(-1, ' ', false, json::error_handler_t::replace);
+}
 
+void BrowserProcessHandler::ForwardJsonMessage(std::string payload) {
+  uint64_t connection = connectionGeneration.load();
+  WireEncoding encoding = wireEncoding.load();
+  if (encoding == WireEncoding::Json) {
+    outgoingMessageQueue.push(OutgoingMessage{std::move(payload), encoding, connection});
+    return;
+  }
   try {
-    json j = json::parse(payload);
-    return j.get<T>();
+    outgoingMessageQueue.push(
+        OutgoingMessage{EncodeMessage(json::parse(payload), encoding), encoding, connection});
   } catch (const nlohmann::json::parse_error& e_parse) {
-    // Log parse error, location and a truncated payload preview (safe length)
-    size_t previewLen = std::min<size_t>(payload.size(), 256);
-    std::string preview = payload.substr(0, previewLen);
-    SDL_Log("WaitForResponse: JSON parse_error: %s at byte=%u payload_preview='%s'",
-            e_parse.what(), static_cast<unsigned int>(e_parse.byte), preview.c_str());
-    throw; // rethrow so caller can handle the failure
+    SDL_Log("ForwardJsonMessage: JSON parse_error: %s at byte=%u",
+            e_parse.what(), static_cast<unsigned int>(e_parse.byte));
+  }
+}
+
+template<typename T>
+std::optional<T> BrowserProcessHandler::SendRequest(const json& message,
+                                                   const UUID& id,
+                                                   Sint32 timeoutMs) {
+  // Register first so that a fast response cannot be missed.
+  responses.Expect(id);
+  SendMessage(message);
+  std::optional<json> response = responses.Wait(id, timeoutMs);
+  if (!response.has_value()) {
+    SDL_Log("SendRequest: no response within %d ms", static_cast<int>(timeoutMs));
+    return std::nullopt;
+  }
+  try {
+    return response->get<T>();
   } catch (const std::exception& e) {
-    SDL_Log("WaitForResponse: JSON exception: %s", e.what());
-    throw;
+    SDL_Log("SendRequest: JSON exception: %s", e.what());
+    return std::nullopt;
   }
 }
 
+void BrowserProcessHandler::SetStreamSocket(NET_StreamSocket* socket) {
+  SDL_LockMutex(socketMutex);
+  // Every connection starts in JSON until it negotiates otherwise.
+  wireEncoding.store(WireEncoding::Json);
+  structuredResults.store(false);
+  streamSocket = socket;
+  streamSocketFailed = false;
+  connectionGeneration++;
+  SDL_BroadcastCondition(socketCond);
+  SDL_UnlockMutex(socketMutex);
+}
+
+void BrowserProcessHandler::CloseStreamSocket() {
+  SDL_LockMutex(socketMutex);
+  if (streamSocket) {
+    NET_DestroyStreamSocket(streamSocket);
+    streamSocket = nullptr;
+  }
+  streamSocketFailed = false;
+  connectionGeneration++;
+  SDL_UnlockMutex(socketMutex);
+}
+
+// Reads from the client socket. The thread sleeps in
+// NET_WaitUntilInputAvailable until a client connects or sends data, and
+// leaves all writing to RpcWriterThread. It is the only thread that creates
+// or destroys the stream socket.
 int BrowserProcessHandler::RpcServerThread(void* browserProcessHandlerPtr) {
   CefRefPtr<BrowserProcessHandler> browserProcessHandler =
       base::WrapRefCounted<BrowserProcessHandler>(static_cast<BrowserProcessHandler*>(browserProcessHandlerPtr));
   NET_Server* socketServer = browserProcessHandler->GetSocketServer();
-  NET_StreamSocket* streamSocket = nullptr;
+  NET_StreamSocket* readSocket = nullptr;
 
   SDL_Log("Network thread running");
 
   // Keep a persistent receive buffer so partial reads are preserved.
-  std::vector<uint8_t> recvBuffer;
-  uint8_t temp[1024];
+  FrameReader frameReader;
+  std::string_view frame;
 
   while (true) {
-    if (!streamSocket) {
-      if (!NET_AcceptClient(socketServer, &streamSocket)) {
+    if (!readSocket) {
+      void* server = socketServer;
+      if (NET_WaitUntilInputAvailable(&server, 1, -1) < 0) {
+        SDL_Log("Accept wait error: %s", SDL_GetError());
+        SDL_Delay(1000);
+        continue;
+      }
+
+      if (!NET_AcceptClient(socketServer, &readSocket)) {
         SDL_Log("Accept error: %s", SDL_GetError());
         SDL_Delay(1000);
         continue;
       }
 
-      if (streamSocket) {
-        SDL_Log("Client connected!");
-        recvBuffer.clear();
-      } else {
-        SDL_Delay(100);
+      if (!readSocket) {
         continue;
       }
+
+      SDL_Log("Client connected!");
+      frameReader.Reset();
+      browserProcessHandler->SetStreamSocket(readSocket);
     }
 
-    int received = NET_ReadFromStreamSocket(streamSocket, temp, sizeof(temp));
-    if (received > 0) {
-      recvBuffer.insert(recvBuffer.end(), temp, temp + received);
-    } else if (received < 0) {
+    // The timeout only bounds how long a write failure seen by the writer
+    // thread can go unnoticed; normally data or a disconnect wakes us first.
+    void* socket = readSocket;
+    int ready = NET_WaitUntilInputAvailable(&socket, 1, kSocketFailureCheckMs);
+
+    SDL_LockMutex(browserProcessHandler->socketMutex);
+    bool writeFailed = browserProcessHandler->streamSocketFailed;
+    int received = 0;
+    if (ready > 0 && !writeFailed) {
+      received = NET_ReadFromStreamSocket(
+          readSocket, frameReader.WritePtr(),
+          static_cast<int>(frameReader.WritableSize()));
+    }
+    SDL_UnlockMutex(browserProcessHandler->socketMutex);
+
+    if (ready < 0 || received < 0 || writeFailed) {
       SDL_Log("Read error: %s", SDL_GetError());
-      streamSocket = nullptr;
-      recvBuffer.clear();
-      SDL_Delay(100);
+      browserProcessHandler->CloseStreamSocket();
+      readSocket = nullptr;
       continue;
     }
+    frameReader.Commit(received);
 
-    // Process as many full framed messages as available in recvBuffer.
-    while (recvBuffer.size() >= 4) {
-      uint32_t msgLen;
-      memcpy(&msgLen, recvBuffer.data(), 4);
+    // Process as many full framed messages as have been received.
+    FrameReader::Status status;
+    while ((status = frameReader.Next(frame)) == FrameReader::Status::Frame) {
+      // The worker thread routes the payload; this is the one copy it takes
+      // to hand it over.
+      browserProcessHandler->incomingMessageQueue.push(std::string(frame));
+    }
+    if (status == FrameReader::Status::Oversized) {
+      SDL_Log("Frame exceeds %u bytes, dropping connection",
+              FrameReader::kMaxFrameSize);
+      browserProcessHandler->CloseStreamSocket();
+      readSocket = nullptr;
+    }
+  }
+  return 0;
+}
 
-      if (recvBuffer.size() < 4 + msgLen)
-        break;  // not enough bytes yet, wait for more reads
+// Writes outgoing messages to the client socket. Blocks on the outgoing queue
+// while it is empty and on the socket condition while no client is connected,
+// so messages are put on the wire as soon as they are queued.
+int BrowserProcessHandler::RpcWriterThread(void* browserProcessHandlerPtr) {
+  CefRefPtr<BrowserProcessHandler> browserProcessHandler =
+      base::WrapRefCounted<BrowserProcessHandler>(static_cast<BrowserProcessHandler*>(browserProcessHandlerPtr));
 
-      std::string jsonMsg(recvBuffer.begin() + 4,
-          recvBuffer.begin() + 4 + msgLen);
-      browserProcessHandler->incomingMessageQueue.push(jsonMsg);  // Worker thread will parse JSON
+  SDL_Log("Writer thread running");
 
-      recvBuffer.erase(recvBuffer.begin(), recvBuffer.begin() + 4 + msgLen);
-    }
+  const RpcWriterOptions& options = browserProcessHandler->writerOptions;
+  RpcWriterStats& stats = browserProcessHandler->writerStats;
 
-    std::string outMsg;
-    while (browserProcessHandler->outgoingMessageQueue.try_pop(outMsg)) {
-        uint32_t len = static_cast<uint32_t>(outMsg.size());
-        // Build single contiguous buffer: [len(4 bytes)] [payload]
-        std::vector<uint8_t> sendBuf;
-        sendBuf.resize(4 + outMsg.size());
-        memcpy(sendBuf.data(), &len, 4);
-        if (!outMsg.empty()) {
-          memcpy(sendBuf.data() + 4, outMsg.data(), outMsg.size());
-        }
+  // What the client expects of the next frame; switched right after the
+  // InitializeResponse is framed.
+  WireState wire;
+  // Reused for every batch so steady-state writes do not allocate.
+  std::vector<uint8_t> sendBuf;
+  std::vector<OutgoingMessage> outMsgs;
+  OutgoingMessage outMsg;
 
-        int total = static_cast<int>(sendBuf.size());
-        if (!NET_WriteToStreamSocket(streamSocket, sendBuf.data(), total)) {
-          SDL_Log("NET_WriteToStreamSocket failed or connection closed: %s", SDL_GetError());
-          NET_DestroyStreamSocket(streamSocket);
-          streamSocket = nullptr;
+  while (true) {
+    // Gather whatever else is already queued (or arrives within the linger
+    // time) into one write.
+    outMsgs.clear();
+    outMsgs.push_back(browserProcessHandler->outgoingMessageQueue.pop());
+    size_t gatheredBytes = outMsgs.back().payload.size();
+    Uint64 lingerDeadline = SDL_GetTicks() + options.maxLingerMs;
+    while (static_cast<int>(outMsgs.size()) < options.maxBatchFrames &&
+           gatheredBytes < options.maxBatchBytes) {
+      if (!browserProcessHandler->outgoingMessageQueue.try_pop(outMsg)) {
+        Uint64 now = SDL_GetTicks();
+        if (now >= lingerDeadline ||
+            !browserProcessHandler->outgoingMessageQueue.try_pop_for(
+                outMsg, static_cast<Sint32>(lingerDeadline - now))) {
           break;
         }
+      }
+      gatheredBytes += outMsg.payload.size();
+      outMsgs.push_back(std::move(outMsg));
+    }
+
+    // Messages are framed for the connection they were queued under, so wait
+    // for a client, then drop whatever was queued for an earlier one. Framing
+    // happens outside the lock; if the connection changes meanwhile, filter
+    // and frame again.
+    FramingCounts counts;
+    WireState framedState;
+    bool framed = false;
+    SDL_LockMutex(browserProcessHandler->socketMutex);
+    while (true) {
+      while (!browserProcessHandler->streamSocket ||
+             browserProcessHandler->streamSocketFailed) {
+        SDL_WaitCondition(browserProcessHandler->socketCond,
+                          browserProcessHandler->socketMutex);
+      }
+      uint64_t connection = browserProcessHandler->connectionGeneration.load();
+      if (framed && framedState.connection == connection) {
+        break;
+      }
+      SDL_UnlockMutex(browserProcessHandler->socketMutex);
+
+      stats.discarded += DiscardStale(outMsgs, connection);
+
+      // [len][payload][len][Batch{payload, payload, ...}]...
+      sendBuf.clear();
+      counts = FramingCounts();
+      framedState = FrameOutgoing(outMsgs, connection, wire, sendBuf, counts);
+      framed = true;
+      SDL_LockMutex(browserProcessHandler->socketMutex);
+    }
+    // Still under the lock, so this cannot undo the reset SetStreamSocket()
+    // does for a newer connection. Incoming frames are decoded in the new
+    // encoding from here on, as the client switches once it has read the
+    // InitializeResponse.
+    wire = framedState;
+    browserProcessHandler->wireEncoding.store(wire.encoding);
+    if (counts.undecodable > 0) {
+      SDL_Log("RpcWriterThread: dropped %d messages that could not be re-encoded",
+              counts.undecodable);
+    }
+
+    if (outMsgs.empty()) {
+      SDL_UnlockMutex(browserProcessHandler->socketMutex);
+      continue;
+    }
+
+    NET_StreamSocket* socket = browserProcessHandler->streamSocket;
+    int total = static_cast<int>(sendBuf.size());
+    int pending = 0;
+    if (!NET_WriteToStreamSocket(socket, sendBuf.data(), total)) {
+      pending = -1;
+    } else {
+      pending = NET_GetStreamSocketPendingWrites(socket);
+      stats.writes++;
+      stats.frames += counts.frames;
+      stats.bytes += sendBuf.size();
+      stats.messages += outMsgs.size();
+      stats.batchFrames += counts.batchFrames;
+      stats.batchedMessages += counts.batchedMessages;
+    }
+
+    // Anything SDL_net could not send right away is only flushed by later
+    // calls on the socket, so push it out here in short slices. Between
+    // slices the lock is released and the thread yields, so a reader
+    // waiting for the lock gets it instead of the writer taking it straight
+    // back.
+    while (pending > 0) {
+      SDL_UnlockMutex(browserProcessHandler->socketMutex);
+      SDL_Delay(0);
+      SDL_LockMutex(browserProcessHandler->socketMutex);
+      if (browserProcessHandler->streamSocket != socket) {
+        break;
+      }
+      pending = NET_WaitUntilStreamSocketDrained(socket, kSocketDrainSliceMs);
+    }
+
+    if (pending < 0 && browserProcessHandler->streamSocket == socket) {
+      SDL_Log("NET_WriteToStreamSocket failed or connection closed: %s", SDL_GetError());
+      browserProcessHandler->streamSocketFailed = true;
     }
-    SDL_Delay(1);  // tiny yield
+    SDL_UnlockMutex(browserProcessHandler->socketMutex);
   }
   return 0;
 }
@@ -275,125 +837,402 @@ int BrowserProcessHandler::RpcWorkerThread(void* browserProcessHandlerPtr) {
   CefRefPtr<BrowserProcessHandler> browserProcessHandler = base::WrapRefCounted<BrowserProcessHandler>(static_cast<BrowserProcessHandler*>(browserProcessHandlerPtr));
   while (true) {
     std::string msg = browserProcessHandler->incomingMessageQueue.pop();
+    // Only the envelope is read here; browser messages are decoded on their
+    // dispatch worker, so this thread does not decode for every browser.
+    browserProcessHandler->dispatcher.DispatchEncoded(
+        std::move(msg), browserProcessHandler->wireEncoding.load());
+  }
 
-    json jsonRequest;
-    try {
-      jsonRequest = json::parse(msg);
-    } catch (const nlohmann::json::parse_error& e_parse) {
-      size_t previewLen = std::min<size_t>(msg.size(), 256);
-      std::string preview = msg.substr(0, previewLen);
-      SDL_Log("RpcWorkerThread: JSON parse_error: %s at byte=%u payload_preview='%s'",
-              e_parse.what(), static_cast<unsigned int>(e_parse.byte), preview.c_str());
-      continue;
-    } catch (const std::exception& e) {
-      SDL_Log("RpcWorkerThread: JSON exception: %s", e.what());
-      continue;
-    }
+  return 0;
+}
 
-    std::string type = jsonRequest["type"].get<std::string>();
-    UUID id = jsonRequest["id"].get<UUID>();
+void BrowserProcessHandler::RegisterRpcHandlers() {
+  dispatcher.Register<InitializeRequest>(
+      [this](const InitializeRequest& request) { InitializeRpc(request); });
+  dispatcher.Register<GetMetricsRequest>(
+      [this](const GetMetricsRequest& request) { GetMetricsRpc(request); });
+  dispatcher.Register<CreateBrowserRequest>(
+      [this](const CreateBrowserRequest& request) {
+        CefPostTask(TID_UI, base::BindOnce(&BrowserProcessHandler::CreateBrowserRpc,
+                                           CefRefPtr<BrowserProcessHandler>(this),
+                                           request));
+      },
+      RpcLane::Any);
+  dispatcher.Register<EvalJavaScriptRequest>(
+      [this](const EvalJavaScriptRequest& request) { EvalJavaScriptRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<EvalBatchRequest>(
+      [this](const EvalBatchRequest& request) { EvalBatchRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<RegisterFunctionRequest>(
+      [this](const RegisterFunctionRequest& request) { RegisterFunctionRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<InvokeFunctionRequest>(
+      [this](const InvokeFunctionRequest& request) { InvokeFunctionRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<MouseClickEvent>(
+      [this](const MouseClickEvent& request) { MouseClickEventRpc(request); },
+      RpcLane::Browser);
+  dispatcher.RegisterCoalesced<MouseMoveEvent>(
+      [this](const MouseMoveEvent& request) { MouseMoveEventRpc(request); },
+      CoalesceMouseMove);
+  dispatcher.RegisterCoalesced<MouseWheelEvent>(
+      [this](const MouseWheelEvent& request) { MouseWheelEventRpc(request); },
+      CoalesceMouseWheel);
+  dispatcher.Register<KeyboardEvent>(
+      [this](const KeyboardEvent& request) { KeyboardEventRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<BeginFrameRequest>(
+      [this](const BeginFrameRequest& request) { BeginFrameRpc(request); },
+      RpcLane::Browser);
+  dispatcher.Register<SetWindowlessFrameRateRequest>(
+      [this](const SetWindowlessFrameRateRequest& request) {
+        SetWindowlessFrameRateRpc(request);
+      },
+      RpcLane::Browser);
+  dispatcher.Register<CloseBrowserRequest>(
+      [this](const CloseBrowserRequest& request) {
+        dispatcher.ForgetBrowser(request.browserId);
+        CefPostTask(TID_UI, base::BindOnce(&BrowserProcessHandler::CloseBrowserRpc,
+                                           CefRefPtr<BrowserProcessHandler>(this),
+                                           request));
+      },
+      RpcLane::Browser);
+  dispatcher.Register<SetVisibilityRequest>(
+      [this](const SetVisibilityRequest& request) {
+        CefPostTask(TID_UI, base::BindOnce(&BrowserProcessHandler::SetVisibilityRpc,
+                                           CefRefPtr<BrowserProcessHandler>(this),
+                                           request));
+      },
+      RpcLane::Browser);
+  dispatcher.RegisterRaw(Acknowledgement::kType,
+                         [this](const json& message) { AcknowledgementRpc(message); });
+}
 
-    if (type == "InitializeRequest") {
-      InitializeRequest request = jsonRequest.get<InitializeRequest>();
-      browserProcessHandler->OpenClientProcessHandle(request.clientProcessId);
-      InitializeResponse response;
-      response.id = request.id;
-      json jsonResponse = response;
-      browserProcessHandler->SendMessage(jsonResponse.dump());
-      continue;
-    }
+void BrowserProcessHandler::InitializeRpc(const InitializeRequest& request) {
+  OpenClientProcessHandle(request.clientProcessId);
+  WireEncoding encoding = NegotiateWireEncoding(request.encodings);
+  InitializeResponse response;
+  response.id = request.id;
+  response.encoding = WireEncodingToString(encoding);
+  response.batching = request.batching;
+  response.structuredResults = request.structuredResults;
+  // The response itself still goes out in the current mode; the writer
+  // switches right after framing it, and the client once it has read it.
+  uint64_t connection = connectionGeneration.load();
+  WireEncoding current = wireEncoding.load();
+  OutgoingMessage message{EncodeMessage(response, current), current, connection};
+  message.switchEncoding = encoding;
+  message.switchBatching = request.batching;
+  outgoingMessageQueue.push(std::move(message));
+  structuredResults.store(request.structuredResults);
+  SDL_Log("Negotiated wire encoding: %s, batching: %s", response.encoding.c_str(),
+          request.batching ? "on" : "off");
+}
 
-    if (type == "CreateBrowserRequest") {
-      CreateBrowserRequest request = jsonRequest.get<CreateBrowserRequest>();
-      CefPostTask(TID_UI, base::BindOnce(&BrowserProcessHandler::CreateBrowserRpc, browserProcessHandler, request));
-      continue;
-    }
+void BrowserProcessHandler::GetMetricsRpc(const GetMetricsRequest& request) {
+  MetricsResponse response;
+  response.id = request.id;
+  response.metrics = CollectMetrics();
+  SendMessage(response);
+}
 
-    if (type == "EvalJavaScriptRequest") {
-      EvalJavaScriptRequest evalRequest = jsonRequest.get<EvalJavaScriptRequest>();
-      CefRefPtr<CefBrowser> browser =
-          browserProcessHandler->GetBrowser(evalRequest.browserId);
-            CefRefPtr<CefFrame> frame = browser->GetMainFrame();
-      CefRefPtr<CefProcessMessage> message =
-          CefProcessMessage::Create(kEvalMessage);
-      message->GetArgumentList()->SetString(0, msg);
-            frame->SendProcessMessage(PID_RENDERER, message);
-      continue;
-    };
-
-    if (type == "MouseClickEvent") {
-      MouseClickEvent request = jsonRequest.get<MouseClickEvent>();
-      CefRefPtr<CefBrowser> browser = browserProcessHandler->GetBrowser(request.browserId);
-      if (browser) {
-            browser->GetHost()->SendMouseClickEvent(
-            request.mouseEvent,
-            static_cast<CefBrowserHost::MouseButtonType>(request.button),
-            request.mouseUp,
-            request.clickCount);
-      } else {
-        SDL_Log("MouseClickEvent: Browser with id %d not found", request.browserId);
-      }
-      continue;
-    }
+void BrowserProcessHandler::EvalJavaScriptRpc(const EvalJavaScriptRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("EvalJavaScriptRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  BrowserHandler* client =
+      static_cast<BrowserHandler*>(browser->GetHost()->GetClient().get());
+  client->ExpectEvalResponse(request.id);
+  CefRefPtr<CefFrame> frame = browser->GetMainFrame();
+  CefRefPtr<CefProcessMessage> message =
+      CefProcessMessage::Create(process_messages::kEval);
+  process_messages::WriteEvalRequest(message->GetArgumentList(), request);
+  frame->SendProcessMessage(PID_RENDERER, message);
+}
 
-    if (type == "MouseMoveEvent") {
-      MouseMoveEvent request = jsonRequest.get<MouseMoveEvent>();
-      CefRefPtr<CefBrowser> browser = browserProcessHandler->GetBrowser(request.browserId);
-      if (browser) {
-        browser->GetHost()->SendMouseMoveEvent(
-            request.mouseEvent,
-            request.mouseLeave);
-      } else {
-        SDL_Log("MouseMoveEvent: Browser with id %d not found", request.browserId);
-      }
-      continue;
-    }
+void BrowserProcessHandler::EvalBatchRpc(const EvalBatchRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("EvalBatchRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  CefRefPtr<CefProcessMessage> message =
+      CefProcessMessage::Create(process_messages::kEvalBatch);
+  process_messages::WriteEvalBatchRequest(message->GetArgumentList(), request);
+  browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, message);
+}
 
-    if (type == "MouseWheelEvent") {
-      MouseWheelEvent request = jsonRequest.get<MouseWheelEvent>();
-      CefRefPtr<CefBrowser> browser = browserProcessHandler->GetBrowser(request.browserId);
-      if (browser) {
-        browser->GetHost()->SendMouseWheelEvent(request.mouseEvent, request.deltaX, request.deltaY);
-      } else {
-        SDL_Log("MouseWheelEvent: Browser with id %d not found",
-                request.browserId);
-      };
-      continue;
-    }
+void BrowserProcessHandler::RegisterFunctionRpc(const RegisterFunctionRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("RegisterFunctionRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  CefRefPtr<CefProcessMessage> message =
+      CefProcessMessage::Create(process_messages::kRegisterFunction);
+  process_messages::WriteRegisterFunctionRequest(message->GetArgumentList(), request);
+  browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, message);
+}
 
-    if (type == "KeyboardEvent") {
-      KeyboardEvent request = jsonRequest.get<KeyboardEvent>();
-      CefRefPtr<CefBrowser> browser = browserProcessHandler->GetBrowser(request.browserId);
-      if (browser) {
-        browser->GetHost()->SendKeyEvent(request.keyEvent);
-      } else {
-        SDL_Log("KeyboardEvent: Browser with id %d not found",
-                request.browserId);
-      }
-      continue;
+void BrowserProcessHandler::InvokeFunctionRpc(const InvokeFunctionRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("InvokeFunctionRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  CefRefPtr<CefProcessMessage> message =
+      CefProcessMessage::Create(process_messages::kInvokeFunction);
+  process_messages::WriteInvokeFunctionRequest(message->GetArgumentList(), request);
+  browser->GetMainFrame()->SendProcessMessage(PID_RENDERER, message);
+}
+
+void BrowserProcessHandler::MouseClickEventRpc(const MouseClickEvent& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (browser) {
+    browser->GetHost()->SendMouseClickEvent(
+        request.mouseEvent,
+        static_cast<CefBrowserHost::MouseButtonType>(request.button),
+        request.mouseUp,
+        request.clickCount);
+  } else {
+    SDL_Log("MouseClickEvent: Browser with id %d not found", request.browserId);
+  }
+}
+
+void BrowserProcessHandler::MouseMoveEventRpc(const MouseMoveEvent& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (browser) {
+    browser->GetHost()->SendMouseMoveEvent(
+        request.mouseEvent,
+        request.mouseLeave);
+  } else {
+    SDL_Log("MouseMoveEvent: Browser with id %d not found", request.browserId);
+  }
+}
+
+void BrowserProcessHandler::MouseWheelEventRpc(const MouseWheelEvent& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (browser) {
+    browser->GetHost()->SendMouseWheelEvent(request.mouseEvent, request.deltaX, request.deltaY);
+  } else {
+    SDL_Log("MouseWheelEvent: Browser with id %d not found",
+            request.browserId);
+  }
+}
+
+void BrowserProcessHandler::KeyboardEventRpc(const KeyboardEvent& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (browser) {
+    browser->GetHost()->SendKeyEvent(request.keyEvent);
+  } else {
+    SDL_Log("KeyboardEvent: Browser with id %d not found",
+            request.browserId);
+  }
+}
+
+void BrowserProcessHandler::BeginFrameRpc(const BeginFrameRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("BeginFrameRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  Uint64 now = SDL_GetTicksNS();
+  SDL_LockMutex(framePacingMutex);
+  FramePacing& pacing = framePacing[request.browserId];
+  if (pacing.lastBeginFrameNs != 0) {
+    double interval = static_cast<double>(now - pacing.lastBeginFrameNs);
+    pacing.beginFrameIntervalNs =
+        pacing.beginFrameIntervalNs == 0
+            ? static_cast<Uint64>(interval)
+            : static_cast<Uint64>(pacing.beginFrameIntervalNs +
+                                  kBeginFrameIntervalSmoothing *
+                                      (interval - pacing.beginFrameIntervalNs));
+  }
+  pacing.lastBeginFrameNs = now;
+  SDL_UnlockMutex(framePacingMutex);
+  beginFrames++;
+  browser->GetHost()->SendExternalBeginFrame();
+}
+
+void BrowserProcessHandler::SetWindowlessFrameRateRpc(
+    const SetWindowlessFrameRateRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("SetWindowlessFrameRateRequest: Browser with id %d not found",
+            request.browserId);
+    return;
+  }
+  int frameRate = std::clamp(request.frameRate, 1, kMaxWindowlessFrameRate);
+  browser->GetHost()->SetWindowlessFrameRate(frameRate);
+  SDL_LockMutex(framePacingMutex);
+  framePacing[request.browserId].frameRate = frameRate;
+  SDL_UnlockMutex(framePacingMutex);
+}
+
+void BrowserProcessHandler::CloseBrowserRpc(const CloseBrowserRequest& request) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser) {
+    SDL_Log("CloseBrowserRequest: Browser with id %d not found", request.browserId);
+    CloseBrowserResponse response;
+    response.id = request.id;
+    response.browserId = request.browserId;
+    response.closed = false;
+    SendMessage(response);
+    return;
+  }
+  pendingCloses[request.browserId].push_back(request.id);
+  browser->GetHost()->CloseBrowser(request.force);
+}
+
+void BrowserProcessHandler::OnBrowserClosed(int browserId) {
+  if (!browsers.Remove(browserId)) {
+    // A warm pool browser, or one that was never handed out. A warm one
+    // that closes (e.g. its renderer crashed) must not be claimed later;
+    // create a replacement.
+    if (browserPool.Remove(browserId)) {
+      SDL_Log("BrowserPool: warm browser closed; id=%d", browserId);
+      ScheduleBrowserPoolRefill();
     }
+    return;
+  }
+  paintFlowControl.RemoveBrowser(browserId);
+  memoryGovernor.Forget(browserId);
+  SDL_LockMutex(framePacingMutex);
+  framePacing.erase(browserId);
+  SDL_UnlockMutex(framePacingMutex);
+  SDL_Log("Closed browser; id=%d", browserId);
 
-    if (type == "Acknowledgement") {
-      // Try to find a waiting entry
-      SDL_LockMutex(browserProcessHandler->responseMapMutex);
-      auto it = browserProcessHandler->responseEntries.find(id);
-      if (it != browserProcessHandler->responseEntries.end()) {
-        ResponseEntry* e = it->second.get();
-        SDL_LockMutex(e->mutex);
-        e->payload = msg;
-        e->ready = true;
-        SDL_SignalCondition(e->cond);
-        SDL_UnlockMutex(e->mutex);
-      }
-      SDL_UnlockMutex(browserProcessHandler->responseMapMutex);
-      continue;
+  auto it = pendingCloses.find(browserId);
+  if (it == pendingCloses.end()) {
+    return;
+  }
+  for (const UUID& id : it->second) {
+    CloseBrowserResponse response;
+    response.id = id;
+    response.browserId = browserId;
+    response.closed = true;
+    SendMessage(response);
+  }
+  pendingCloses.erase(it);
+}
+
+void BrowserProcessHandler::SetVisibilityRpc(const SetVisibilityRequest& request) {
+  Uint64 now = SDL_GetTicksNS();
+  CefRefPtr<CefBrowser> browser = GetBrowser(request.browserId);
+  if (!browser || !memoryGovernor.SetVisible(request.browserId, request.visible, now)) {
+    SDL_Log("SetVisibilityRequest: Browser with id %d not found", request.browserId);
+    return;
+  }
+  CefRefPtr<CefBrowserHost> host = browser->GetHost();
+  if (!request.visible) {
+    host->WasHidden(true);
+    host->SetWindowlessFrameRate(kHiddenWindowlessFrameRate);
+    host->SetAudioMuted(true);
+    // Refresh the scroll position that hibernation would save.
+    RequestMemorySample(browser);
+    return;
+  }
+
+  std::optional<MemoryGovernor::SavedPage> page = memoryGovernor.Wake(request.browserId);
+  if (page.has_value()) {
+    CefRefPtr<BrowserHandler> client =
+        static_cast<BrowserHandler*>(host->GetClient().get());
+    client->SetHibernated(false);
+    client->RestoreScrollOnLoad(page->scrollX, page->scrollY);
+    client->TrackFirstPaint(now, memoryGovernor.RestoreLatency());
+    browser->GetMainFrame()->LoadURL(page->url);
+    SDL_Log("Restoring hibernated browser; id=%d url=%s", request.browserId,
+            page->url.c_str());
+  }
+  int frameRate = kDefaultWindowlessFrameRate;
+  SDL_LockMutex(framePacingMutex);
+  auto it = framePacing.find(request.browserId);
+  if (it != framePacing.end() && it->second.frameRate > 0) {
+    frameRate = it->second.frameRate;
+  }
+  SDL_UnlockMutex(framePacingMutex);
+  host->SetWindowlessFrameRate(frameRate);
+  host->SetAudioMuted(false);
+  host->WasHidden(false);
+}
+
+void BrowserProcessHandler::SampleMemory() {
+  for (int browserId : memoryGovernor.SelectVictims()) {
+    HibernateBrowser(browserId);
+  }
+  for (int browserId : browsers.Ids()) {
+    CefRefPtr<CefBrowser> browser = browsers.Get(browserId);
+    if (browser && !memoryGovernor.IsHibernated(browserId)) {
+      RequestMemorySample(browser);
     }
+  }
+  CefPostDelayedTask(TID_UI,
+                     base::BindOnce(&BrowserProcessHandler::SampleMemory,
+                                    CefRefPtr<BrowserProcessHandler>(this)),
+                     memorySampleIntervalMs);
+}
+
+void BrowserProcessHandler::RequestMemorySample(CefRefPtr<CefBrowser> browser) {
+  browser->GetMainFrame()->SendProcessMessage(
+      PID_RENDERER, CefProcessMessage::Create(process_messages::kMemoryUsage));
+}
 
-    SDL_Log("RpcWorkerThread: unknown message type '%s'", type.c_str());
+void BrowserProcessHandler::OnMemorySample(int browserId,
+                                           int processId,
+                                           uint64_t processBytes,
+                                           const MemoryGovernor::SavedPage& page) {
+  memoryGovernor.RecordSample(browserId, processId, processBytes, page);
+}
+
+void BrowserProcessHandler::HibernateBrowser(int browserId) {
+  CefRefPtr<CefBrowser> browser = browsers.Get(browserId);
+  if (!browser) {
+    return;
+  }
+  std::optional<MemoryGovernor::SavedPage> page = memoryGovernor.Hibernate(browserId);
+  if (!page.has_value()) {
+    return;
   }
+  CefRefPtr<BrowserHandler> client =
+      static_cast<BrowserHandler*>(browser->GetHost()->GetClient().get());
+  client->SetHibernated(true);
+  browser->GetMainFrame()->LoadURL("about:blank");
+  SDL_Log("Hibernated browser; id=%d url=%s", browserId, page->url.c_str());
+}
 
-  return 0;
+void BrowserProcessHandler::AcknowledgementRpc(const json& message) {
+  UUID id = message.at("id").get<UUID>();
+
+  // Paint acknowledgements release a slot in the paint window and, on the
+  // UI thread, the frame ring slot the frame was written to.
+  bool repaint = false;
+  std::optional<int> paintedBrowserId =
+      paintFlowControl.Complete(id, SDL_GetTicksNS(), repaint);
+  if (paintedBrowserId.has_value()) {
+    CefPostTask(TID_UI, base::BindOnce(&BrowserProcessHandler::OnPaintAcknowledged,
+                                       CefRefPtr<BrowserProcessHandler>(this),
+                                       paintedBrowserId.value(), id, repaint));
+    return;
+  }
+
+  json response = message;
+  responses.Complete(id, std::move(response));
 }
 
-template Acknowledgement
-    BrowserProcessHandler::WaitForResponse<Acknowledgement>(UUID);
\ No newline at end of file
+template std::optional<Acknowledgement>
+    BrowserProcessHandler::SendRequest<Acknowledgement>(const json&,
+                                                        const UUID&,
+                                                        Sint32);
+
+void BrowserProcessHandler::OnPaintAcknowledged(int browserId, UUID frameId, bool repaint) {
+  CefRefPtr<CefBrowser> browser = GetBrowser(browserId);
+  if (!browser) {
+    return;
+  }
+  CefRefPtr<BrowserHandler> client =
+      static_cast<BrowserHandler*>(browser->GetHost()->GetClient().get());
+  client->OnFrameAcknowledged(frameId, repaint);
+}
\ No newline at end of file
@@ -1,11 +1,43 @@
 #pragma once
 
 #include <rpc.h>
+#include <atomic>
 #include "SDL3_net/SDL_net.h"
 #include "include/cef_base.h"
+#include "browser_pool.hpp"
+#include "browser_registry.hpp"
+#include "dirty_rects.hpp"
+#include "memory_governor.hpp"
+#include "paint_flow_control.hpp"
+#include "response_table.hpp"
 #include "process_handler.h"
 #include "rpc.hpp"
+#include "rpc_dispatcher.hpp"
 #include "thread_safe_queue.hpp"
+#include "wire_encoding.hpp"
+
+// Limits for gathering queued outgoing messages into a single socket write.
+struct RpcWriterOptions {
+  int maxBatchFrames = 64;
+  size_t maxBatchBytes = 1024 * 1024;
+  // How long the writer waits for more messages before flushing a batch
+  // that is not yet full. Zero flushes as soon as the queue is empty.
+  int maxLingerMs = 0;
+};
+
+struct RpcWriterStats {
+  std::atomic<uint64_t> writes{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> messages{0};
+  // Batch frames written, and the messages they carried.
+  std::atomic<uint64_t> batchFrames{0};
+  std::atomic<uint64_t> batchedMessages{0};
+  // Messages queued for a connection that closed before they were written.
+  std::atomic<uint64_t> discarded{0};
+};
+
+class BrowserHandler;
 
 class BrowserProcessHandler : public ProcessHandler, public CefBrowserProcessHandler {
  public:
@@ -17,31 +49,157 @@ class BrowserProcessHandler : public ProcessHandler, public CefBrowserProcessHan
   CefRefPtr<CefBrowser> GetBrowser(int browserId);
   void OpenClientProcessHandle(int processId);
   std::optional<HANDLE> GetClientProcessHandle();
+  json CollectMetrics();
+  Uint64 GetInputCoalescingWindowNs(int browserId);
+  PaintFlowControl& GetPaintFlowControl();
+  DirtyRectStats& GetDirtyRectStats();
+  // Changes whenever the client connects or disconnects.
+  uint64_t GetConnectionGeneration() const;
 
   // CefBrowserProcessHandler methods.
   CefRefPtr<CefBrowserProcessHandler> GetBrowserProcessHandler() override;
   void OnContextInitialized() override;
   
   // Incoming RPC messages.
+  void InitializeRpc(const InitializeRequest& request);
+  void GetMetricsRpc(const GetMetricsRequest& request);
   void CreateBrowserRpc(const CreateBrowserRequest& request);
+  void EvalJavaScriptRpc(const EvalJavaScriptRequest& request);
+  void EvalBatchRpc(const EvalBatchRequest& request);
+  void RegisterFunctionRpc(const RegisterFunctionRequest& request);
+  void InvokeFunctionRpc(const InvokeFunctionRequest& request);
+  void MouseClickEventRpc(const MouseClickEvent& request);
+  void MouseMoveEventRpc(const MouseMoveEvent& request);
+  void MouseWheelEventRpc(const MouseWheelEvent& request);
+  void KeyboardEventRpc(const KeyboardEvent& request);
+  void BeginFrameRpc(const BeginFrameRequest& request);
+  void SetWindowlessFrameRateRpc(const SetWindowlessFrameRateRequest& request);
+  void CloseBrowserRpc(const CloseBrowserRequest& request);
+  void SetVisibilityRpc(const SetVisibilityRequest& request);
+  void AcknowledgementRpc(const json& message);
   
   // Outgoing RPC messages.
-  void SendMessage(std::string payload);
-  template<typename T> T WaitForResponse(UUID id);
+  void SendMessage(const json& message);
+  void ForwardJsonMessage(std::string payload);
+  // An eval result as the client negotiated: the value itself, or its JSON
+  // text for clients without structured results.
+  json EncodeEvalResult(json result);
+  // Sends a request and waits up to |timeoutMs| for the response with the
+  // same id. Returns nullopt on timeout or if the response does not decode.
+  template<typename T> std::optional<T> SendRequest(const json& message,
+                                                    const UUID& id,
+                                                    Sint32 timeoutMs);
+  // Hands a software frame's acknowledgement to its browser, repainting it
+  // if it dropped frames under paint backpressure. UI thread.
+  void OnPaintAcknowledged(int browserId, UUID frameId, bool repaint);
+  // Forgets a browser that CEF is about to destroy and answers any
+  // CloseBrowserRequest for it. UI thread.
+  void OnBrowserClosed(int browserId);
+  // A renderer's answer to a memory sample request. UI thread.
+  void OnMemorySample(int browserId,
+                      int processId,
+                      uint64_t processBytes,
+                      const MemoryGovernor::SavedPage& page);
   
   // RPC threads, need to be static.
   static int RpcServerThread(void* browserProcessHandlerPtr);
+  static int RpcWriterThread(void* browserProcessHandlerPtr);
   static int RpcWorkerThread(void* browserProcessHandlerPtr);
 
  private:
+  // How a browser's frames are paced, for sizing its input coalescing
+  // window.
+  struct FramePacing {
+    bool external = false;
+    int frameRate = 0;
+    // External pacing only: smoothed interval between BeginFrameRequests.
+    Uint64 beginFrameIntervalNs = 0;
+    Uint64 lastBeginFrameNs = 0;
+  };
+
+  void RegisterRpcHandlers();
+  // Starts creating a browser; |client| is told when it exists. Returns
+  // false if CEF refused to start.
+  bool CreateBrowserFor(const BrowserPoolKey& key,
+                        int frameRate,
+                        const CefRect& rectangle,
+                        CefRefPtr<BrowserHandler> client,
+                        const std::string& url);
+  // Registers a browser created for |request| and answers it.
+  void OnBrowserCreated(const CreateBrowserRequest& request,
+                        const BrowserPoolKey& key,
+                        int frameRate,
+                        bool fromPool,
+                        CefRefPtr<CefBrowser> browser);
+  // Creates one warm browser for the pool, then schedules itself again
+  // while the pool is short.
+  void RefillBrowserPool();
+  void ScheduleBrowserPoolRefill();
+  // Hibernates browsers over the memory budget, asks every awake browser's
+  // renderer for a new sample and reschedules itself.
+  void SampleMemory();
+  void RequestMemorySample(CefRefPtr<CefBrowser> browser);
+  void HibernateBrowser(int browserId);
+  // The request context for a new browser with |key|'s partition.
+  CefRefPtr<CefRequestContext> GetRequestContext(const BrowserPoolKey& key);
+  void SetFramePacing(int browserId, bool external, int frameRate);
+
   std::optional<HANDLE> clientProcessHandle;
+  // The connection's encoding as of the last frame written. Incoming frames
+  // are decoded in it and outgoing messages are queued in it; the writer
+  // re-encodes any that end up on the other side of a switch.
+  std::atomic<WireEncoding> wireEncoding;
+  // Set once the client has agreed to receive structured eval results.
+  std::atomic<bool> structuredResults;
   ThreadSafeQueue<std::string> incomingMessageQueue;
-  ThreadSafeQueue<std::string> outgoingMessageQueue;
-  SDL_Mutex* responseMapMutex = nullptr;
-  std::map<UUID, std::unique_ptr<ResponseEntry>> responseEntries;
-  std::map<int, CefRefPtr<CefBrowser>> browsers;
+  ThreadSafeQueue<OutgoingMessage> outgoingMessageQueue;
+  RpcDispatcher dispatcher;
+  PaintFlowControl paintFlowControl;
+  DirtyRectStats dirtyRectStats;
+  // Cap on the input coalescing window; negative means one frame interval.
+  int inputCoalescingWindowMs = -1;
+  bool externalBeginFrameDefault = false;
+  SDL_Mutex* framePacingMutex;
+  std::unordered_map<int, FramePacing> framePacing;
+  std::atomic<uint64_t> beginFrames{0};
+  BrowserPool browserPool;
+  // UI thread only.
+  bool browserPoolRefillScheduled = false;
+  bool requestContextPerBrowser = false;
+  bool requestContextSharedCache = false;
+  // Request contexts by partition name. UI thread only.
+  std::map<std::string, CefRefPtr<CefRequestContext>> partitions;
+  std::atomic<size_t> partitionCount{0};
+  std::atomic<uint64_t> requestContextsCreated{0};
+  // Time CreateBrowserRpc holds the UI thread, and time until the browser
+  // exists.
+  LatencyStats createBrowserUiTime;
+  LatencyStats createBrowserLatency;
+  std::atomic<int> pendingBrowserCreations{0};
+  ResponseTable responses;
+  BrowserRegistry browsers;
+  MemoryGovernor memoryGovernor;
+  int memorySampleIntervalMs = 5000;
+  // CloseBrowserRequests waiting for OnBeforeClose. UI thread only.
+  std::unordered_map<int, std::vector<UUID>> pendingCloses;
 
   NET_Server* socketServer;
+  RpcWriterOptions writerOptions;
+  RpcWriterStats writerStats;
+
+  // Client connection, shared by the reader and writer threads. Only the
+  // reader creates or destroys it; the writer flags failures.
+  void SetStreamSocket(NET_StreamSocket* socket);
+  void CloseStreamSocket();
+  NET_StreamSocket* streamSocket;
+  bool streamSocketFailed;
+  SDL_Mutex* socketMutex;
+  SDL_Condition* socketCond;
+  // Bumped whenever a connection is opened or closed, under socketMutex.
+  // Outgoing messages carry the value they were queued under, and the writer
+  // discards any from another connection: they were encoded for a client
+  // that is gone, in an encoding the next one may not have negotiated.
+  std::atomic<uint64_t> connectionGeneration{0};
 
   IMPLEMENT_REFCOUNTING(BrowserProcessHandler);
   DISALLOW_COPY_AND_ASSIGN(BrowserProcessHandler);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include "include/cef_browser.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// The live browsers by id.
+//
+// Browsers are added and removed on the CEF UI thread, but looked up for
+// every input event on the RPC dispatch workers, so lookups only take the
+// read side of a reader/writer lock and never wait for each other.
+class BrowserRegistry {
+ public:
+  BrowserRegistry() : lock(SDL_CreateRWLock()) {}
+  ~BrowserRegistry() { SDL_DestroyRWLock(lock); }
+  BrowserRegistry(const BrowserRegistry&) = delete;
+  BrowserRegistry& operator=(const BrowserRegistry&) = delete;
+
+  void Add(int browserId, CefRefPtr<CefBrowser> browser) {
+    SDL_LockRWLockForWriting(lock);
+    browsers[browserId] = browser;
+    SDL_UnlockRWLock(lock);
+    added++;
+  }
+
+  // Returns nullptr for unknown or closed browsers.
+  CefRefPtr<CefBrowser> Get(int browserId) {
+    CefRefPtr<CefBrowser> browser;
+    SDL_LockRWLockForReading(lock);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end()) {
+      browser = it->second;
+    }
+    SDL_UnlockRWLock(lock);
+    return browser;
+  }
+
+  // Returns false if |browserId| was not registered.
+  bool Remove(int browserId) {
+    SDL_LockRWLockForWriting(lock);
+    bool removed = browsers.erase(browserId) != 0;
+    SDL_UnlockRWLock(lock);
+    if (removed) {
+      closed++;
+    }
+    return removed;
+  }
+
+  std::vector<int> Ids() {
+    std::vector<int> ids;
+    SDL_LockRWLockForReading(lock);
+    ids.reserve(browsers.size());
+    for (const auto& it : browsers) {
+      ids.push_back(it.first);
+    }
+    SDL_UnlockRWLock(lock);
+    return ids;
+  }
+
+  json CollectMetrics() {
+    SDL_LockRWLockForReading(lock);
+    size_t live = browsers.size();
+    SDL_UnlockRWLock(lock);
+    return {
+        {"live", live},
+        {"created", added.load()},
+        {"closed", closed.load()},
+    };
+  }
+
+ private:
+  SDL_RWLock* lock;
+  std::unordered_map<int, CefRefPtr<CefBrowser>> browsers;
+  std::atomic<uint64_t> added{0};
+  std::atomic<uint64_t> closed{0};
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "include/cef_values.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Conversions between JSON as used on the wire and CefValue as used in
+// process messages.
+//
+// Integers that do not fit in a CefValue int become doubles; binary JSON
+// values (CBOR and MsgPack can carry them) map to CefBinaryValue.
+
+inline CefRefPtr<CefValue> JsonToCefValue(const json& j);
+
+inline CefRefPtr<CefListValue> JsonToCefList(const json& array) {
+  CefRefPtr<CefListValue> list = CefListValue::Create();
+  list->SetSize(array.size());
+  for (size_t i = 0; i < array.size(); i++) {
+    list->SetValue(i, JsonToCefValue(array[i]));
+  }
+  return list;
+}
+
+inline CefRefPtr<CefValue> JsonToCefValue(const json& j) {
+  CefRefPtr<CefValue> value = CefValue::Create();
+  switch (j.type()) {
+    case json::value_t::boolean:
+      value->SetBool(j.get<bool>());
+      break;
+    case json::value_t::number_integer: {
+      int64_t n = j.get<int64_t>();
+      if (n >= INT_MIN && n <= INT_MAX) {
+        value->SetInt(static_cast<int>(n));
+      } else {
+        value->SetDouble(static_cast<double>(n));
+      }
+      break;
+    }
+    case json::value_t::number_unsigned: {
+      uint64_t n = j.get<uint64_t>();
+      if (n <= INT_MAX) {
+        value->SetInt(static_cast<int>(n));
+      } else {
+        value->SetDouble(static_cast<double>(n));
+      }
+      break;
+    }
+    case json::value_t::number_float:
+      value->SetDouble(j.get<double>());
+      break;
+    case json::value_t::string:
+      value->SetString(j.get_ref<const std::string&>());
+      break;
+    case json::value_t::binary: {
+      const auto& bytes = j.get_binary();
+      value->SetBinary(CefBinaryValue::Create(bytes.data(), bytes.size()));
+      break;
+    }
+    case json::value_t::array:
+      value->SetList(JsonToCefList(j));
+      break;
+    case json::value_t::object: {
+      CefRefPtr<CefDictionaryValue> dict = CefDictionaryValue::Create();
+      for (auto it = j.begin(); it != j.end(); ++it) {
+        dict->SetValue(it.key(), JsonToCefValue(it.value()));
+      }
+      value->SetDictionary(dict);
+      break;
+    }
+    default:
+      value->SetNull();
+      break;
+  }
+  return value;
+}
+
+inline json CefValueToJson(CefRefPtr<CefValue> value) {
+  if (!value) {
+    return nullptr;
+  }
+  switch (value->GetType()) {
+    case VTYPE_BOOL:
+      return value->GetBool();
+    case VTYPE_INT:
+      return value->GetInt();
+    case VTYPE_DOUBLE:
+      return value->GetDouble();
+    case VTYPE_STRING:
+      return value->GetString().ToString();
+    case VTYPE_BINARY: {
+      CefRefPtr<CefBinaryValue> binary = value->GetBinary();
+      std::vector<uint8_t> bytes(binary->GetSize());
+      if (!bytes.empty()) {
+        binary->GetData(bytes.data(), bytes.size(), 0);
+      }
+      return json::binary(std::move(bytes));
+    }
+    case VTYPE_LIST: {
+      CefRefPtr<CefListValue> list = value->GetList();
+      json array = json::array();
+      for (size_t i = 0; i < list->GetSize(); i++) {
+        array.push_back(CefValueToJson(list->GetValue(i)));
+      }
+      return array;
+    }
+    case VTYPE_DICTIONARY: {
+      CefRefPtr<CefDictionaryValue> dict = value->GetDictionary();
+      CefDictionaryValue::KeyList keys;
+      dict->GetKeys(keys);
+      json object = json::object();
+      for (const CefString& key : keys) {
+        object[key.ToString()] = CefValueToJson(dict->GetValue(key));
+      }
+      return object;
+    }
+    default:
+      return nullptr;
+  }
+}
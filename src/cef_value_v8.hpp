@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "include/cef_v8.h"
+#include "include/cef_values.h"
+#include "include/internal/cef_time.h"
+
+// Conversions between V8 values and CefValue, for passing structured data
+// between the renderer's JavaScript and process messages. Renderer process
+// only; must be called with a V8 context entered.
+
+// Deeper nesting converts to null.
+constexpr int kMaxV8ValueDepth = 64;
+
+// Walks a V8 value the way JSON.stringify would, but natively, so a page
+// that replaces JSON.stringify cannot change results and nothing is encoded
+// as text on the way. Differences from JSON.stringify:
+//   - toJSON methods are not called; dates become ISO 8601 strings directly.
+//   - ArrayBuffers, typed arrays and DataViews become binary values of the
+//     bytes they view. Views are recognised with the context's original
+//     ArrayBuffer.isView, so objects that merely look like one do not count.
+//   - Cycles and anything nested deeper than kMaxV8ValueDepth become null
+//     instead of throwing.
+// Property getters still run, as they do for JSON.stringify.
+class V8ValueSerializer {
+ public:
+  // |isView| is ArrayBuffer.isView as captured when the context was
+  // created; without it, views serialize as plain objects.
+  explicit V8ValueSerializer(CefRefPtr<CefV8Value> isView) : isView(isView) {}
+
+  CefRefPtr<CefValue> Serialize(CefRefPtr<CefV8Value> value) {
+    CefRefPtr<CefValue> result = Convert(value);
+    if (!result) {
+      result = CefValue::Create();
+      result->SetNull();
+    }
+    return result;
+  }
+
+ private:
+  // Returns nullptr for the values JSON leaves out of objects (undefined and
+  // functions); arrays hold null in their place.
+  CefRefPtr<CefValue> Convert(CefRefPtr<CefV8Value> value) {
+    if (!value || !value->IsValid() || value->IsUndefined() || value->IsFunction()) {
+      return nullptr;
+    }
+    CefRefPtr<CefValue> result = CefValue::Create();
+    if (value->IsNull()) {
+      result->SetNull();
+    } else if (value->IsBool()) {
+      result->SetBool(value->GetBoolValue());
+    } else if (value->IsInt()) {
+      result->SetInt(value->GetIntValue());
+    } else if (value->IsUInt() || value->IsDouble()) {
+      double number = value->GetDoubleValue();
+      if (std::isfinite(number)) {
+        result->SetDouble(number);
+      } else {
+        result->SetNull();
+      }
+    } else if (value->IsString()) {
+      result->SetString(value->GetStringValue());
+    } else if (value->IsDate()) {
+      SetDate(result, value->GetDateValue());
+    } else if (value->IsArrayBuffer()) {
+      SetBytes(result, value, 0, value->GetArrayBufferByteLength());
+    } else if (value->IsObject()) {
+      if (static_cast<int>(ancestors.size()) >= kMaxV8ValueDepth || IsAncestor(value)) {
+        result->SetNull();
+        return result;
+      }
+      ancestors.push_back(value);
+      if (value->IsArray()) {
+        SetList(result, value);
+      } else if (!SetView(result, value)) {
+        SetDictionary(result, value);
+      }
+      ancestors.pop_back();
+    } else {
+      result->SetNull();
+    }
+    return result;
+  }
+
+  bool IsAncestor(CefRefPtr<CefV8Value> value) {
+    for (const CefRefPtr<CefV8Value>& ancestor : ancestors) {
+      if (ancestor->IsSame(value)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void SetList(CefRefPtr<CefValue> result, CefRefPtr<CefV8Value> array) {
+    CefRefPtr<CefListValue> list = CefListValue::Create();
+    int length = array->GetArrayLength();
+    list->SetSize(length);
+    for (int i = 0; i < length; i++) {
+      CefRefPtr<CefValue> element = Convert(array->GetValue(i));
+      if (element) {
+        list->SetValue(i, element);
+      } else {
+        list->SetNull(i);
+      }
+    }
+    result->SetList(list);
+  }
+
+  void SetDictionary(CefRefPtr<CefValue> result, CefRefPtr<CefV8Value> object) {
+    CefRefPtr<CefDictionaryValue> dict = CefDictionaryValue::Create();
+    std::vector<CefString> keys;
+    object->GetKeys(keys);
+    for (const CefString& key : keys) {
+      CefRefPtr<CefValue> property = Convert(object->GetValue(key));
+      if (property) {
+        dict->SetValue(key, property);
+      }
+    }
+    result->SetDictionary(dict);
+  }
+
+  // Typed arrays and DataViews: objects viewing a range of an ArrayBuffer.
+  bool SetView(CefRefPtr<CefValue> result, CefRefPtr<CefV8Value> view) {
+    if (!isView) {
+      return false;
+    }
+    CefRefPtr<CefV8Value> viewed = isView->ExecuteFunction(nullptr, {view});
+    if (isView->HasException()) {
+      isView->ClearException();
+      return false;
+    }
+    if (!viewed || !viewed->IsBool() || !viewed->GetBoolValue()) {
+      return false;
+    }
+    CefRefPtr<CefV8Value> buffer = view->GetValue("buffer");
+    CefRefPtr<CefV8Value> byteOffset = view->GetValue("byteOffset");
+    CefRefPtr<CefV8Value> byteLength = view->GetValue("byteLength");
+    if (!buffer || !buffer->IsArrayBuffer() || !byteOffset || !byteOffset->IsUInt() ||
+        !byteLength || !byteLength->IsUInt()) {
+      return false;
+    }
+    SetBytes(result, buffer, byteOffset->GetUIntValue(), byteLength->GetUIntValue());
+    return true;
+  }
+
+  void SetBytes(CefRefPtr<CefValue> result,
+                CefRefPtr<CefV8Value> buffer,
+                size_t offset,
+                size_t length) {
+    const char* data = static_cast<const char*>(buffer->GetArrayBufferData());
+    size_t size = buffer->GetArrayBufferByteLength();
+    // A detached buffer has no data.
+    if (!data || offset > size) {
+      result->SetBinary(CefBinaryValue::Create("", 0));
+      return;
+    }
+    length = std::min(length, size - offset);
+    result->SetBinary(CefBinaryValue::Create(data + offset, length));
+  }
+
+  void SetDate(CefRefPtr<CefValue> result, CefBaseTime date) {
+    cef_time_t time;
+    if (!cef_time_from_basetime(date, &time)) {
+      // Invalid Date.
+      result->SetNull();
+      return;
+    }
+    // Years outside 0000-9999 take the expanded ±YYYYYY form, as in
+    // Date.prototype.toISOString.
+    const char* format = time.year >= 0 && time.year <= 9999
+                             ? "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ"
+                             : "%+07d-%02d-%02dT%02d:%02d:%02d.%03dZ";
+    char iso[40];
+    snprintf(iso, sizeof(iso), format, time.year, time.month, time.day_of_month, time.hour,
+             time.minute, time.second, time.millisecond);
+    result->SetString(iso);
+  }
+
+  CefRefPtr<CefV8Value> isView;
+  std::vector<CefRefPtr<CefV8Value>> ancestors;
+};
+
+inline CefRefPtr<CefValue> V8ToCefValue(CefRefPtr<CefV8Value> value,
+                                        CefRefPtr<CefV8Value> isView) {
+  return V8ValueSerializer(isView).Serialize(value);
+}
+
+inline CefRefPtr<CefV8Value> CefValueToV8(CefRefPtr<CefValue> value) {
+  if (!value) {
+    return CefV8Value::CreateNull();
+  }
+  switch (value->GetType()) {
+    case VTYPE_BOOL:
+      return CefV8Value::CreateBool(value->GetBool());
+    case VTYPE_INT:
+      return CefV8Value::CreateInt(value->GetInt());
+    case VTYPE_DOUBLE:
+      return CefV8Value::CreateDouble(value->GetDouble());
+    case VTYPE_STRING:
+      return CefV8Value::CreateString(value->GetString());
+    case VTYPE_BINARY: {
+      // The reverse of V8ValueSerializer: bytes become an ArrayBuffer.
+      CefRefPtr<CefBinaryValue> binary = value->GetBinary();
+      // Never hand V8 a null pointer, even for an empty buffer.
+      std::vector<uint8_t> bytes(std::max<size_t>(binary->GetSize(), 1));
+      binary->GetData(bytes.data(), binary->GetSize(), 0);
+      CefRefPtr<CefV8Value> buffer =
+          CefV8Value::CreateArrayBufferWithCopy(bytes.data(), binary->GetSize());
+      return buffer ? buffer : CefV8Value::CreateNull();
+    }
+    case VTYPE_LIST: {
+      CefRefPtr<CefListValue> list = value->GetList();
+      CefRefPtr<CefV8Value> array = CefV8Value::CreateArray(static_cast<int>(list->GetSize()));
+      for (size_t i = 0; i < list->GetSize(); i++) {
+        array->SetValue(static_cast<int>(i), CefValueToV8(list->GetValue(i)));
+      }
+      return array;
+    }
+    case VTYPE_DICTIONARY: {
+      CefRefPtr<CefDictionaryValue> dict = value->GetDictionary();
+      CefDictionaryValue::KeyList keys;
+      dict->GetKeys(keys);
+      CefRefPtr<CefV8Value> object = CefV8Value::CreateObject(nullptr, nullptr);
+      for (const CefString& key : keys) {
+        object->SetValue(key, CefValueToV8(dict->GetValue(key)), V8_PROPERTY_ATTRIBUTE_NONE);
+      }
+      return object;
+    }
+    default:
+      return CefV8Value::CreateNull();
+  }
+}
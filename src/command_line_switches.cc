@@ -57,5 +57,16 @@ const char kUseBottomControls[] = "use-bottom-controls";
 const char kHidePipFrame[] = "hide-pip-frame";
 const char kHideChromeBubbles[] = "hide-chrome-bubbles";
 const char kApplicationProcessId[] = "application-process-id";
+const char kRpcMaxBatchFrames[] = "rpc-max-batch-frames";
+const char kRpcMaxBatchBytes[] = "rpc-max-batch-bytes";
+const char kRpcMaxLingerMs[] = "rpc-max-linger-ms";
+const char kRpcDispatchWorkers[] = "rpc-dispatch-workers";
+const char kInputCoalescingWindowMs[] = "input-coalescing-window-ms";
+const char kPaintFramesInFlight[] = "paint-frames-in-flight";
+const char kPaintAckTimeoutMs[] = "paint-ack-timeout-ms";
+const char kBrowserPoolSize[] = "browser-pool-size";
+const char kBrowserPoolPrewarm[] = "browser-pool-prewarm";
+const char kRendererMemoryBudgetMb[] = "renderer-memory-budget-mb";
+const char kMemorySampleIntervalMs[] = "memory-sample-interval-ms";
 
 }  // namespace switches
@@ -49,5 +49,16 @@ extern const char kUseBottomControls[];
 extern const char kHidePipFrame[];
 extern const char kHideChromeBubbles[];
 extern const char kApplicationProcessId[];
+extern const char kRpcMaxBatchFrames[];
+extern const char kRpcMaxBatchBytes[];
+extern const char kRpcMaxLingerMs[];
+extern const char kRpcDispatchWorkers[];
+extern const char kInputCoalescingWindowMs[];
+extern const char kPaintFramesInFlight[];
+extern const char kPaintAckTimeoutMs[];
+extern const char kBrowserPoolSize[];
+extern const char kBrowserPoolPrewarm[];
+extern const char kRendererMemoryBudgetMb[];
+extern const char kMemorySampleIntervalMs[];
 
 }  // namespace switches
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "include/internal/cef_types_wrappers.h"
+#include "json.hpp"
+#include "pixel_kernels.h"
+
+using json = nlohmann::json;
+
+const size_t kDefaultMaxDirtyRects = 8;
+
+namespace dirty_rects {
+
+inline bool IsEmpty(const CefRect& r) {
+  return r.width <= 0 || r.height <= 0;
+}
+
+inline int64_t Area(const CefRect& r) {
+  return IsEmpty(r) ? 0 : static_cast<int64_t>(r.width) * r.height;
+}
+
+inline CefRect Intersection(const CefRect& a, const CefRect& b) {
+  int left = std::max(a.x, b.x);
+  int top = std::max(a.y, b.y);
+  int right = std::min(a.x + a.width, b.x + b.width);
+  int bottom = std::min(a.y + a.height, b.y + b.height);
+  if (right <= left || bottom <= top) {
+    return CefRect(0, 0, 0, 0);
+  }
+  return CefRect(left, top, right - left, bottom - top);
+}
+
+inline CefRect Union(const CefRect& a, const CefRect& b) {
+  int left = std::min(a.x, b.x);
+  int top = std::min(a.y, b.y);
+  int right = std::max(a.x + a.width, b.x + b.width);
+  int bottom = std::max(a.y + a.height, b.y + b.height);
+  return CefRect(left, top, right - left, bottom - top);
+}
+
+inline bool Overlaps(const CefRect& a, const CefRect& b) {
+  return !IsEmpty(Intersection(a, b));
+}
+
+// Replaces every pair of overlapping rects by their union until no two
+// overlap, so the total area is the sum of the individual areas.
+inline void MergeOverlapping(std::vector<CefRect>& rects) {
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (size_t i = 0; i < rects.size() && !merged; i++) {
+      for (size_t j = i + 1; j < rects.size(); j++) {
+        if (Overlaps(rects[i], rects[j])) {
+          rects[i] = Union(rects[i], rects[j]);
+          rects.erase(rects.begin() + j);
+          merged = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace dirty_rects
+
+// Clips |rects| to |bounds| (unless |bounds| is empty), drops empty ones and
+// merges them into at most |maxRects| non-overlapping rectangles. While
+// there are too many, the pair whose union adds the least undamaged area is
+// merged. Large lists are collapsed into their bounding box straight away,
+// which is what the client would end up uploading anyway.
+inline std::vector<CefRect> SimplifyDirtyRects(const std::vector<CefRect>& rects,
+                                               const CefRect& bounds,
+                                               size_t maxRects) {
+  using namespace dirty_rects;
+  const size_t kMaxPairwiseRects = 64;
+
+  std::vector<CefRect> result;
+  result.reserve(rects.size());
+  for (const CefRect& rect : rects) {
+    CefRect clipped = IsEmpty(bounds) ? rect : Intersection(rect, bounds);
+    if (!IsEmpty(clipped)) {
+      result.push_back(clipped);
+    }
+  }
+  if (result.empty()) {
+    return result;
+  }
+
+  maxRects = std::max<size_t>(maxRects, 1);
+  if (result.size() > kMaxPairwiseRects) {
+    CefRect box = result[0];
+    for (const CefRect& rect : result) {
+      box = Union(box, rect);
+    }
+    result.assign(1, box);
+    return result;
+  }
+
+  MergeOverlapping(result);
+  while (result.size() > maxRects) {
+    size_t bestI = 0;
+    size_t bestJ = 1;
+    int64_t bestCost = INT64_MAX;
+    for (size_t i = 0; i < result.size(); i++) {
+      for (size_t j = i + 1; j < result.size(); j++) {
+        int64_t cost = Area(Union(result[i], result[j])) - Area(result[i]) -
+                       Area(result[j]);
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestI = i;
+          bestJ = j;
+        }
+      }
+    }
+    result[bestI] = Union(result[bestI], result[bestJ]);
+    result.erase(result.begin() + bestJ);
+    MergeOverlapping(result);
+  }
+  return result;
+}
+
+// Content hashes of the tiles of the last frame sent, used to drop damage
+// over tiles whose pixels did not actually change (e.g. a caret blink that
+// repaints a region with identical content).
+class TileHashGrid {
+ public:
+  static constexpr int kTileSize = 64;
+
+  // Returns |damage| restricted to the tiles that differ from the last
+  // committed frame. The new hashes only take effect after Commit(), so a
+  // frame that ends up not being sent does not hide its changes.
+  std::vector<CefRect> Filter(const uint8_t* pixels,
+                              size_t stride,
+                              int width,
+                              int height,
+                              const std::vector<CefRect>& damage,
+                              size_t maxRects,
+                              uint64_t& tilesUnchanged) {
+    if (width != this->width || height != this->height) {
+      this->width = width;
+      this->height = height;
+      columns = (width + kTileSize - 1) / kTileSize;
+      rows = (height + kTileSize - 1) / kTileSize;
+      hashes.assign(static_cast<size_t>(columns) * rows, 0);
+      known.assign(hashes.size(), false);
+    }
+    pending.clear();
+    tileState.assign(hashes.size(), kTileUntouched);
+
+    std::vector<CefRect> changed;
+    for (const CefRect& rect : damage) {
+      int firstColumn = rect.x / kTileSize;
+      int lastColumn = std::min(columns - 1, (rect.x + rect.width - 1) / kTileSize);
+      int firstRow = rect.y / kTileSize;
+      int lastRow = std::min(rows - 1, (rect.y + rect.height - 1) / kTileSize);
+      for (int row = firstRow; row <= lastRow; row++) {
+        for (int column = firstColumn; column <= lastColumn; column++) {
+          size_t index = static_cast<size_t>(row) * columns + column;
+          CefRect tile(column * kTileSize, row * kTileSize,
+                       std::min(kTileSize, width - column * kTileSize),
+                       std::min(kTileSize, height - row * kTileSize));
+          if (tileState[index] == kTileUntouched) {
+            uint64_t hash = pixel_kernels::HashRect(
+                pixels + tile.y * stride + static_cast<size_t>(tile.x) * 4, stride,
+                tile.width, tile.height);
+            if (known[index] && hashes[index] == hash) {
+              tileState[index] = kTileUnchanged;
+              tilesUnchanged++;
+            } else {
+              tileState[index] = kTileChanged;
+              pending.emplace_back(index, hash);
+            }
+          }
+          if (tileState[index] == kTileChanged) {
+            changed.push_back(dirty_rects::Intersection(rect, tile));
+          }
+        }
+      }
+    }
+    return SimplifyDirtyRects(changed, CefRect(0, 0, width, height), maxRects);
+  }
+
+  void Commit() {
+    for (const auto& update : pending) {
+      hashes[update.first] = update.second;
+      known[update.first] = true;
+    }
+    pending.clear();
+  }
+
+ private:
+  static constexpr char kTileUntouched = 0;
+  static constexpr char kTileUnchanged = 1;
+  static constexpr char kTileChanged = 2;
+
+  int width = 0;
+  int height = 0;
+  int columns = 0;
+  int rows = 0;
+  std::vector<uint64_t> hashes;
+  std::vector<bool> known;
+  std::vector<std::pair<size_t, uint64_t>> pending;
+  std::vector<char> tileState;
+};
+
+// Damage statistics across all browsers' paint events.
+struct DirtyRectStats {
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> skippedEmpty{0};
+  std::atomic<uint64_t> rectsIn{0};
+  std::atomic<uint64_t> rectsOut{0};
+  std::atomic<uint64_t> dirtyPixels{0};
+  std::atomic<uint64_t> surfacePixels{0};
+  std::atomic<uint64_t> tilesUnchanged{0};
+
+  void Record(size_t inCount,
+              const std::vector<CefRect>& out,
+              const CefRect& surface) {
+    int64_t dirty = 0;
+    for (const CefRect& rect : out) {
+      dirty += dirty_rects::Area(rect);
+    }
+    frames++;
+    rectsIn += inCount;
+    rectsOut += out.size();
+    dirtyPixels += static_cast<uint64_t>(dirty);
+    surfacePixels += static_cast<uint64_t>(dirty_rects::Area(surface));
+  }
+
+  json CollectMetrics() const {
+    uint64_t frameCount = frames.load();
+    uint64_t dirty = dirtyPixels.load();
+    uint64_t surface = surfacePixels.load();
+    return {
+        {"frames", frameCount},
+        {"skippedEmpty", skippedEmpty.load()},
+        {"rectsIn", rectsIn.load()},
+        {"rectsOut", rectsOut.load()},
+        {"tilesUnchanged", tilesUnchanged.load()},
+        {"dirtyFraction", surface ? static_cast<double>(dirty) / surface : 0.0},
+        // Bytes a client doing partial BGRA uploads would copy.
+        {"dirtyBytesPerFrame",
+         frameCount ? static_cast<double>(dirty) * 4 / frameCount : 0.0},
+        {"fullBytesPerFrame",
+         frameCount ? static_cast<double>(surface) * 4 / frameCount : 0.0},
+    };
+  }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Receive buffer for the length-prefixed frames on the RPC socket:
+// [len (4 bytes)] [payload (len bytes)].
+//
+// Socket reads go straight into the free tail of the buffer and complete
+// frames are consumed by advancing a read cursor, so a burst of small frames
+// costs O(n) rather than the O(n^2) of erasing from the front of a vector.
+// Unread bytes (at most one partial frame) are only moved back to the start
+// of the buffer when the tail runs out of room. Frames are handed out as
+// views into the buffer, so the caller copies a payload only if it has to
+// keep it.
+//
+// Has no CEF or SDL dependencies.
+class FrameReader {
+ public:
+  enum class Status {
+    Frame,      // a complete frame was returned
+    NeedMore,   // more bytes must be read before the next frame is complete
+    Oversized,  // the peer announced a frame larger than kMaxFrameSize
+  };
+
+  static constexpr size_t kHeaderSize = 4;
+  static constexpr size_t kDefaultCapacity = 64 * 1024;
+  static constexpr size_t kMinReadSize = 16 * 1024;
+  static constexpr uint32_t kMaxFrameSize = 256 * 1024 * 1024;
+
+  explicit FrameReader(size_t capacity = kDefaultCapacity)
+      : buffer(capacity), readPos(0), writePos(0), initialCapacity(capacity) {}
+
+  // Destination for the next socket read. Always at least kMinReadSize bytes,
+  // or the remainder of the frame currently being received if that is larger.
+  uint8_t* WritePtr() {
+    EnsureWritable(kMinReadSize);
+    return buffer.data() + writePos;
+  }
+
+  size_t WritableSize() {
+    EnsureWritable(kMinReadSize);
+    return buffer.size() - writePos;
+  }
+
+  // Marks |bytes| written at WritePtr() as received.
+  void Commit(size_t bytes) { writePos += bytes; }
+
+  // Points |frame| at the next complete frame payload. The view stays valid
+  // until the next call to any other method of the reader, which may move
+  // or free the buffer.
+  Status Next(std::string_view& frame) {
+    // Deferred from the last frame, whose view is no longer needed.
+    if (readPos == writePos && readPos > 0) {
+      readPos = 0;
+      writePos = 0;
+      ShrinkIfOversized();
+    }
+
+    size_t available = writePos - readPos;
+    if (available < kHeaderSize) {
+      return Status::NeedMore;
+    }
+
+    uint32_t frameLen;
+    memcpy(&frameLen, buffer.data() + readPos, kHeaderSize);
+    if (frameLen > kMaxFrameSize) {
+      return Status::Oversized;
+    }
+
+    if (available < kHeaderSize + frameLen) {
+      // Make room for the whole frame now so the following reads land in
+      // place instead of growing the buffer piecemeal.
+      EnsureWritable(kHeaderSize + frameLen - available);
+      return Status::NeedMore;
+    }
+
+    frame = std::string_view(
+        reinterpret_cast<const char*>(buffer.data() + readPos + kHeaderSize), frameLen);
+    readPos += kHeaderSize + frameLen;
+    return Status::Frame;
+  }
+
+  // Drops any buffered bytes, e.g. when the connection is replaced.
+  void Reset() {
+    readPos = 0;
+    writePos = 0;
+    ShrinkIfOversized();
+  }
+
+  size_t BufferedSize() const { return writePos - readPos; }
+
+ private:
+  void EnsureWritable(size_t bytes) {
+    if (readPos == writePos) {
+      readPos = 0;
+      writePos = 0;
+      ShrinkIfOversized();
+    }
+    if (buffer.size() - writePos >= bytes) {
+      return;
+    }
+    size_t unread = writePos - readPos;
+    if (readPos > 0) {
+      memmove(buffer.data(), buffer.data() + readPos, unread);
+      readPos = 0;
+      writePos = unread;
+      if (buffer.size() - writePos >= bytes) {
+        return;
+      }
+    }
+    size_t needed = writePos + bytes;
+    size_t capacity = buffer.size() * 2;
+    buffer.resize(capacity > needed ? capacity : needed);
+  }
+
+  // Gives back memory after an unusually large frame has been consumed.
+  void ShrinkIfOversized() {
+    if (buffer.size() > initialCapacity * 4) {
+      std::vector<uint8_t>(initialCapacity).swap(buffer);
+    }
+  }
+
+  std::vector<uint8_t> buffer;
+  size_t readPos;
+  size_t writePos;
+  size_t initialCapacity;
+};
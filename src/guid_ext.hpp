@@ -4,12 +4,34 @@
 #include <cstdint>
 #include <cstring>
 #include <functional>
+#include <string>
 #include <rpc.h>
 
 inline bool operator<(const UUID& a, const UUID& b) {
   return std::memcmp(&a, &b, sizeof(UUID)) < 0;
 }
 
+// Canonical lowercase "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" form.
+inline std::string UuidToString(const UUID& id) {
+  RPC_CSTR str;
+  if (UuidToStringA(const_cast<UUID*>(&id), &str) != RPC_S_OK) {
+    return std::string();
+  }
+  std::string result(reinterpret_cast<char*>(str));
+  RpcStringFreeA(&str);
+  return result;
+}
+
+// Returns false (and leaves |id| nil) if |str| is not a UUID.
+inline bool UuidFromString(const std::string& str, UUID& id) {
+  RPC_CSTR rpcStr = reinterpret_cast<RPC_CSTR>(const_cast<char*>(str.c_str()));
+  if (UuidFromStringA(rpcStr, &id) != RPC_S_OK) {
+    UuidCreateNil(&id);
+    return false;
+  }
+  return true;
+}
+
 namespace std {
 template <>
 struct hash<UUID> {
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <SDL3/SDL.h>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Count, average and maximum of a duration.
+struct LatencyStats {
+  std::atomic<uint64_t> count{0};
+  std::atomic<Uint64> totalNs{0};
+  std::atomic<Uint64> maxNs{0};
+
+  void Record(Uint64 ns) {
+    count++;
+    totalNs += ns;
+    Uint64 max = maxNs.load();
+    while (ns > max && !maxNs.compare_exchange_weak(max, ns)) {
+    }
+  }
+
+  json CollectMetrics() const {
+    uint64_t n = count.load();
+    return {
+        {"count", n},
+        {"averageMs", n ? static_cast<double>(totalNs.load()) / n / SDL_NS_PER_MS : 0.0},
+        {"maxMs", static_cast<double>(maxNs.load()) / SDL_NS_PER_MS},
+    };
+  }
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include "json.hpp"
+#include "latency_stats.hpp"
+
+using json = nlohmann::json;
+
+// Keeps renderer memory within a budget by hibernating hidden browsers.
+//
+// Renderers periodically report their process's private memory and the
+// page's URL and scroll position. Browsers sharing a renderer process are
+// each charged an equal share of it. When the total is over budget, the
+// hidden browsers that have been hidden the longest are hibernated: the
+// caller navigates them to about:blank and keeps what the governor saved
+// so the page can be reloaded and scrolled back when shown again.
+//
+// Used on the CEF UI thread; metrics may be read from any thread.
+class MemoryGovernor {
+ public:
+  struct SavedPage {
+    std::string url;
+    int scrollX = 0;
+    int scrollY = 0;
+  };
+
+  MemoryGovernor() : mutex(SDL_CreateMutex()) {}
+  ~MemoryGovernor() { SDL_DestroyMutex(mutex); }
+  MemoryGovernor(const MemoryGovernor&) = delete;
+  MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+  // Zero disables hibernation.
+  void Configure(uint64_t budgetBytes) { this->budgetBytes = budgetBytes; }
+  uint64_t BudgetBytes() const { return budgetBytes; }
+
+  void Track(int browserId, Uint64 now) {
+    SDL_LockMutex(mutex);
+    browsers[browserId].lastVisibleNs = now;
+    SDL_UnlockMutex(mutex);
+  }
+
+  void Forget(int browserId) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end()) {
+      int processId = it->second.processId;
+      browsers.erase(it);
+      bool shared = std::any_of(browsers.begin(), browsers.end(), [&](const auto& other) {
+        return other.second.processId == processId;
+      });
+      if (!shared) {
+        processBytesById.erase(processId);
+      }
+    }
+    SDL_UnlockMutex(mutex);
+  }
+
+  // Returns false for unknown browsers.
+  bool SetVisible(int browserId, bool visible, Uint64 now) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    bool known = it != browsers.end();
+    if (known) {
+      // A browser stops being recently used when it is hidden.
+      if (it->second.visible || visible) {
+        it->second.lastVisibleNs = now;
+      }
+      it->second.visible = visible;
+    }
+    SDL_UnlockMutex(mutex);
+    return known;
+  }
+
+  bool IsVisible(int browserId) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    bool visible = it == browsers.end() || it->second.visible;
+    SDL_UnlockMutex(mutex);
+    return visible;
+  }
+
+  bool IsHibernated(int browserId) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    bool hibernated = it != browsers.end() && it->second.hibernated;
+    SDL_UnlockMutex(mutex);
+    return hibernated;
+  }
+
+  void RecordSample(int browserId,
+                    int processId,
+                    uint64_t processBytes,
+                    const SavedPage& page) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end() && !it->second.hibernated) {
+      it->second.processId = processId;
+      it->second.page = page;
+      processBytesById[processId] = processBytes;
+      samples++;
+    }
+    SDL_UnlockMutex(mutex);
+  }
+
+  // Hidden, awake browsers to hibernate, least recently visible first, so
+  // that the estimated total fits the budget.
+  std::vector<int> SelectVictims() {
+    std::vector<int> victims;
+    if (budgetBytes == 0) {
+      return victims;
+    }
+    SDL_LockMutex(mutex);
+    std::map<int, uint64_t> shares = SharesLocked();
+    uint64_t total = 0;
+    for (const auto& it : shares) {
+      total += it.second;
+    }
+    std::vector<std::pair<Uint64, int>> candidates;
+    for (const auto& it : browsers) {
+      if (!it.second.visible && !it.second.hibernated && !it.second.page.url.empty()) {
+        candidates.emplace_back(it.second.lastVisibleNs, it.first);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (const auto& candidate : candidates) {
+      if (total <= budgetBytes) {
+        break;
+      }
+      victims.push_back(candidate.second);
+      total -= std::min(total, shares[candidate.second]);
+    }
+    SDL_UnlockMutex(mutex);
+    return victims;
+  }
+
+  // Marks a browser hibernated and returns the page to restore later.
+  std::optional<SavedPage> Hibernate(int browserId) {
+    std::optional<SavedPage> page;
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end() && !it->second.hibernated) {
+      uint64_t share = SharesLocked()[browserId];
+      it->second.hibernated = true;
+      page = it->second.page;
+      hibernations++;
+      bytesReclaimed += share;
+    }
+    SDL_UnlockMutex(mutex);
+    return page;
+  }
+
+  // Wakes a hibernated browser and returns its saved page.
+  std::optional<SavedPage> Wake(int browserId) {
+    std::optional<SavedPage> page;
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end() && it->second.hibernated) {
+      it->second.hibernated = false;
+      page = it->second.page;
+      restores++;
+    }
+    SDL_UnlockMutex(mutex);
+    return page;
+  }
+
+  // Time from a SetVisibility that wakes a browser to its first frame.
+  LatencyStats& RestoreLatency() { return restoreLatency; }
+
+  json CollectMetrics() {
+    SDL_LockMutex(mutex);
+    uint64_t total = 0;
+    for (const auto& it : SharesLocked()) {
+      total += it.second;
+    }
+    size_t hidden = 0;
+    size_t hibernated = 0;
+    for (const auto& it : browsers) {
+      hidden += it.second.visible ? 0 : 1;
+      hibernated += it.second.hibernated ? 1 : 0;
+    }
+    SDL_UnlockMutex(mutex);
+    return {
+        {"budgetBytes", budgetBytes},
+        {"estimatedBytes", total},
+        {"hidden", hidden},
+        {"hibernated", hibernated},
+        {"samples", samples.load()},
+        {"hibernations", hibernations.load()},
+        {"restores", restores.load()},
+        // Charged to the browsers when they were hibernated.
+        {"estimatedBytesReclaimed", bytesReclaimed.load()},
+        {"restoreFirstPaint", restoreLatency.CollectMetrics()},
+    };
+  }
+
+ private:
+  struct Browser {
+    bool visible = true;
+    bool hibernated = false;
+    Uint64 lastVisibleNs = 0;
+    int processId = 0;
+    SavedPage page;
+  };
+
+  // Each awake, sampled browser's share of its renderer's memory. Requires
+  // the mutex.
+  std::map<int, uint64_t> SharesLocked() {
+    std::unordered_map<int, int> browsersPerProcess;
+    for (const auto& it : browsers) {
+      if (!it.second.hibernated && it.second.processId != 0) {
+        browsersPerProcess[it.second.processId]++;
+      }
+    }
+    std::map<int, uint64_t> shares;
+    for (const auto& it : browsers) {
+      if (it.second.hibernated || it.second.processId == 0) {
+        continue;
+      }
+      shares[it.first] = processBytesById[it.second.processId] /
+                         browsersPerProcess[it.second.processId];
+    }
+    return shares;
+  }
+
+  uint64_t budgetBytes = 0;
+  SDL_Mutex* mutex;
+  std::unordered_map<int, Browser> browsers;
+  std::unordered_map<int, uint64_t> processBytesById;
+  std::atomic<uint64_t> samples{0};
+  std::atomic<uint64_t> hibernations{0};
+  std::atomic<uint64_t> restores{0};
+  std::atomic<uint64_t> bytesReclaimed{0};
+  LatencyStats restoreLatency;
+};
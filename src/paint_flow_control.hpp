@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include "guid_ext.hpp"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Flow control for paint events. Software frames are copied into the
+// runner-owned frame ring and accelerated frames into the texture pool, so
+// neither waits for the client once the paint callback returns.
+//
+// Each browser may have up to a fixed number of paint events sent to the
+// client and not yet acknowledged. Paints beyond that window are dropped
+// instead of blocking the UI thread; the browser is then owed a repaint,
+// which the caller issues once an acknowledgement frees a slot (or, for a
+// client that stopped answering, once the oldest frame has timed out).
+// Frames whose acknowledgement does not arrive within the timeout stop
+// counting against the window. Their ids are kept (up to kMaxExpiredFrames
+// per browser) so a late acknowledgement still reports the browser: the
+// frame ring or texture pool slot such a frame holds stays in use until then.
+//
+// Paints are admitted on the UI thread and acknowledgements arrive on the
+// RPC worker, so all state is guarded by one mutex.
+class PaintFlowControl {
+ public:
+  enum class Admission {
+    Send,       // send the frame
+    Drop,       // window full; a repaint is already owed
+    DropFirst,  // window full; first drop since the last repaint, so the
+                // caller should arm a retry after AckTimeoutNs()
+  };
+
+  static constexpr int kDefaultFramesInFlight = 2;
+  static constexpr Uint64 kDefaultAckTimeoutNs = 1000 * SDL_NS_PER_MS;
+  // Timed-out frames remembered per browser; older ones are forgotten, as
+  // the client that would acknowledge them is most likely gone.
+  static constexpr size_t kMaxExpiredFrames = 64;
+
+  PaintFlowControl() : mutex(SDL_CreateMutex()) {}
+  ~PaintFlowControl() { SDL_DestroyMutex(mutex); }
+  PaintFlowControl(const PaintFlowControl&) = delete;
+  PaintFlowControl& operator=(const PaintFlowControl&) = delete;
+
+  // Must be called before the first paint.
+  void Configure(int framesInFlight, Uint64 timeoutNs) {
+    maxFramesInFlight = std::max(1, framesInFlight);
+    ackTimeoutNs = timeoutNs;
+  }
+
+  int FramesInFlight() const { return maxFramesInFlight; }
+  Uint64 AckTimeoutNs() const { return ackTimeoutNs; }
+
+  Admission TryBegin(int browserId, const UUID& frameId, Uint64 now) {
+    SDL_LockMutex(mutex);
+    Browser& browser = browsers[browserId];
+    ExpireLocked(browser, now);
+    Admission admission = Admission::Send;
+    if (static_cast<int>(browser.inFlight.size()) >= maxFramesInFlight) {
+      admission = browser.repaintPending ? Admission::Drop : Admission::DropFirst;
+      browser.repaintPending = true;
+      dropped++;
+    } else {
+      browser.inFlight.push_back(Frame{frameId, now});
+      owners[frameId] = browserId;
+      sent++;
+    }
+    SDL_UnlockMutex(mutex);
+    return admission;
+  }
+
+  // Returns the browser a tracked frame belonged to, whether it is still
+  // in flight or already timed out, or nullopt for ids that are not paints.
+  // Sets |repaint| if that browser is owed a repaint.
+  std::optional<int> Complete(const UUID& frameId, Uint64 now, bool& repaint) {
+    repaint = false;
+    SDL_LockMutex(mutex);
+    auto ownerIt = owners.find(frameId);
+    if (ownerIt == owners.end()) {
+      SDL_UnlockMutex(mutex);
+      return std::nullopt;
+    }
+    int browserId = ownerIt->second;
+    owners.erase(ownerIt);
+
+    Browser& browser = browsers[browserId];
+    for (auto it = browser.inFlight.begin(); it != browser.inFlight.end(); ++it) {
+      if (memcmp(&it->id, &frameId, sizeof(UUID)) == 0) {
+        Uint64 rtt = now - it->sentNs;
+        rttTotalNs += rtt;
+        rttMaxNs = std::max(rttMaxNs, rtt);
+        rttLastNs = rtt;
+        acked++;
+        browser.inFlight.erase(it);
+        break;
+      }
+    }
+    auto expiredIt = std::find_if(
+        browser.expired.begin(), browser.expired.end(),
+        [&frameId](const UUID& id) { return memcmp(&id, &frameId, sizeof(UUID)) == 0; });
+    if (expiredIt != browser.expired.end()) {
+      browser.expired.erase(expiredIt);
+      lateAcked++;
+    }
+    repaint = browser.repaintPending;
+    browser.repaintPending = false;
+    SDL_UnlockMutex(mutex);
+    return browserId;
+  }
+
+  // Claims the repaint owed to a browser, if any. Used by the retry armed
+  // after Admission::DropFirst; frames that timed out by then no longer
+  // count, so the repaint is admitted.
+  bool TakeRepaint(int browserId) {
+    SDL_LockMutex(mutex);
+    bool repaint = false;
+    auto it = browsers.find(browserId);
+    if (it != browsers.end()) {
+      repaint = it->second.repaintPending;
+      it->second.repaintPending = false;
+    }
+    SDL_UnlockMutex(mutex);
+    return repaint;
+  }
+
+  // Counts a software frame dropped because the client still held every
+  // frame ring slot.
+  void CountRingFull() {
+    SDL_LockMutex(mutex);
+    droppedRingFull++;
+    SDL_UnlockMutex(mutex);
+  }
+
+  void RemoveBrowser(int browserId) {
+    SDL_LockMutex(mutex);
+    auto it = browsers.find(browserId);
+    if (it != browsers.end()) {
+      for (const Frame& frame : it->second.inFlight) {
+        owners.erase(frame.id);
+      }
+      for (const UUID& id : it->second.expired) {
+        owners.erase(id);
+      }
+      browsers.erase(it);
+    }
+    SDL_UnlockMutex(mutex);
+  }
+
+  json CollectMetrics() {
+    SDL_LockMutex(mutex);
+    json metrics = {
+        {"framesInFlightLimit", maxFramesInFlight},
+        {"sent", sent},
+        {"acked", acked},
+        {"dropped", dropped},
+        {"droppedRingFull", droppedRingFull},
+        {"timedOut", timedOut},
+        {"lateAcked", lateAcked},
+        {"ackRttAvgMs",
+         acked ? static_cast<double>(rttTotalNs) / acked / SDL_NS_PER_MS : 0.0},
+        {"ackRttMaxMs", static_cast<double>(rttMaxNs) / SDL_NS_PER_MS},
+        {"ackRttLastMs", static_cast<double>(rttLastNs) / SDL_NS_PER_MS},
+    };
+    SDL_UnlockMutex(mutex);
+    return metrics;
+  }
+
+ private:
+  struct Frame {
+    UUID id;
+    Uint64 sentNs;
+  };
+
+  struct Browser {
+    // Oldest first; never longer than maxFramesInFlight.
+    std::vector<Frame> inFlight;
+    // Timed out but not acknowledged yet, oldest first.
+    std::vector<UUID> expired;
+    bool repaintPending = false;
+  };
+
+  void ExpireLocked(Browser& browser, Uint64 now) {
+    while (!browser.inFlight.empty() &&
+           now - browser.inFlight.front().sentNs >= ackTimeoutNs) {
+      browser.expired.push_back(browser.inFlight.front().id);
+      browser.inFlight.erase(browser.inFlight.begin());
+      timedOut++;
+    }
+    if (browser.expired.size() > kMaxExpiredFrames) {
+      size_t excess = browser.expired.size() - kMaxExpiredFrames;
+      for (size_t i = 0; i < excess; i++) {
+        owners.erase(browser.expired[i]);
+      }
+      browser.expired.erase(browser.expired.begin(), browser.expired.begin() + excess);
+    }
+  }
+
+  SDL_Mutex* mutex;
+  int maxFramesInFlight = kDefaultFramesInFlight;
+  Uint64 ackTimeoutNs = kDefaultAckTimeoutNs;
+  std::unordered_map<int, Browser> browsers;
+  std::unordered_map<UUID, int> owners;
+
+  uint64_t sent = 0;
+  uint64_t acked = 0;
+  uint64_t dropped = 0;
+  uint64_t droppedRingFull = 0;
+  uint64_t timedOut = 0;
+  uint64_t lateAcked = 0;
+  Uint64 rttTotalNs = 0;
+  Uint64 rttMaxNs = 0;
+  Uint64 rttLastNs = 0;
+};
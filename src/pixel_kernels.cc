@@ -0,0 +1,442 @@
+#include "pixel_kernels.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXEL_KERNELS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define PIXEL_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace pixel_kernels {
+
+namespace {
+
+const uint64_t kHashSeed0 = 0x9E3779B185EBCA87ULL;
+const uint64_t kHashSeed1 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kHashKey0 = 0x165667B19E3779F9ULL;
+const uint64_t kHashKey1 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kHashPrime = 0x9E3779B1ULL;
+
+// round(c * a / 255) without a division.
+inline uint8_t MulDiv255(unsigned c, unsigned a) {
+  unsigned x = c * a + 128;
+  return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+}
+
+inline uint8_t UnpremultiplyChannel(uint8_t c, float scale) {
+  float value = c * scale + 0.5f;
+  if (value > 255.0f) {
+    value = 255.0f;
+  }
+  return static_cast<uint8_t>(value);
+}
+
+// One 16-byte (4 pixel) step of the tile hash. Mirrors the SSE2 version
+// lane for lane.
+inline void HashAccumulate(uint64_t acc[2], const uint8_t* data) {
+  uint64_t d[2];
+  memcpy(d, data, sizeof(d));
+  uint64_t dk0 = d[0] ^ kHashKey0;
+  uint64_t dk1 = d[1] ^ kHashKey1;
+  acc[0] += d[1] + (dk0 & 0xFFFFFFFF) * (dk0 >> 32);
+  acc[1] += d[0] + (dk1 & 0xFFFFFFFF) * (dk1 >> 32);
+}
+
+inline void HashScrambleRow(uint64_t acc[2]) {
+  acc[0] = ((acc[0] ^ (acc[0] >> 47)) ^ kHashKey0) * kHashPrime;
+  acc[1] = ((acc[1] ^ (acc[1] >> 47)) ^ kHashKey1) * kHashPrime;
+}
+
+// Hashes the last |pixels| (< 4) pixels of a row, zero padded to 16 bytes.
+inline void HashTail(uint64_t acc[2], const uint8_t* row, int pixels) {
+  if (pixels > 0) {
+    uint8_t padded[16] = {};
+    memcpy(padded, row, pixels * 4);
+    HashAccumulate(acc, padded);
+  }
+}
+
+inline uint64_t HashFinish(const uint64_t acc[2], int width, int height) {
+  uint64_t h = acc[0] ^ ((acc[1] << 31) | (acc[1] >> 33));
+  h ^= (static_cast<uint64_t>(width) << 32) ^ static_cast<uint64_t>(height);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+}  // namespace
+
+namespace scalar {
+
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    uint8_t* p = pixels + y * stride;
+    for (int x = 0; x < width; x++, p += 4) {
+      uint8_t b = p[0];
+      p[0] = p[2];
+      p[2] = b;
+    }
+  }
+}
+
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    uint8_t* p = pixels + y * stride;
+    for (int x = 0; x < width; x++, p += 4) {
+      unsigned a = p[3];
+      p[0] = MulDiv255(p[0], a);
+      p[1] = MulDiv255(p[1], a);
+      p[2] = MulDiv255(p[2], a);
+    }
+  }
+}
+
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    uint8_t* p = pixels + y * stride;
+    for (int x = 0; x < width; x++, p += 4) {
+      uint8_t a = p[3];
+      if (a == 0) {
+        p[0] = p[1] = p[2] = 0;
+        continue;
+      }
+      float scale = 255.0f / a;
+      p[0] = UnpremultiplyChannel(p[0], scale);
+      p[1] = UnpremultiplyChannel(p[1], scale);
+      p[2] = UnpremultiplyChannel(p[2], scale);
+    }
+  }
+}
+
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride) {
+  for (int y = 0; y < height / 2; y++) {
+    const uint8_t* r0 = src + (2 * y) * srcStride;
+    const uint8_t* r1 = r0 + srcStride;
+    uint8_t* out = dst + y * dstStride;
+    for (int x = 0; x < width / 2; x++, r0 += 8, r1 += 8, out += 4) {
+      for (int c = 0; c < 4; c++) {
+        out[c] = static_cast<uint8_t>((r0[c] + r0[c + 4] + r1[c] + r1[c + 4] + 2) >> 2);
+      }
+    }
+  }
+}
+
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride) {
+  for (int y = 0; y < height / 4; y++) {
+    const uint8_t* block = src + (4 * y) * srcStride;
+    uint8_t* out = dst + y * dstStride;
+    for (int x = 0; x < width / 4; x++, block += 16, out += 4) {
+      for (int c = 0; c < 4; c++) {
+        unsigned sum = 0;
+        for (int row = 0; row < 4; row++) {
+          const uint8_t* p = block + row * srcStride + c;
+          sum += p[0] + p[4] + p[8] + p[12];
+        }
+        out[c] = static_cast<uint8_t>((sum + 8) >> 4);
+      }
+    }
+  }
+}
+
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height) {
+  uint64_t acc[2] = {kHashSeed0, kHashSeed1};
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      HashAccumulate(acc, row + x * 4);
+    }
+    HashTail(acc, row + x * 4, width - x);
+    HashScrambleRow(acc);
+  }
+  return HashFinish(acc, width, height);
+}
+
+}  // namespace scalar
+
+#if defined(PIXEL_KERNELS_SSE2)
+
+const char* Implementation() {
+  return "sse2";
+}
+
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height) {
+  const __m128i rbMask = _mm_set1_epi32(0x00FF00FF);
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128i* p = reinterpret_cast<__m128i*>(row + x * 4);
+      __m128i v = _mm_loadu_si128(p);
+      __m128i rb = _mm_and_si128(v, rbMask);
+      __m128i ga = _mm_andnot_si128(rbMask, v);
+      __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+      _mm_storeu_si128(p, _mm_or_si128(ga, br));
+    }
+    scalar::SwapRedBlue(row + x * 4, stride, width - x, 1);
+  }
+}
+
+namespace {
+
+// Premultiplies the two pixels in |v| (8 x 16-bit lanes).
+inline __m128i PremultiplyPixels16(__m128i v) {
+  const __m128i colorMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  const __m128i alphaOne = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+  __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)),
+                                      _MM_SHUFFLE(3, 3, 3, 3));
+  // Alpha itself is multiplied by 255 / 255 and so stays unchanged.
+  alpha = _mm_or_si128(_mm_and_si128(alpha, colorMask), alphaOne);
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(v, alpha), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Unpremultiplies one pixel held as four floats; the alpha lane is fixed up
+// by the caller.
+inline __m128 UnpremultiplyPixel(__m128 p) {
+  __m128 alpha = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128 scale = _mm_div_ps(_mm_set1_ps(255.0f), alpha);
+  __m128 value = _mm_add_ps(_mm_mul_ps(p, scale), _mm_set1_ps(0.5f));
+  return _mm_min_ps(value, _mm_set1_ps(255.0f));
+}
+
+inline void HashAccumulateSse2(__m128i& acc, const uint8_t* data) {
+  const __m128i key = _mm_set_epi64x(static_cast<long long>(kHashKey1),
+                                     static_cast<long long>(kHashKey0));
+  __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  __m128i dk = _mm_xor_si128(d, key);
+  __m128i dkHigh = _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1));
+  __m128i product = _mm_mul_epu32(dk, dkHigh);
+  __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+  acc = _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+}
+
+}  // namespace
+
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128i* p = reinterpret_cast<__m128i*>(row + x * 4);
+      __m128i v = _mm_loadu_si128(p);
+      __m128i lo = PremultiplyPixels16(_mm_unpacklo_epi8(v, zero));
+      __m128i hi = PremultiplyPixels16(_mm_unpackhi_epi8(v, zero));
+      _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+    scalar::Premultiply(row + x * 4, stride, width - x, 1);
+  }
+}
+
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      __m128i* p = reinterpret_cast<__m128i*>(row + x * 4);
+      __m128i v = _mm_loadu_si128(p);
+      __m128i lo16 = _mm_unpacklo_epi8(v, zero);
+      __m128i hi16 = _mm_unpackhi_epi8(v, zero);
+      __m128i p0 = _mm_cvttps_epi32(
+          UnpremultiplyPixel(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo16, zero))));
+      __m128i p1 = _mm_cvttps_epi32(
+          UnpremultiplyPixel(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo16, zero))));
+      __m128i p2 = _mm_cvttps_epi32(
+          UnpremultiplyPixel(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi16, zero))));
+      __m128i p3 = _mm_cvttps_epi32(
+          UnpremultiplyPixel(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi16, zero))));
+      __m128i result =
+          _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+
+      // Keep alpha as is, and zero the color of transparent pixels (whose
+      // float result is NaN).
+      __m128i alpha = _mm_and_si128(v, alphaMask);
+      __m128i transparent = _mm_cmpeq_epi32(alpha, zero);
+      result = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(alphaMask, transparent), result),
+                            alpha);
+      _mm_storeu_si128(p, result);
+    }
+    scalar::Unpremultiply(row + x * 4, stride, width - x, 1);
+  }
+}
+
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  int outWidth = width / 2;
+  for (int y = 0; y < height / 2; y++) {
+    const uint8_t* r0 = src + (2 * y) * srcStride;
+    const uint8_t* r1 = r0 + srcStride;
+    uint8_t* out = dst + y * dstStride;
+    int x = 0;
+    for (; x + 2 <= outWidth; x += 2) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + x * 8));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + x * 8));
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+      hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+      __m128i sum = _mm_unpacklo_epi64(lo, hi);
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, zero));
+    }
+    if (x < outWidth) {
+      scalar::DownscaleHalf(r0 + x * 8, srcStride, 2, 2, out + x * 4, dstStride);
+    }
+  }
+}
+
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i eight = _mm_set1_epi16(8);
+  for (int y = 0; y < height / 4; y++) {
+    const uint8_t* block = src + (4 * y) * srcStride;
+    uint8_t* out = dst + y * dstStride;
+    for (int x = 0; x < width / 4; x++, block += 16, out += 4) {
+      __m128i sum = zero;
+      for (int row = 0; row < 4; row++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + row * srcStride));
+        sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(v, zero));
+        sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(v, zero));
+      }
+      sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, eight), 4);
+      int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+      memcpy(out, &pixel, 4);
+    }
+  }
+}
+
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height) {
+  uint64_t acc[2] = {kHashSeed0, kHashSeed1};
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + y * stride;
+    __m128i accVec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      HashAccumulateSse2(accVec, row + x * 4);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(acc), accVec);
+    HashTail(acc, row + x * 4, width - x);
+    HashScrambleRow(acc);
+  }
+  return HashFinish(acc, width, height);
+}
+
+#elif defined(PIXEL_KERNELS_NEON)
+
+// Kernels without a NEON version below use the scalar code.
+const char* Implementation() {
+  return "neon";
+}
+
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      uint8x16x4_t v = vld4q_u8(row + x * 4);
+      uint8x16_t b = v.val[0];
+      v.val[0] = v.val[2];
+      v.val[2] = b;
+      vst4q_u8(row + x * 4, v);
+    }
+    scalar::SwapRedBlue(row + x * 4, stride, width - x, 1);
+  }
+}
+
+namespace {
+
+inline uint8x8_t MulDiv255Neon(uint8x8_t c, uint8x8_t a) {
+  uint16x8_t x = vaddq_u16(vmull_u8(c, a), vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8);
+}
+
+inline uint8x16_t MulDiv255Neon(uint8x16_t c, uint8x16_t a) {
+  return vcombine_u8(MulDiv255Neon(vget_low_u8(c), vget_low_u8(a)),
+                     MulDiv255Neon(vget_high_u8(c), vget_high_u8(a)));
+}
+
+}  // namespace
+
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = pixels + y * stride;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      uint8x16x4_t v = vld4q_u8(row + x * 4);
+      v.val[0] = MulDiv255Neon(v.val[0], v.val[3]);
+      v.val[1] = MulDiv255Neon(v.val[1], v.val[3]);
+      v.val[2] = MulDiv255Neon(v.val[2], v.val[3]);
+      vst4q_u8(row + x * 4, v);
+    }
+    scalar::Premultiply(row + x * 4, stride, width - x, 1);
+  }
+}
+
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  scalar::Unpremultiply(pixels, stride, width, height);
+}
+
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride) {
+  scalar::DownscaleHalf(src, srcStride, width, height, dst, dstStride);
+}
+
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride) {
+  scalar::DownscaleQuarter(src, srcStride, width, height, dst, dstStride);
+}
+
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height) {
+  return scalar::HashRect(pixels, stride, width, height);
+}
+
+#else
+
+const char* Implementation() {
+  return "scalar";
+}
+
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height) {
+  scalar::SwapRedBlue(pixels, stride, width, height);
+}
+
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  scalar::Premultiply(pixels, stride, width, height);
+}
+
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height) {
+  scalar::Unpremultiply(pixels, stride, width, height);
+}
+
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride) {
+  scalar::DownscaleHalf(src, srcStride, width, height, dst, dstStride);
+}
+
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride) {
+  scalar::DownscaleQuarter(src, srcStride, width, height, dst, dstStride);
+}
+
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height) {
+  return scalar::HashRect(pixels, stride, width, height);
+}
+
+#endif
+
+}  // namespace pixel_kernels
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pixel kernels for 32-bit software frames (BGRA as delivered by OnPaint).
+//
+// Every kernel works on a sub-rectangle given by a pointer to its first
+// pixel, the row stride in bytes and its size in pixels, so it can be run
+// on just the dirty part of a frame. The vectorized versions (SSE2 on x86,
+// NEON on ARM) produce exactly the same output as the scalar ones, which
+// stay available under pixel_kernels::scalar for comparison.
+namespace pixel_kernels {
+
+// Name of the implementation selected at compile time: "sse2", "neon" or
+// "scalar".
+const char* Implementation();
+
+// Swaps the R and B channels in place (BGRA <-> RGBA).
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height);
+
+// Multiplies the color channels by alpha in place, rounding to nearest.
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height);
+
+// Divides the color channels by alpha in place; fully transparent pixels
+// become zero.
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height);
+
+// Box-filters |src| (width x height) down by 2 or 4 in both directions into
+// |dst|, rounding to nearest. Trailing rows and columns that do not fill a
+// whole block are ignored.
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride);
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride);
+
+// 64-bit content hash of a rectangle, for detecting unchanged tiles.
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height);
+
+namespace scalar {
+void SwapRedBlue(uint8_t* pixels, size_t stride, int width, int height);
+void Premultiply(uint8_t* pixels, size_t stride, int width, int height);
+void Unpremultiply(uint8_t* pixels, size_t stride, int width, int height);
+void DownscaleHalf(const uint8_t* src, size_t srcStride, int width, int height,
+                   uint8_t* dst, size_t dstStride);
+void DownscaleQuarter(const uint8_t* src, size_t srcStride, int width, int height,
+                      uint8_t* dst, size_t dstStride);
+uint64_t HashRect(const uint8_t* pixels, size_t stride, int width, int height);
+}  // namespace scalar
+
+}  // namespace pixel_kernels
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "include/cef_values.h"
+#include "cef_value_json.hpp"
+#include "guid_ext.hpp"
+#include "rpc.hpp"
+
+// Typed arguments of the process messages exchanged between the browser
+// and renderer processes. Messages travel as CefListValue/CefDictionaryValue
+// so that nothing is serialized to JSON text until it reaches the socket.
+namespace process_messages {
+
+// Browser -> renderer: evaluate a script in the main frame.
+//   [0] id (string), [1] browserId (int), [2] code (string),
+//   [3] scriptUrl (string), [4] startLine (int), [5] timeoutMs (int)
+const char kEval[] = "Eval";
+// Renderer -> browser: the result of an Eval.
+//   [0] id (string), [1] browserId (int), [2] success (bool),
+//   [3] result (any value; null unless success),
+//   [4] error (dictionary) or null
+const char kOnEval[] = "RenderProcessHandler.OnEval";
+// Browser -> renderer: sample memory use for the memory governor.
+const char kMemoryUsage[] = "MemoryUsage";
+// Renderer -> browser:
+//   [0] renderer process id (int), [1] its private bytes (double),
+//   [2] scrollX (int), [3] scrollY (int)
+const char kOnMemoryUsage[] = "RenderProcessHandler.OnMemoryUsage";
+// Browser -> renderer: evaluate scripts in order in the main frame.
+//   [0] id (string), [1] browserId (int), [2] stopOnError (bool),
+//   [3] scripts (list of [code (string), scriptUrl (string), startLine (int)])
+const char kEvalBatch[] = "EvalBatch";
+// Renderer -> browser: one entry per script that ran.
+//   [0] id (string), [1] browserId (int),
+//   [2] results (list of dictionaries with "success" (bool), "result"
+//       (any value) and "error" (dictionary))
+const char kOnEvalBatch[] = "RenderProcessHandler.OnEvalBatch";
+// Browser -> renderer: compile a function in the main frame's context.
+//   [0] id (string), [1] browserId (int), [2] source (string)
+const char kRegisterFunction[] = "RegisterFunction";
+// Renderer -> browser:
+//   [0] id (string), [1] browserId (int), [2] success (bool),
+//   [3] handle (int) or null, [4] error (string) or null
+const char kOnRegisterFunction[] = "RenderProcessHandler.OnRegisterFunction";
+// Browser -> renderer: call a registered function.
+//   [0] id (string), [1] browserId (int), [2] handle (int),
+//   [3] arguments (list)
+const char kInvokeFunction[] = "InvokeFunction";
+// Renderer -> browser:
+//   [0] id (string), [1] browserId (int), [2] success (bool),
+//   [3] result (any value), [4] error (string) or null
+const char kOnInvokeFunction[] = "RenderProcessHandler.OnInvokeFunction";
+
+// The outcome of one script in the renderer: a value or an error.
+struct ScriptResult {
+  bool success = false;
+  CefRefPtr<CefValue> value;
+  std::optional<EvalJavaScriptError> error;
+};
+
+// The renderer's view of an InvokeFunction message; the arguments stay
+// CefValues until they are turned into V8 values.
+struct FunctionCall {
+  UUID id;
+  int browserId;
+  int handle;
+  CefRefPtr<CefListValue> arguments;
+};
+
+// The renderer's answer to an InvokeFunction message.
+struct FunctionResult {
+  UUID id;
+  int browserId;
+  bool success;
+  CefRefPtr<CefValue> result;
+  std::optional<std::string> error;
+};
+
+inline CefRefPtr<CefDictionaryValue> WriteEvalError(const EvalJavaScriptError& error) {
+  CefRefPtr<CefDictionaryValue> dict = CefDictionaryValue::Create();
+  dict->SetInt("endColumn", error.endColumn);
+  dict->SetInt("endPosition", error.endPosition);
+  dict->SetInt("lineNumber", error.lineNumber);
+  dict->SetString("message", error.message);
+  dict->SetString("scriptResourceName", error.scriptResourceName);
+  dict->SetString("sourceLine", error.sourceLine);
+  dict->SetInt("startColumn", error.startColumn);
+  dict->SetInt("startPosition", error.startPosition);
+  return dict;
+}
+
+inline EvalJavaScriptError ReadEvalError(CefRefPtr<CefDictionaryValue> dict) {
+  EvalJavaScriptError error;
+  error.endColumn = dict->GetInt("endColumn");
+  error.endPosition = dict->GetInt("endPosition");
+  error.lineNumber = dict->GetInt("lineNumber");
+  error.message = dict->GetString("message").ToString();
+  error.scriptResourceName = dict->GetString("scriptResourceName").ToString();
+  error.sourceLine = dict->GetString("sourceLine").ToString();
+  error.startColumn = dict->GetInt("startColumn");
+  error.startPosition = dict->GetInt("startPosition");
+  return error;
+}
+
+inline void WriteEvalRequest(CefRefPtr<CefListValue> args,
+                             const EvalJavaScriptRequest& request) {
+  args->SetString(0, UuidToString(request.id));
+  args->SetInt(1, request.browserId);
+  args->SetString(2, request.code);
+  args->SetString(3, request.scriptUrl);
+  args->SetInt(4, request.startLine);
+  args->SetInt(5, request.timeoutMs);
+}
+
+inline std::optional<EvalJavaScriptRequest> ReadEvalRequest(CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 6 || args->GetType(0) != VTYPE_STRING) {
+    return std::nullopt;
+  }
+  EvalJavaScriptRequest request;
+  if (!UuidFromString(args->GetString(0).ToString(), request.id)) {
+    return std::nullopt;
+  }
+  request.browserId = args->GetInt(1);
+  request.code = args->GetString(2).ToString();
+  request.scriptUrl = args->GetString(3).ToString();
+  request.startLine = args->GetInt(4);
+  request.timeoutMs = args->GetInt(5);
+  return request;
+}
+
+inline void WriteEvalResponse(CefRefPtr<CefListValue> args,
+                              const UUID& id,
+                              int browserId,
+                              const ScriptResult& result) {
+  args->SetString(0, UuidToString(id));
+  args->SetInt(1, browserId);
+  args->SetBool(2, result.success);
+  if (result.value) {
+    args->SetValue(3, result.value);
+  } else {
+    args->SetNull(3);
+  }
+  if (result.error.has_value()) {
+    args->SetDictionary(4, WriteEvalError(result.error.value()));
+  } else {
+    args->SetNull(4);
+  }
+}
+
+inline std::optional<EvalJavaScriptResponse> ReadEvalResponse(CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 5 || args->GetType(0) != VTYPE_STRING) {
+    return std::nullopt;
+  }
+  EvalJavaScriptResponse response;
+  if (!UuidFromString(args->GetString(0).ToString(), response.id)) {
+    return std::nullopt;
+  }
+  response.browserId = args->GetInt(1);
+  response.success = args->GetBool(2);
+  if (response.success) {
+    response.result = CefValueToJson(args->GetValue(3));
+  }
+  if (args->GetType(4) == VTYPE_DICTIONARY) {
+    response.error = ReadEvalError(args->GetDictionary(4));
+  }
+  return response;
+}
+
+inline void WriteEvalBatchRequest(CefRefPtr<CefListValue> args,
+                                  const EvalBatchRequest& request) {
+  args->SetString(0, UuidToString(request.id));
+  args->SetInt(1, request.browserId);
+  args->SetBool(2, request.stopOnError);
+  CefRefPtr<CefListValue> scripts = CefListValue::Create();
+  scripts->SetSize(request.scripts.size());
+  for (size_t i = 0; i < request.scripts.size(); i++) {
+    CefRefPtr<CefListValue> script = CefListValue::Create();
+    script->SetString(0, request.scripts[i].code);
+    script->SetString(1, request.scripts[i].scriptUrl);
+    script->SetInt(2, request.scripts[i].startLine);
+    scripts->SetList(i, script);
+  }
+  args->SetList(3, scripts);
+}
+
+inline std::optional<EvalBatchRequest> ReadEvalBatchRequest(CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 4 || args->GetType(0) != VTYPE_STRING ||
+      args->GetType(3) != VTYPE_LIST) {
+    return std::nullopt;
+  }
+  EvalBatchRequest request;
+  if (!UuidFromString(args->GetString(0).ToString(), request.id)) {
+    return std::nullopt;
+  }
+  request.browserId = args->GetInt(1);
+  request.stopOnError = args->GetBool(2);
+  CefRefPtr<CefListValue> scripts = args->GetList(3);
+  request.scripts.resize(scripts->GetSize());
+  for (size_t i = 0; i < scripts->GetSize(); i++) {
+    CefRefPtr<CefListValue> script = scripts->GetList(i);
+    if (!script || script->GetSize() < 3) {
+      return std::nullopt;
+    }
+    request.scripts[i].code = script->GetString(0).ToString();
+    request.scripts[i].scriptUrl = script->GetString(1).ToString();
+    request.scripts[i].startLine = script->GetInt(2);
+  }
+  return request;
+}
+
+inline void WriteEvalBatchResponse(CefRefPtr<CefListValue> args,
+                                   const UUID& id,
+                                   int browserId,
+                                   const std::vector<ScriptResult>& scriptResults) {
+  args->SetString(0, UuidToString(id));
+  args->SetInt(1, browserId);
+  CefRefPtr<CefListValue> results = CefListValue::Create();
+  results->SetSize(scriptResults.size());
+  for (size_t i = 0; i < scriptResults.size(); i++) {
+    const ScriptResult& result = scriptResults[i];
+    CefRefPtr<CefDictionaryValue> dict = CefDictionaryValue::Create();
+    dict->SetBool("success", result.success);
+    if (result.value) {
+      dict->SetValue("result", result.value);
+    }
+    if (result.error.has_value()) {
+      dict->SetDictionary("error", WriteEvalError(result.error.value()));
+    }
+    results->SetDictionary(i, dict);
+  }
+  args->SetList(2, results);
+}
+
+inline std::optional<EvalBatchResponse> ReadEvalBatchResponse(CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 3 || args->GetType(0) != VTYPE_STRING ||
+      args->GetType(2) != VTYPE_LIST) {
+    return std::nullopt;
+  }
+  EvalBatchResponse response;
+  if (!UuidFromString(args->GetString(0).ToString(), response.id)) {
+    return std::nullopt;
+  }
+  response.browserId = args->GetInt(1);
+  CefRefPtr<CefListValue> results = args->GetList(2);
+  response.results.resize(results->GetSize());
+  for (size_t i = 0; i < results->GetSize(); i++) {
+    CefRefPtr<CefDictionaryValue> dict = results->GetDictionary(i);
+    if (!dict) {
+      return std::nullopt;
+    }
+    EvalBatchResult& result = response.results[i];
+    result.success = dict->GetBool("success");
+    if (result.success) {
+      result.result = CefValueToJson(dict->GetValue("result"));
+    }
+    if (dict->GetType("error") == VTYPE_DICTIONARY) {
+      result.error = ReadEvalError(dict->GetDictionary("error"));
+    }
+  }
+  return response;
+}
+
+inline void WriteRegisterFunctionRequest(CefRefPtr<CefListValue> args,
+                                        const RegisterFunctionRequest& request) {
+  args->SetString(0, UuidToString(request.id));
+  args->SetInt(1, request.browserId);
+  args->SetString(2, request.source);
+}
+
+inline std::optional<RegisterFunctionRequest> ReadRegisterFunctionRequest(
+    CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 3 || args->GetType(0) != VTYPE_STRING) {
+    return std::nullopt;
+  }
+  RegisterFunctionRequest request;
+  if (!UuidFromString(args->GetString(0).ToString(), request.id)) {
+    return std::nullopt;
+  }
+  request.browserId = args->GetInt(1);
+  request.source = args->GetString(2).ToString();
+  return request;
+}
+
+inline void WriteRegisterFunctionResponse(CefRefPtr<CefListValue> args,
+                                          const RegisterFunctionResponse& response) {
+  args->SetString(0, UuidToString(response.id));
+  args->SetInt(1, response.browserId);
+  args->SetBool(2, response.success);
+  if (response.handle.has_value()) {
+    args->SetInt(3, response.handle.value());
+  } else {
+    args->SetNull(3);
+  }
+  if (response.error.has_value()) {
+    args->SetString(4, response.error.value());
+  } else {
+    args->SetNull(4);
+  }
+}
+
+inline std::optional<RegisterFunctionResponse> ReadRegisterFunctionResponse(
+    CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 5 || args->GetType(0) != VTYPE_STRING) {
+    return std::nullopt;
+  }
+  RegisterFunctionResponse response;
+  if (!UuidFromString(args->GetString(0).ToString(), response.id)) {
+    return std::nullopt;
+  }
+  response.browserId = args->GetInt(1);
+  response.success = args->GetBool(2);
+  if (args->GetType(3) == VTYPE_INT) {
+    response.handle = args->GetInt(3);
+  }
+  if (args->GetType(4) == VTYPE_STRING) {
+    response.error = args->GetString(4).ToString();
+  }
+  return response;
+}
+
+inline void WriteInvokeFunctionRequest(CefRefPtr<CefListValue> args,
+                                       const InvokeFunctionRequest& request) {
+  args->SetString(0, UuidToString(request.id));
+  args->SetInt(1, request.browserId);
+  args->SetInt(2, request.handle);
+  args->SetList(3, JsonToCefList(request.arguments));
+}
+
+inline std::optional<FunctionCall> ReadInvokeFunctionRequest(CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 4 || args->GetType(0) != VTYPE_STRING ||
+      args->GetType(3) != VTYPE_LIST) {
+    return std::nullopt;
+  }
+  FunctionCall call;
+  if (!UuidFromString(args->GetString(0).ToString(), call.id)) {
+    return std::nullopt;
+  }
+  call.browserId = args->GetInt(1);
+  call.handle = args->GetInt(2);
+  call.arguments = args->GetList(3);
+  return call;
+}
+
+inline void WriteInvokeFunctionResponse(CefRefPtr<CefListValue> args,
+                                        const FunctionResult& result) {
+  args->SetString(0, UuidToString(result.id));
+  args->SetInt(1, result.browserId);
+  args->SetBool(2, result.success);
+  if (result.result) {
+    args->SetValue(3, result.result);
+  } else {
+    args->SetNull(3);
+  }
+  if (result.error.has_value()) {
+    args->SetString(4, result.error.value());
+  } else {
+    args->SetNull(4);
+  }
+}
+
+inline std::optional<InvokeFunctionResponse> ReadInvokeFunctionResponse(
+    CefRefPtr<CefListValue> args) {
+  if (args->GetSize() < 5 || args->GetType(0) != VTYPE_STRING) {
+    return std::nullopt;
+  }
+  InvokeFunctionResponse response;
+  if (!UuidFromString(args->GetString(0).ToString(), response.id)) {
+    return std::nullopt;
+  }
+  response.browserId = args->GetInt(1);
+  response.success = args->GetBool(2);
+  response.result = CefValueToJson(args->GetValue(3));
+  if (args->GetType(4) == VTYPE_STRING) {
+    response.error = args->GetString(4).ToString();
+  }
+  return response;
+}
+
+}  // namespace process_messages
@@ -6,13 +6,22 @@
 
 #include "render_process_handler.h"
 
+#include "include/base/cef_callback.h"
 #include "include/base/cef_logging.h"
+#include "include/cef_task.h"
+#include "include/wrapper/cef_closure_task.h"
 #include "json.hpp"
+#include <algorithm>
 #include <map>
 #include <rpc.h>
 #include <string>
+#include <vector>
+#include "cef_value_v8.hpp"
+#include "process_messages.hpp"
 #include "rpc.hpp"
 #include <SDL3/sdl.h>
+#include <windows.h>
+#include <psapi.h>
 
 using json = nlohmann::json;
 
@@ -21,7 +30,6 @@ const char kOnFocusOutMessage[] = "RenderProcessHandler.OnFocusOut";
 const char kOnMouseOverMessage[] = "RenderProcessHandler.OnMouseOver";
 const char kOnNavigateMessage[] = "RenderProcessHandler.OnNavigate";
 const char kOnMessageMessage[] = "RenderProcessHandler.OnMessage";
-const char kOnEvalMessage[] = "RenderProcessHandler.OnEval";
 
 RenderProcessHandler::RenderProcessHandler() {}
 
@@ -233,6 +241,13 @@ void RenderProcessHandler::OnContextCreated(CefRefPtr<CefBrowser> browser,
                                          CefRefPtr<CefFrame> frame,
                                          CefRefPtr<CefV8Context> context) {
   CefRefPtr<CefV8Value> window = context->GetGlobal();
+
+  // Captured before any page script runs, so a page cannot replace it.
+  CefRefPtr<CefV8Value> arrayBuffer = window->GetValue("ArrayBuffer");
+  CefRefPtr<CefV8Value> isView = arrayBuffer ? arrayBuffer->GetValue("isView") : nullptr;
+  if (isView && isView->IsFunction()) {
+    context_builtins_.push_back({context, isView});
+  }
   
   // mouse over
   CefRefPtr<CefV8Handler> mouseOverHandler = new MouseOverHandler();
@@ -270,9 +285,45 @@ void RenderProcessHandler::OnContextCreated(CefRefPtr<CefBrowser> browser,
       ->ExecuteFunction(window, messageArguments);
 }
 
+CefRefPtr<CefV8Value> RenderProcessHandler::ArrayBufferIsView(
+    CefRefPtr<CefV8Context> context) {
+  for (const ContextBuiltins& builtins : context_builtins_) {
+    if (builtins.context->IsSame(context)) {
+      return builtins.arrayBufferIsView;
+    }
+  }
+  return nullptr;
+}
+
 void RenderProcessHandler::OnContextReleased(CefRefPtr<CefBrowser> browser,
                                           CefRefPtr<CefFrame> frame,
                                           CefRefPtr<CefV8Context> context) {
+  std::vector<std::string> cancelled;
+  for (const auto& it : pending_evals_) {
+    if (it.second.context->IsSame(context)) {
+      cancelled.push_back(it.first);
+    }
+  }
+  for (const std::string& evalId : cancelled) {
+    process_messages::ScriptResult result;
+    result.error = EvalJavaScriptError{};
+    result.error->message = "page unloaded before the promise settled";
+    result.error->scriptResourceName = pending_evals_[evalId].scriptUrl;
+    FinishEval(evalId, result);
+  }
+  context_builtins_.erase(
+      std::remove_if(context_builtins_.begin(), context_builtins_.end(),
+                     [&context](const ContextBuiltins& builtins) {
+                       return builtins.context->IsSame(context);
+                     }),
+      context_builtins_.end());
+  for (auto it = registered_functions_.begin(); it != registered_functions_.end();) {
+    if (it->second.context->IsSame(context)) {
+      it = registered_functions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 void RenderProcessHandler::OnUncaughtException(
@@ -299,46 +350,70 @@ void RenderProcessHandler::OnFocusedNodeChanged(CefRefPtr<CefBrowser> browser,
   }
 }
 
-// Custom handler for our promise "then" callback
+static EvalJavaScriptError ToEvalJavaScriptError(CefRefPtr<CefV8Exception> exception) {
+  EvalJavaScriptError error;
+  error.endColumn = exception->GetEndColumn();
+  error.endPosition = exception->GetEndPosition();
+  error.lineNumber = exception->GetLineNumber();
+  error.message = exception->GetMessage().ToString();
+  error.scriptResourceName = exception->GetScriptResourceName().ToString();
+  error.sourceLine = exception->GetSourceLine().ToString();
+  error.startColumn = exception->GetStartColumn();
+  error.startPosition = exception->GetStartPosition();
+  return error;
+}
+
+// A rejected promise has a reason rather than a V8 exception. Errors are
+// described the way String(error) would; other reasons by their value.
+static EvalJavaScriptError ToEvalJavaScriptError(CefRefPtr<CefV8Value> reason,
+                                                 const std::string& scriptUrl,
+                                                 CefRefPtr<CefV8Value> isView) {
+  EvalJavaScriptError error = {};
+  error.scriptResourceName = scriptUrl;
+  if (reason && reason->IsString()) {
+    error.message = reason->GetStringValue().ToString();
+  } else if (reason && reason->IsObject() && reason->HasValue("message")) {
+    CefRefPtr<CefV8Value> name = reason->GetValue("name");
+    error.message = reason->GetValue("message")->GetStringValue().ToString();
+    if (name && name->IsString()) {
+      error.message = name->GetStringValue().ToString() + ": " + error.message;
+    }
+  } else {
+    error.message = CefValueToJson(V8ToCefValue(reason, isView))
+                        .dump(-1, ' ', false, json::error_handler_t::replace);
+  }
+  return error;
+}
+
+// Both "then" callbacks of a promise returned by an eval. |sequence| is
+// that of the pending eval, so a promise that settles after its eval timed
+// out cannot answer a later eval reusing the id.
 class PromiseThenHandler : public CefV8Handler {
  public:
-  explicit PromiseThenHandler(CefRefPtr<CefFrame> frame, CefProcessId sourceProcessId, const UUID messageId)
-      : frame(frame), sourceProcessId(sourceProcessId), messageId(messageId) {}
+  PromiseThenHandler(CefRefPtr<RenderProcessHandler> renderProcessHandler,
+                     const std::string& evalId,
+                     uint64_t sequence)
+      : renderProcessHandler(renderProcessHandler), evalId(evalId), sequence(sequence) {}
 
   bool Execute(const CefString& name,
                CefRefPtr<CefV8Value> object,
                const CefV8ValueList& arguments,
                CefRefPtr<CefV8Value>& retval,
                CefString& exception) override {
-    if (name != "onPromiseResolved" || arguments.size() == 0) {
+    if (name != "onPromiseResolved" && name != "onPromiseRejected") {
       return false;
     }
-    CefRefPtr<CefV8Context> context = frame->GetV8Context();
-    CefRefPtr<CefV8Value> window = context->GetGlobal();
-    CefRefPtr<CefV8Value> json = window->GetValue("JSON");
-    CefRefPtr<CefV8Value> stringifyFunction = json->GetValue("stringify");
-    CefV8ValueList stringifyArguments;
-    stringifyArguments.push_back(arguments[0]);
-    const CefString& result =
-        stringifyFunction->ExecuteFunction(json, stringifyArguments)
-            ->GetStringValue();
-    CefRefPtr<CefProcessMessage> responseMessage =
-        CefProcessMessage::Create(kOnEvalMessage);
-    CefRefPtr<CefDictionaryValue> messageArguments =
-        CefDictionaryValue::Create();
-    EvalJavaScriptResponse evalResponse;
-    evalResponse.id = messageId;
-    evalResponse.result = result.ToString();
-    responseMessage->GetArgumentList()->SetDictionary(0, messageArguments);
-    frame->SendProcessMessage(sourceProcessId, responseMessage);
-    retval = arguments[0];
+    CefRefPtr<CefV8Value> value =
+        arguments.empty() ? CefV8Value::CreateUndefined() : arguments[0];
+    renderProcessHandler->OnPromiseSettled(evalId, sequence, name == "onPromiseResolved",
+                                           value);
     return true;
   }
 
  private:
-  CefRefPtr<CefFrame> frame;
-  CefProcessId sourceProcessId;
-  const UUID messageId;
+  CefRefPtr<RenderProcessHandler> renderProcessHandler;
+  const std::string evalId;
+  const uint64_t sequence;
   IMPLEMENT_REFCOUNTING(PromiseThenHandler);
 };
 
@@ -353,57 +428,263 @@ bool RenderProcessHandler::OnProcessMessageReceived(
   const CefString& name = message->GetName();
   SDL_Log("RenderProcessHandler received message: %s", name.ToString().c_str());
   bool handled = false;
-  if (name == "Eval") {
-    SDL_Log("RenderProcessHandler received CefEvalRequest");
-    const CefString& payload = message->GetArgumentList()->GetString(0);
-    EvalJavaScriptRequest evalRequest = json::parse(payload.ToString()).get<EvalJavaScriptRequest>();
+  if (name == process_messages::kEval) {
+    std::optional<EvalJavaScriptRequest> evalRequest =
+        process_messages::ReadEvalRequest(message->GetArgumentList());
+    if (!evalRequest.has_value()) {
+      SDL_Log("RenderProcessHandler: malformed %s message", process_messages::kEval);
+      context->Exit();
+      return true;
+    }
     CefRefPtr<CefV8Value> retval;
     CefRefPtr<CefV8Exception> exception;
     bool success =
-        context->Eval(CefString(evalRequest.code), CefString(evalRequest.scriptUrl), evalRequest.startLine, retval, exception);
-    if (success && retval->IsPromise()) {
+        context->Eval(CefString(evalRequest->code), CefString(evalRequest->scriptUrl), evalRequest->startLine, retval, exception);
+    std::string evalId = UuidToString(evalRequest->id);
+    if (success && retval->IsPromise() && pending_evals_.count(evalId) == 0) {
+      uint64_t sequence = next_eval_sequence_++;
+      pending_evals_[evalId] = {evalRequest->id,
+                                frame->GetBrowser()->GetIdentifier(),
+                                frame->GetBrowser(),
+                                context,
+                                source_process,
+                                evalRequest->scriptUrl,
+                                sequence};
+      CefRefPtr<PromiseThenHandler> handler = new PromiseThenHandler(this, evalId, sequence);
       CefRefPtr<CefV8Value> thenFunction = retval->GetValue("then");
-      CefRefPtr<PromiseThenHandler> handler =
-          new PromiseThenHandler(frame, source_process, evalRequest.id);
-      CefRefPtr<CefV8Value> onResolvedFunc =
-          CefV8Value::CreateFunction("onPromiseResolved", handler);
-      thenFunction->ExecuteFunction(retval, {onResolvedFunc});
+      thenFunction->ExecuteFunction(
+          retval, {CefV8Value::CreateFunction("onPromiseResolved", handler),
+                   CefV8Value::CreateFunction("onPromiseRejected", handler)});
+      if (evalRequest->timeoutMs > 0) {
+        CefPostDelayedTask(TID_RENDERER,
+                           base::BindOnce(&RenderProcessHandler::OnEvalTimeout,
+                                          CefRefPtr<RenderProcessHandler>(this), evalId,
+                                          sequence, evalRequest->timeoutMs),
+                           evalRequest->timeoutMs);
+      }
      } else {
-      EvalJavaScriptResponse evalResponse;
-      evalResponse.id = evalRequest.id;
-      evalResponse.browserId = frame->GetBrowser()->GetIdentifier();
-      evalResponse.success = success;
-      if (success) {
-        CefRefPtr<CefV8Value> window = context->GetGlobal();
-        CefRefPtr<CefV8Value> jsonObj = window->GetValue("JSON");
-        CefRefPtr<CefV8Value> stringifyFunction = jsonObj->GetValue("stringify");
-        CefV8ValueList stringifyArguments;
-        stringifyArguments.push_back(retval);
-        const CefString& result =
-            stringifyFunction->ExecuteFunction(jsonObj, stringifyArguments)
-                ->GetStringValue();
-        evalResponse.result = result.ToString();
+      process_messages::ScriptResult result;
+      result.success = success && !retval->IsPromise();
+      if (result.success) {
+        result.value = V8ToCefValue(retval, ArrayBufferIsView(context));
+      } else if (success) {
+        // The first eval with this id still owns its pending entry.
+        result.error = EvalJavaScriptError{};
+        result.error->message = "an eval with id " + evalId + " is already in flight";
+        result.error->scriptResourceName = evalRequest->scriptUrl;
       } else {
-        EvalJavaScriptError error;
-        error.endColumn = exception->GetEndColumn();
-        error.endPosition = exception->GetEndPosition();
-        error.lineNumber = exception->GetLineNumber();
-        error.message = exception->GetMessage().ToString();
-        error.scriptResourceName =
-            exception->GetScriptResourceName().ToString();
-        error.sourceLine = exception->GetSourceLine().ToString();
-        error.startColumn = exception->GetStartColumn();
-        error.startPosition = exception->GetStartPosition();
-        evalResponse.error = error;
+        result.error = ToEvalJavaScriptError(exception);
       }
       CefRefPtr<CefProcessMessage> responseMessage =
-          CefProcessMessage::Create(kOnEvalMessage);
-      json j = evalResponse;
-      responseMessage->GetArgumentList()->SetString(0, j.dump());
+          CefProcessMessage::Create(process_messages::kOnEval);
+      process_messages::WriteEvalResponse(responseMessage->GetArgumentList(), evalRequest->id,
+                                          frame->GetBrowser()->GetIdentifier(), result);
       frame->SendProcessMessage(source_process, responseMessage);
      }
      handled = true;
+  } else if (name == process_messages::kEvalBatch) {
+    EvalBatch(frame, context, source_process, message->GetArgumentList());
+    handled = true;
+  } else if (name == process_messages::kRegisterFunction) {
+    RegisterFunction(frame, context, source_process, message->GetArgumentList());
+    handled = true;
+  } else if (name == process_messages::kInvokeFunction) {
+    InvokeFunction(frame, context, source_process, message->GetArgumentList());
+    handled = true;
+  } else if (name == process_messages::kMemoryUsage) {
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(),
+                         reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+                         sizeof(counters));
+    CefRefPtr<CefV8Value> window = context->GetGlobal();
+    CefRefPtr<CefProcessMessage> responseMessage =
+        CefProcessMessage::Create(process_messages::kOnMemoryUsage);
+    CefRefPtr<CefListValue> args = responseMessage->GetArgumentList();
+    args->SetInt(0, static_cast<int>(GetCurrentProcessId()));
+    args->SetDouble(1, static_cast<double>(counters.PrivateUsage));
+    args->SetInt(2, window->GetValue("scrollX")->GetIntValue());
+    args->SetInt(3, window->GetValue("scrollY")->GetIntValue());
+    frame->SendProcessMessage(source_process, responseMessage);
+    handled = true;
    }
    context->Exit();
    return handled;
- }
\ No newline at end of file
+ }
+
+void RenderProcessHandler::EvalBatch(CefRefPtr<CefFrame> frame,
+                                     CefRefPtr<CefV8Context> context,
+                                     CefProcessId source_process,
+                                     CefRefPtr<CefListValue> args) {
+  std::optional<EvalBatchRequest> request = process_messages::ReadEvalBatchRequest(args);
+  if (!request.has_value()) {
+    SDL_Log("RenderProcessHandler: malformed %s message", process_messages::kEvalBatch);
+    return;
+  }
+  std::vector<process_messages::ScriptResult> results;
+  results.reserve(request->scripts.size());
+  CefRefPtr<CefV8Value> isView = ArrayBufferIsView(context);
+  // The caller has entered |context| once for the whole batch.
+  for (const EvalBatchScript& script : request->scripts) {
+    CefRefPtr<CefV8Value> retval;
+    CefRefPtr<CefV8Exception> exception;
+    process_messages::ScriptResult result;
+    result.success = context->Eval(CefString(script.code), CefString(script.scriptUrl),
+                                   script.startLine, retval, exception);
+    if (result.success) {
+      result.value = V8ToCefValue(retval, isView);
+    } else {
+      result.error = ToEvalJavaScriptError(exception);
+    }
+    results.push_back(std::move(result));
+    if (!results.back().success && request->stopOnError) {
+      break;
+    }
+  }
+  CefRefPtr<CefProcessMessage> responseMessage =
+      CefProcessMessage::Create(process_messages::kOnEvalBatch);
+  process_messages::WriteEvalBatchResponse(responseMessage->GetArgumentList(), request->id,
+                                           frame->GetBrowser()->GetIdentifier(), results);
+  frame->SendProcessMessage(source_process, responseMessage);
+}
+
+void RenderProcessHandler::RegisterFunction(CefRefPtr<CefFrame> frame,
+                                            CefRefPtr<CefV8Context> context,
+                                            CefProcessId source_process,
+                                            CefRefPtr<CefListValue> args) {
+  std::optional<RegisterFunctionRequest> request =
+      process_messages::ReadRegisterFunctionRequest(args);
+  if (!request.has_value()) {
+    SDL_Log("RenderProcessHandler: malformed %s message",
+            process_messages::kRegisterFunction);
+    return;
+  }
+  RegisterFunctionResponse response;
+  response.id = request->id;
+  response.browserId = frame->GetBrowser()->GetIdentifier();
+  // Parenthesized so that a function expression is not parsed as a
+  // declaration; the newline keeps a trailing line comment from eating the
+  // closing parenthesis.
+  CefRefPtr<CefV8Value> function;
+  CefRefPtr<CefV8Exception> exception;
+  bool compiled = context->Eval("(" + request->source + "\n)", CefString(), 0,
+                                function, exception);
+  if (!compiled) {
+    response.success = false;
+    response.error = exception->GetMessage().ToString();
+  } else if (!function->IsFunction()) {
+    response.success = false;
+    response.error = "source does not evaluate to a function";
+  } else {
+    int handle = next_function_handle_++;
+    registered_functions_[handle] = {context, function};
+    response.success = true;
+    response.handle = handle;
+  }
+  CefRefPtr<CefProcessMessage> responseMessage =
+      CefProcessMessage::Create(process_messages::kOnRegisterFunction);
+  process_messages::WriteRegisterFunctionResponse(responseMessage->GetArgumentList(),
+                                                  response);
+  frame->SendProcessMessage(source_process, responseMessage);
+}
+
+void RenderProcessHandler::InvokeFunction(CefRefPtr<CefFrame> frame,
+                                          CefRefPtr<CefV8Context> context,
+                                          CefProcessId source_process,
+                                          CefRefPtr<CefListValue> args) {
+  std::optional<process_messages::FunctionCall> call =
+      process_messages::ReadInvokeFunctionRequest(args);
+  if (!call.has_value()) {
+    SDL_Log("RenderProcessHandler: malformed %s message",
+            process_messages::kInvokeFunction);
+    return;
+  }
+  process_messages::FunctionResult result;
+  result.id = call->id;
+  result.browserId = frame->GetBrowser()->GetIdentifier();
+  result.success = false;
+  auto it = registered_functions_.find(call->handle);
+  // A handle from another browser's page sharing this renderer is as unknown
+  // as one whose page has gone.
+  if (it == registered_functions_.end() || !it->second.context->IsSame(context)) {
+    result.error = "unknown function handle " + std::to_string(call->handle);
+  } else {
+    CefV8ValueList arguments;
+    arguments.reserve(call->arguments->GetSize());
+    for (size_t i = 0; i < call->arguments->GetSize(); i++) {
+      arguments.push_back(CefValueToV8(call->arguments->GetValue(i)));
+    }
+    CefRefPtr<CefV8Value> function = it->second.function;
+    CefRefPtr<CefV8Value> retval =
+        function->ExecuteFunctionWithContext(context, nullptr, arguments);
+    if (function->HasException()) {
+      result.error = function->GetException()->GetMessage().ToString();
+      function->ClearException();
+    } else if (!retval) {
+      result.error = "function could not be called";
+    } else {
+      result.success = true;
+      result.result = V8ToCefValue(retval, ArrayBufferIsView(context));
+    }
+  }
+  CefRefPtr<CefProcessMessage> responseMessage =
+      CefProcessMessage::Create(process_messages::kOnInvokeFunction);
+  process_messages::WriteInvokeFunctionResponse(responseMessage->GetArgumentList(), result);
+  frame->SendProcessMessage(source_process, responseMessage);
+}
+
+void RenderProcessHandler::OnPromiseSettled(const std::string& evalId,
+                                            uint64_t sequence,
+                                            bool fulfilled,
+                                            CefRefPtr<CefV8Value> value) {
+  auto it = pending_evals_.find(evalId);
+  if (it == pending_evals_.end() || it->second.sequence != sequence) {
+    // Timed out or cancelled already, possibly with a newer eval now
+    // pending under the same id.
+    return;
+  }
+  process_messages::ScriptResult result;
+  result.success = fulfilled;
+  CefRefPtr<CefV8Value> isView = ArrayBufferIsView(it->second.context);
+  if (fulfilled) {
+    result.value = V8ToCefValue(value, isView);
+  } else {
+    result.error = ToEvalJavaScriptError(value, it->second.scriptUrl, isView);
+  }
+  FinishEval(evalId, result);
+}
+
+void RenderProcessHandler::OnEvalTimeout(const std::string& evalId,
+                                         uint64_t sequence,
+                                         int timeoutMs) {
+  auto it = pending_evals_.find(evalId);
+  if (it == pending_evals_.end() || it->second.sequence != sequence) {
+    return;
+  }
+  process_messages::ScriptResult result;
+  result.error = EvalJavaScriptError{};
+  result.error->message =
+      "promise did not settle within " + std::to_string(timeoutMs) + " ms";
+  result.error->scriptResourceName = it->second.scriptUrl;
+  FinishEval(evalId, result);
+}
+
+void RenderProcessHandler::FinishEval(const std::string& evalId,
+                                      const process_messages::ScriptResult& result) {
+  auto it = pending_evals_.find(evalId);
+  if (it == pending_evals_.end()) {
+    return;
+  }
+  PendingEval pending = it->second;
+  pending_evals_.erase(it);
+  CefRefPtr<CefProcessMessage> responseMessage =
+      CefProcessMessage::Create(process_messages::kOnEval);
+  process_messages::WriteEvalResponse(responseMessage->GetArgumentList(), pending.id,
+                                      pending.browserId, result);
+  CefRefPtr<CefFrame> mainFrame = pending.browser->GetMainFrame();
+  if (!mainFrame || !mainFrame->IsValid()) {
+    // The main frame now lives in another renderer. The browser process
+    // answered this eval when the navigation committed.
+    return;
+  }
+  mainFrame->SendProcessMessage(pending.sourceProcess, responseMessage);
+}
@@ -4,16 +4,29 @@
 
 #pragma once
 
+#include <cstdint>
 #include <optional>
 #include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "process_handler.h"
+#include "process_messages.hpp"
 
 // Client app implementation for the renderer process.
 class RenderProcessHandler : public ProcessHandler, public CefRenderProcessHandler {
  public:
     RenderProcessHandler();
 
+  // Answers the eval whose promise settled, unless it already timed out or
+  // its context went away. |sequence| identifies the eval as in
+  // OnEvalTimeout().
+  void OnPromiseSettled(const std::string& evalId,
+                        uint64_t sequence,
+                        bool fulfilled,
+                        CefRefPtr<CefV8Value> value);
+
  private:
   // CefApp methods.
   CefRefPtr<CefRenderProcessHandler> GetRenderProcessHandler() override;
@@ -44,7 +57,63 @@ class RenderProcessHandler : public ProcessHandler, public CefRenderProcessHandl
                                 CefRefPtr<CefProcessMessage> message) override;
 
  private:
+  // A function compiled by a RegisterFunction message, usable for as long as
+  // the context it was compiled in.
+  struct RegisteredFunction {
+    CefRefPtr<CefV8Context> context;
+    CefRefPtr<CefV8Value> function;
+  };
+
+  // Builtins of a context as they were before any page script ran.
+  struct ContextBuiltins {
+    CefRefPtr<CefV8Context> context;
+    CefRefPtr<CefV8Value> arrayBufferIsView;
+  };
+
+  // An eval whose script returned a promise that has not settled yet.
+  struct PendingEval {
+    UUID id;
+    int browserId;
+    // The answer goes through the browser's main frame as it is when the
+    // eval finishes, not the frame it ran in, which a cross-process
+    // navigation may have detached.
+    CefRefPtr<CefBrowser> browser;
+    CefRefPtr<CefV8Context> context;
+    CefProcessId sourceProcess;
+    std::string scriptUrl;
+    // Tells a timeout or a settled promise apart from those of an earlier
+    // eval with the same id.
+    uint64_t sequence;
+  };
+
+  // ArrayBuffer.isView of |context|, or nullptr if it was not captured.
+  CefRefPtr<CefV8Value> ArrayBufferIsView(CefRefPtr<CefV8Context> context);
+  void OnEvalTimeout(const std::string& evalId, uint64_t sequence, int timeoutMs);
+  // Sends |result| for a pending eval and forgets it.
+  void FinishEval(const std::string& evalId, const process_messages::ScriptResult& result);
+  void EvalBatch(CefRefPtr<CefFrame> frame,
+                 CefRefPtr<CefV8Context> context,
+                 CefProcessId source_process,
+                 CefRefPtr<CefListValue> args);
+  void RegisterFunction(CefRefPtr<CefFrame> frame,
+                        CefRefPtr<CefV8Context> context,
+                        CefProcessId source_process,
+                        CefRefPtr<CefListValue> args);
+  void InvokeFunction(CefRefPtr<CefFrame> frame,
+                      CefRefPtr<CefV8Context> context,
+                      CefProcessId source_process,
+                      CefRefPtr<CefListValue> args);
+
   bool last_node_is_editable_ = false;
+  // One per live context. Renderer main thread only.
+  std::vector<ContextBuiltins> context_builtins_;
+  // By handle. Handles are never reused, so a stale one cannot reach a
+  // function registered later. Renderer main thread only.
+  std::unordered_map<int, RegisteredFunction> registered_functions_;
+  int next_function_handle_ = 1;
+  // By eval id. Renderer main thread only.
+  std::unordered_map<std::string, PendingEval> pending_evals_;
+  uint64_t next_eval_sequence_ = 1;
 
   IMPLEMENT_REFCOUNTING(RenderProcessHandler);
   DISALLOW_COPY_AND_ASSIGN(RenderProcessHandler);
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include "guid_ext.hpp"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Correlates responses from the client with the requests that expect them.
+//
+// A request id is registered with Expect() before the request is sent, so
+// a fast response can never arrive ahead of its waiter, which then waits for
+// it with a deadline.
+//
+// Ids are spread over lock-striped shards by hash, and each shard keeps a
+// pool of waiter slots whose condition variables are created once and
+// reused, so a request/response round trip does not allocate or create
+// synchronization objects in the steady state.
+class ResponseTable {
+ public:
+  static constexpr size_t kShardCount = 16;
+
+  ResponseTable() {
+    for (Shard& shard : shards) {
+      shard.mutex = SDL_CreateMutex();
+    }
+  }
+
+  ~ResponseTable() {
+    for (Shard& shard : shards) {
+      for (std::unique_ptr<Slot>& slot : shard.slots) {
+        SDL_DestroyCondition(slot->cond);
+      }
+      SDL_DestroyMutex(shard.mutex);
+    }
+  }
+
+  ResponseTable(const ResponseTable&) = delete;
+  ResponseTable& operator=(const ResponseTable&) = delete;
+
+  // Registers |id| for a later Wait().
+  void Expect(const UUID& id) {
+    Shard& shard = ShardFor(id);
+    SDL_LockMutex(shard.mutex);
+    Slot* slot;
+    if (shard.freeSlots.empty()) {
+      shard.slots.push_back(std::make_unique<Slot>());
+      slot = shard.slots.back().get();
+      slot->cond = SDL_CreateCondition();
+    } else {
+      slot = shard.freeSlots.back();
+      shard.freeSlots.pop_back();
+    }
+    if (!shard.pending.emplace(id, slot).second) {
+      SDL_Log("ResponseTable: id registered twice, keeping the first waiter");
+      shard.freeSlots.push_back(slot);
+    }
+    SDL_UnlockMutex(shard.mutex);
+  }
+
+  // Waits up to |timeoutMs| (-1 waits forever) for the response to an id
+  // registered with Expect(id); at most one thread may wait for an id.
+  // Returns nullopt on timeout, on cancellation, or if |id| was never
+  // registered. The id is forgotten either way.
+  std::optional<json> Wait(const UUID& id, Sint32 timeoutMs) {
+    Shard& shard = ShardFor(id);
+    Uint64 deadline = timeoutMs < 0 ? 0 : SDL_GetTicks() + timeoutMs;
+
+    SDL_LockMutex(shard.mutex);
+    auto it = shard.pending.find(id);
+    if (it == shard.pending.end()) {
+      SDL_UnlockMutex(shard.mutex);
+      return std::nullopt;
+    }
+    Slot* slot = it->second;
+    while (!slot->done) {
+      if (timeoutMs < 0) {
+        SDL_WaitCondition(slot->cond, shard.mutex);
+        continue;
+      }
+      Uint64 now = SDL_GetTicks();
+      if (now >= deadline) {
+        break;
+      }
+      SDL_WaitConditionTimeout(slot->cond, shard.mutex,
+                               static_cast<Sint32>(deadline - now));
+    }
+
+    std::optional<json> response;
+    if (slot->done) {
+      response = std::move(slot->response);
+    } else {
+      timeouts++;
+    }
+    shard.pending.erase(id);
+    Release(shard, slot);
+    SDL_UnlockMutex(shard.mutex);
+    return response;
+  }
+
+  // Delivers a response. Returns false if nobody expects |id|.
+  bool Complete(const UUID& id, json&& response) {
+    return Finish(id, std::optional<json>(std::move(response)));
+  }
+
+  // Fails a pending request: its waiter sees nullopt. Returns
+  // false if |id| is not pending (e.g. already completed).
+  bool Cancel(const UUID& id) { return Finish(id, std::nullopt); }
+
+  json CollectMetrics() {
+    size_t pendingCount = 0;
+    size_t pooled = 0;
+    for (Shard& shard : shards) {
+      SDL_LockMutex(shard.mutex);
+      pendingCount += shard.pending.size();
+      pooled += shard.slots.size();
+      SDL_UnlockMutex(shard.mutex);
+    }
+    return {
+        {"pending", pendingCount},
+        {"pooledSlots", pooled},
+        {"completed", completed.load()},
+        {"timeouts", timeouts.load()},
+        {"cancelled", cancelled.load()},
+        {"unmatched", unmatched.load()},
+    };
+  }
+
+ private:
+  struct Slot {
+    SDL_Condition* cond = nullptr;
+    std::optional<json> response;
+    bool done = false;
+  };
+
+  struct Shard {
+    SDL_Mutex* mutex = nullptr;
+    std::unordered_map<UUID, Slot*> pending;
+    // Every slot ever created for this shard; free ones are in |freeSlots|.
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<Slot*> freeSlots;
+  };
+
+  Shard& ShardFor(const UUID& id) {
+    return shards[std::hash<UUID>()(id) % kShardCount];
+  }
+
+  bool Finish(const UUID& id, std::optional<json> response) {
+    Shard& shard = ShardFor(id);
+    SDL_LockMutex(shard.mutex);
+    auto it = shard.pending.find(id);
+    if (it == shard.pending.end()) {
+      SDL_UnlockMutex(shard.mutex);
+      if (response.has_value()) {
+        unmatched++;
+      }
+      return false;
+    }
+    Slot* slot = it->second;
+    if (slot->done) {
+      // Already finished; its waiter has not collected it yet.
+      SDL_UnlockMutex(shard.mutex);
+      return false;
+    }
+    if (response.has_value()) {
+      completed++;
+    } else {
+      cancelled++;
+    }
+
+    // The waiter picks up the response and releases the slot.
+    slot->response = std::move(response);
+    slot->done = true;
+    SDL_SignalCondition(slot->cond);
+    SDL_UnlockMutex(shard.mutex);
+    return true;
+  }
+
+  // Returns |slot| to the pool. Requires the shard mutex.
+  static void Release(Shard& shard, Slot* slot) {
+    slot->response.reset();
+    slot->done = false;
+    shard.freeSlots.push_back(slot);
+  }
+
+  Shard shards[kShardCount];
+  std::atomic<uint64_t> completed{0};
+  std::atomic<uint64_t> timeouts{0};
+  std::atomic<uint64_t> cancelled{0};
+  std::atomic<uint64_t> unmatched{0};
+};
@@ -1,10 +1,12 @@
 #pragma once
 
 #include "include/internal/cef_types_wrappers.h"
+#include "guid_ext.hpp"
 #include "json.hpp"
 #include <optional>
 #include <rpc.h>
 #include <string>
+#include <vector>
 
 using json = nlohmann::json;
 
@@ -20,16 +22,11 @@ inline void from_json(const json& j, HANDLE& m) {
 
 // UUID
 inline void to_json(json& j, const UUID& m) {
-  RPC_CSTR str;
-  UuidToStringA(const_cast<UUID*>(&m), &str);
-  j = std::string(reinterpret_cast<char*>(str));
-  RpcStringFreeA(&str);
+  j = UuidToString(m);
 }
 
 inline void from_json(const json& j, UUID& m) {
-  std::string str = j.get<std::string>();
-  RPC_CSTR rpcStr = reinterpret_cast<RPC_CSTR>(const_cast<char*>(str.c_str()));
-  UuidFromStringA(rpcStr, &m);
+  UuidFromString(j.get<std::string>(), m);
 }
 
 // CEF types
@@ -70,30 +67,110 @@ inline void to_json(json& j, const CefCursorInfo& m) {
 
 // Request messages
 struct InitializeRequest {
+  static constexpr const char* kType = "InitializeRequest";
+
   UUID id;
   int clientProcessId;
+  // Wire encodings supported by the client, in order of preference.
+  std::vector<std::string> encodings;
+  // Whether the client accepts Batch frames from the runner.
+  bool batching = false;
+  // Whether the client accepts eval results as structured values. Older
+  // clients get them as JSON text.
+  bool structuredResults = false;
 };
 
 inline void from_json(const json& j, InitializeRequest& m) {
   j.at("id").get_to(m.id);
   j.at("clientProcessId").get_to(m.clientProcessId);
+  if (j.contains("encodings")) {
+    j.at("encodings").get_to(m.encodings);
+  }
+  if (j.contains("batching")) {
+    j.at("batching").get_to(m.batching);
+  }
+  if (j.contains("structuredResults")) {
+    j.at("structuredResults").get_to(m.structuredResults);
+  }
 }
 
 struct InitializeResponse {
   UUID id;
+  // Encoding used for every frame after this response.
+  std::string encoding;
+  // Whether frames after this response may be Batch frames.
+  bool batching = false;
+  // Whether eval results after this response are structured values rather
+  // than JSON text.
+  bool structuredResults = false;
 };
 
 inline void to_json(json& j, const InitializeResponse& m) {
   j = json::object();
   j["type"] = "InitializeResponse";
   j["id"] = m.id;
+  j["encoding"] = m.encoding;
+  j["batching"] = m.batching;
+  j["structuredResults"] = m.structuredResults;
+}
+
+struct GetMetricsRequest {
+  static constexpr const char* kType = "GetMetricsRequest";
+
+  UUID id;
+};
+
+inline void from_json(const json& j, GetMetricsRequest& m) {
+  j.at("id").get_to(m.id);
+}
+
+struct MetricsResponse {
+  UUID id;
+  json metrics;
+};
+
+inline void to_json(json& j, const MetricsResponse& m) {
+  j = json::object();
+  j["type"] = "MetricsResponse";
+  j["id"] = m.id;
+  j["metrics"] = m.metrics;
 }
 
 struct CreateBrowserRequest {
+  static constexpr const char* kType = "CreateBrowserRequest";
+
   UUID id;
   std::string url;
   CefRect rectangle;
   std::optional<std::string> html;
+  // Upper bound on the dirty rects sent with each paint event.
+  std::optional<int> maxDirtyRects;
+  // Don't send paint events whose damage is empty.
+  bool skipEmptyFrames = false;
+  // Render in software and deliver frames through shared memory
+  // (SoftwareFrameEvent) instead of shared GPU textures.
+  bool softwareRendering = false;
+  // Software rendering only: "bgra" (default) or "rgba".
+  std::string pixelFormat = "bgra";
+  // Software rendering only: un-premultiply alpha.
+  bool straightAlpha = false;
+  // Software rendering only: also publish a thumbnail scaled down by 2 or 4.
+  int thumbnailScale = 0;
+  // Software rendering only: drop damage over tiles whose content is
+  // unchanged.
+  bool skipUnchangedTiles = false;
+  // Render only when the client sends BeginFrameRequest. Defaults to
+  // --external-begin-frame-enabled.
+  std::optional<bool> externalBeginFrame;
+  // Frame rate for browsers that pace themselves.
+  std::optional<int> frameRate;
+  // Browsers in the same partition share one request context (cookies,
+  // cache, connections). Without a partition the process-wide context is
+  // used, or a private one with --request-context-per-browser.
+  std::optional<std::string> partition;
+  // Keep the partition's storage under cache/partitions/<name> instead of
+  // in memory. Only the first browser in a partition decides.
+  bool partitionOnDisk = false;
 };
 
 inline void from_json(const json& j, CreateBrowserRequest& m) {
@@ -101,22 +178,151 @@ inline void from_json(const json& j, CreateBrowserRequest& m) {
   j.at("url").get_to(m.url);
   j.at("rectangle").get_to(m.rectangle);
   j.at("html").get_to(m.html);
+  if (j.contains("maxDirtyRects")) {
+    j.at("maxDirtyRects").get_to(m.maxDirtyRects);
+  }
+  if (j.contains("skipEmptyFrames")) {
+    j.at("skipEmptyFrames").get_to(m.skipEmptyFrames);
+  }
+  if (j.contains("softwareRendering")) {
+    j.at("softwareRendering").get_to(m.softwareRendering);
+  }
+  if (j.contains("pixelFormat")) {
+    j.at("pixelFormat").get_to(m.pixelFormat);
+  }
+  if (j.contains("straightAlpha")) {
+    j.at("straightAlpha").get_to(m.straightAlpha);
+  }
+  if (j.contains("thumbnailScale")) {
+    j.at("thumbnailScale").get_to(m.thumbnailScale);
+  }
+  if (j.contains("skipUnchangedTiles")) {
+    j.at("skipUnchangedTiles").get_to(m.skipUnchangedTiles);
+  }
+  if (j.contains("externalBeginFrame")) {
+    j.at("externalBeginFrame").get_to(m.externalBeginFrame);
+  }
+  if (j.contains("frameRate")) {
+    j.at("frameRate").get_to(m.frameRate);
+  }
+  if (j.contains("partition")) {
+    j.at("partition").get_to(m.partition);
+  }
+  if (j.contains("partitionOnDisk")) {
+    j.at("partitionOnDisk").get_to(m.partitionOnDisk);
+  }
 }
 
 struct EvalJavaScriptRequest {
+  static constexpr const char* kType = "EvalJavaScriptRequest";
+
   UUID id;
   int browserId;
   std::string code;
   std::string scriptUrl;
   int startLine;
+  // If the script returns a promise, how long to wait for it to settle
+  // before answering with a timeout error. Zero waits indefinitely.
+  int timeoutMs = 0;
 };
 
+inline void to_json(json& j, const EvalJavaScriptRequest& m) {
+  j = json::object();
+  j["type"] = EvalJavaScriptRequest::kType;
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["code"] = m.code;
+  j["scriptUrl"] = m.scriptUrl;
+  j["startLine"] = m.startLine;
+  j["timeoutMs"] = m.timeoutMs;
+}
+
 inline void from_json(const json& j, EvalJavaScriptRequest& m) {
   j.at("id").get_to(m.id);
   j.at("browserId").get_to(m.browserId);
   j.at("code").get_to(m.code);
   j.at("scriptUrl").get_to(m.scriptUrl);
   j.at("startLine").get_to(m.startLine);
+  if (j.contains("timeoutMs")) {
+    j.at("timeoutMs").get_to(m.timeoutMs);
+  }
+}
+
+struct EvalBatchScript {
+  std::string code;
+  std::string scriptUrl;
+  int startLine = 0;
+};
+
+inline void from_json(const json& j, EvalBatchScript& m) {
+  j.at("code").get_to(m.code);
+  if (j.contains("scriptUrl")) {
+    j.at("scriptUrl").get_to(m.scriptUrl);
+  }
+  if (j.contains("startLine")) {
+    j.at("startLine").get_to(m.startLine);
+  }
+}
+
+// Evaluates several scripts in order against the same page state, in one
+// round trip to the renderer. With |stopOnError| the scripts after the first
+// one that throws are not run.
+struct EvalBatchRequest {
+  static constexpr const char* kType = "EvalBatchRequest";
+
+  UUID id;
+  int browserId;
+  std::vector<EvalBatchScript> scripts;
+  bool stopOnError = true;
+};
+
+inline void from_json(const json& j, EvalBatchRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  j.at("scripts").get_to(m.scripts);
+  if (j.contains("stopOnError")) {
+    j.at("stopOnError").get_to(m.stopOnError);
+  }
+}
+
+// Compiles |source|, a function expression such as "(a, b) => a + b", once in
+// the browser's current page. The returned handle stays valid until the page's
+// JavaScript context goes away (navigation, reload, hibernation).
+struct RegisterFunctionRequest {
+  static constexpr const char* kType = "RegisterFunctionRequest";
+
+  UUID id;
+  int browserId;
+  std::string source;
+};
+
+inline void from_json(const json& j, RegisterFunctionRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  j.at("source").get_to(m.source);
+}
+
+// Calls a function registered with RegisterFunctionRequest. Arguments and the
+// result are passed as structured values rather than script text.
+struct InvokeFunctionRequest {
+  static constexpr const char* kType = "InvokeFunctionRequest";
+
+  UUID id;
+  int browserId;
+  int handle;
+  json arguments = json::array();
+};
+
+inline void from_json(const json& j, InvokeFunctionRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  j.at("handle").get_to(m.handle);
+  if (j.contains("arguments")) {
+    m.arguments = j.at("arguments");
+    if (!m.arguments.is_array()) {
+      throw json::type_error::create(302, "arguments must be an array", &j);
+    }
+  }
 }
 
 inline void from_json(const json& j, MouseEvent& m) {
@@ -126,6 +332,8 @@ inline void from_json(const json& j, MouseEvent& m) {
 }
 
 struct MouseClickEvent {
+  static constexpr const char* kType = "MouseClickEvent";
+
   UUID id;
   int browserId;
   MouseEvent mouseEvent;
@@ -144,6 +352,8 @@ inline void from_json(const json& j, MouseClickEvent& m) {
 }
 
 struct MouseMoveEvent {
+  static constexpr const char* kType = "MouseMoveEvent";
+
   UUID id;
   int browserId;
   MouseEvent mouseEvent;
@@ -158,6 +368,8 @@ inline void from_json(const json& j, MouseMoveEvent& m) {
 }
 
 struct MouseWheelEvent {
+  static constexpr const char* kType = "MouseWheelEvent";
+
   UUID id;
   int browserId;
   MouseEvent mouseEvent;
@@ -174,6 +386,8 @@ inline void from_json(const json& j, MouseWheelEvent& m) {
 }
 
 struct KeyboardEvent {
+  static constexpr const char* kType = "KeyboardEvent";
+
   UUID id;
   int browserId;
   CefKeyEvent keyEvent;
@@ -198,6 +412,69 @@ inline void from_json(const json& j, KeyboardEvent& m) {
   j.at("keyEvent").get_to(m.keyEvent);
 }
 
+// Asks a browser created with externalBeginFrame to produce one frame.
+struct BeginFrameRequest {
+  static constexpr const char* kType = "BeginFrameRequest";
+
+  UUID id;
+  int browserId;
+};
+
+inline void from_json(const json& j, BeginFrameRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+}
+
+struct SetWindowlessFrameRateRequest {
+  static constexpr const char* kType = "SetWindowlessFrameRateRequest";
+
+  UUID id;
+  int browserId;
+  int frameRate;
+};
+
+inline void from_json(const json& j, SetWindowlessFrameRateRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  j.at("frameRate").get_to(m.frameRate);
+}
+
+// Shows or hides a browser. Hidden browsers stop painting, are throttled
+// and muted, and may be hibernated to stay within
+// --renderer-memory-budget-mb; showing one again restores its page.
+struct SetVisibilityRequest {
+  static constexpr const char* kType = "SetVisibilityRequest";
+
+  UUID id;
+  int browserId;
+  bool visible;
+};
+
+inline void from_json(const json& j, SetVisibilityRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  j.at("visible").get_to(m.visible);
+}
+
+// Closes a browser and releases everything held for it. Answered with a
+// CloseBrowserResponse once the browser is gone.
+struct CloseBrowserRequest {
+  static constexpr const char* kType = "CloseBrowserRequest";
+
+  UUID id;
+  int browserId;
+  // Skip beforeunload handlers.
+  bool force = true;
+};
+
+inline void from_json(const json& j, CloseBrowserRequest& m) {
+  j.at("id").get_to(m.id);
+  j.at("browserId").get_to(m.browserId);
+  if (j.contains("force")) {
+    j.at("force").get_to(m.force);
+  }
+}
+
 struct NavigateDestination {
   std::string id;
   int index;
@@ -266,6 +543,7 @@ inline void to_json(json& j, const MouseOverEvent& m) {
 // Response messages
 struct CreateBrowserResponse {
   UUID id;
+  // -1 if the browser could not be created.
   int browserId;
 };
 
@@ -276,6 +554,21 @@ inline void to_json(json& j, const CreateBrowserResponse& m) {
   j["browserId"] = m.browserId;
 }
 
+struct CloseBrowserResponse {
+  UUID id;
+  int browserId;
+  // False if the browser did not exist.
+  bool closed;
+};
+
+inline void to_json(json& j, const CloseBrowserResponse& m) {
+  j = json::object();
+  j["type"] = "CloseBrowserResponse";
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["closed"] = m.closed;
+}
+
 struct EvalJavaScriptError {
   int endColumn;
   int endPosition;
@@ -304,7 +597,9 @@ struct EvalJavaScriptResponse {
   int browserId;
   bool success;
   std::optional<EvalJavaScriptError> error;
-  std::optional<std::string> result;
+  // A structured value, or its JSON text if the client did not negotiate
+  // structured results.
+  std::optional<json> result;
 };
 
 inline void to_json(json& j, const EvalJavaScriptResponse& m) {
@@ -321,12 +616,94 @@ inline void to_json(json& j, const EvalJavaScriptResponse& m) {
   }
 }
 
+struct EvalBatchResult {
+  bool success;
+  std::optional<EvalJavaScriptError> error;
+  // As EvalJavaScriptResponse::result.
+  std::optional<json> result;
+};
+
+inline void to_json(json& j, const EvalBatchResult& m) {
+  j = json::object();
+  j["success"] = m.success;
+  if (m.error.has_value()) {
+    j["error"] = m.error.value();
+  }
+  if (m.result.has_value()) {
+    j["result"] = m.result.value();
+  }
+}
+
+struct EvalBatchResponse {
+  UUID id;
+  int browserId;
+  // One per script that ran, in order; shorter than the request's scripts
+  // if the batch stopped on an error.
+  std::vector<EvalBatchResult> results;
+};
+
+inline void to_json(json& j, const EvalBatchResponse& m) {
+  j = json::object();
+  j["type"] = "EvalBatchResponse";
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["results"] = m.results;
+}
+
+struct RegisterFunctionResponse {
+  UUID id;
+  int browserId;
+  bool success;
+  std::optional<int> handle;
+  std::optional<std::string> error;
+};
+
+inline void to_json(json& j, const RegisterFunctionResponse& m) {
+  j = json::object();
+  j["type"] = "RegisterFunctionResponse";
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["success"] = m.success;
+  if (m.handle.has_value()) {
+    j["handle"] = m.handle.value();
+  }
+  if (m.error.has_value()) {
+    j["error"] = m.error.value();
+  }
+}
+
+struct InvokeFunctionResponse {
+  UUID id;
+  int browserId;
+  bool success;
+  json result;
+  std::optional<std::string> error;
+};
+
+inline void to_json(json& j, const InvokeFunctionResponse& m) {
+  j = json::object();
+  j["type"] = "InvokeFunctionResponse";
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["success"] = m.success;
+  j["result"] = m.result;
+  if (m.error.has_value()) {
+    j["error"] = m.error.value();
+  }
+}
+
+// An accelerated frame is ready in the shared texture |sharedTextureHandle|,
+// a runner-owned copy of CEF's duplicated into the client's process; 0 if
+// the copy failed. The texture is not written again until the client
+// acknowledges the frame, which it does once it is done reading it.
 struct AcceleratedPaintEvent {
   UUID id;
   int browserId;
   int elementType;
-  uintptr_t sharedTextureHandle;
+  uintptr_t sharedTextureHandle = 0;
   int format;
+  // Damaged area of the surface, in view coordinates.
+  std::vector<CefRect> dirtyRects;
 };
 
 inline void to_json(json& j, const AcceleratedPaintEvent& m) {
@@ -337,6 +714,58 @@ inline void to_json(json& j, const AcceleratedPaintEvent& m) {
   j["elementType"] = m.elementType;
   j["sharedTextureHandle"] = m.sharedTextureHandle;
   j["format"] = m.format;
+  j["dirtyRects"] = m.dirtyRects;
+}
+
+// A software-rendered frame is ready in slot |slot| of the shared-memory
+// ring named |sharedMemoryName|. Must be acknowledged like
+// AcceleratedPaintEvent once the client is done reading the slot.
+struct SoftwareFrameEvent {
+  UUID id;
+  int browserId;
+  uint64_t frameNumber;
+  std::string sharedMemoryName;
+  int slot;
+  int slotCount;
+  int width;
+  int height;
+  size_t stride;
+  size_t slotSize;
+  std::string pixelFormat;
+  bool straightAlpha;
+  // Zero when no thumbnail is published.
+  int thumbnailScale;
+  size_t thumbnailOffset;
+  int thumbnailWidth;
+  int thumbnailHeight;
+  size_t thumbnailStride;
+  // Damage relative to the previous frame, in view coordinates.
+  std::vector<CefRect> dirtyRects;
+};
+
+inline void to_json(json& j, const SoftwareFrameEvent& m) {
+  j = json::object();
+  j["type"] = "SoftwareFrameEvent";
+  j["id"] = m.id;
+  j["browserId"] = m.browserId;
+  j["frameNumber"] = m.frameNumber;
+  j["sharedMemoryName"] = m.sharedMemoryName;
+  j["slot"] = m.slot;
+  j["slotCount"] = m.slotCount;
+  j["width"] = m.width;
+  j["height"] = m.height;
+  j["stride"] = m.stride;
+  j["slotSize"] = m.slotSize;
+  j["pixelFormat"] = m.pixelFormat;
+  j["straightAlpha"] = m.straightAlpha;
+  j["thumbnailScale"] = m.thumbnailScale;
+  if (m.thumbnailScale > 0) {
+    j["thumbnailOffset"] = m.thumbnailOffset;
+    j["thumbnailWidth"] = m.thumbnailWidth;
+    j["thumbnailHeight"] = m.thumbnailHeight;
+    j["thumbnailStride"] = m.thumbnailStride;
+  }
+  j["dirtyRects"] = m.dirtyRects;
 }
 
 struct CursorChangeEvent {
@@ -419,6 +848,8 @@ inline void to_json(json& j, const LoadingProgressChangeEvent& m) {
 }
 
 struct Acknowledgement {
+  static constexpr const char* kType = "Acknowledgement";
+
   UUID id;
 };
 
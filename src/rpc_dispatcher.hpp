@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <any>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include "json.hpp"
+#include "thread_safe_queue.hpp"
+#include "wire_encoding.hpp"
+
+using json = nlohmann::json;
+
+// Where a registered message type is handled.
+enum class RpcLane {
+  // Inline on the thread calling Dispatch(). Used for connection-level
+  // messages (initialization, acknowledgements) that must not queue behind
+  // browser traffic.
+  Connection,
+  // On one of the dispatch workers, chosen by the message's browserId. All
+  // messages for one browser go to the same worker and keep their order;
+  // different browsers proceed in parallel.
+  Browser,
+  // On the dispatch workers in turn. For messages that name no browser and
+  // need no ordering among themselves, so a burst of them (browser
+  // creation) is decoded in parallel instead of inline.
+  Any,
+};
+
+// Routes decoded incoming messages to their handlers by "type" tag.
+//
+// Each request struct in rpc.hpp is registered once, keyed by its kType tag,
+// and is decoded straight into that struct before its handler runs. Lookup
+// is a single hash probe with the tag borrowed from the message, so
+// dispatch cost does not grow with the number of message types. Exceptions
+// from decoding or handling one message are logged and contained there.
+//
+// Browser-lane types registered with RegisterCoalesced() are additionally
+// rate limited per browser: the first message in a window is handled right
+// away, later ones are merged into a single pending message that is handled
+// when the window closes or when any other message for the same browser
+// arrives (which keeps ordering intact).
+//
+// DispatchEncoded() takes a message still in its wire encoding and reads
+// only its type and browserId before queueing it; the full decode of
+// worker-lane messages then happens on their worker rather than on the
+// single thread reading the socket.
+//
+// A message of type kBatchType carries an ordered "messages" array of
+// ordinary messages, which are dispatched one after another exactly as if
+// they had arrived in separate frames.
+//
+// All registration must happen before Start().
+class RpcDispatcher {
+ public:
+  static constexpr const char* kBatchType = "Batch";
+
+  RpcDispatcher() = default;
+  RpcDispatcher(const RpcDispatcher&) = delete;
+  RpcDispatcher& operator=(const RpcDispatcher&) = delete;
+
+  template <typename T>
+  void Register(std::function<void(const T&)> handler,
+                RpcLane lane = RpcLane::Connection) {
+    Entry& entry = entries[T::kType];
+    entry.type = T::kType;
+    entry.lane = lane;
+    entry.invoke = [handler](const json& message) {
+      T request = message.get<T>();
+      handler(request);
+    };
+  }
+
+  // Registers a browser-lane type whose consecutive messages can be merged.
+  // |merge| folds |next| into |pending| and returns true, or returns false
+  // if the two must be handled separately.
+  template <typename T>
+  void RegisterCoalesced(std::function<void(const T&)> handler,
+                         std::function<bool(T& pending, const T& next)> merge) {
+    Register<T>(handler, RpcLane::Browser);
+    Entry& entry = entries[T::kType];
+    entry.decode = [](const json& message) { return std::any(message.get<T>()); };
+    entry.invokeDecoded = [handler](const std::any& value) {
+      handler(std::any_cast<const T&>(value));
+    };
+    entry.merge = [merge](std::any& pending, const std::any& next) {
+      return merge(*std::any_cast<T>(&pending), std::any_cast<const T&>(next));
+    };
+  }
+
+  // Returns the coalescing window for a browser in nanoseconds; zero
+  // disables coalescing for it. Must be set before Start().
+  void SetCoalescingWindow(std::function<Uint64(int browserId)> windowNs) {
+    coalescingWindowNs = std::move(windowNs);
+  }
+
+  // Drops the coalescing state kept for a closed browser. Only valid from
+  // the handler of a RpcLane::Browser message for that browser, which runs
+  // on the worker owning the state.
+  void ForgetBrowser(int browserId) {
+    Shard& shard = ShardFor(browserId);
+    shard.pending.erase(browserId);
+    shard.lastHandledNs.erase(browserId);
+  }
+
+  // For handlers that need the message itself rather than a decoded struct.
+  void RegisterRaw(const char* type,
+                   std::function<void(const json& message)> handler,
+                   RpcLane lane = RpcLane::Connection) {
+    Entry& entry = entries[type];
+    entry.type = type;
+    entry.lane = lane;
+    entry.invoke = std::move(handler);
+  }
+
+  // Spawns the workers for the browser lanes.
+  void Start(int workerCount) {
+    if (workerCount < 1) {
+      workerCount = 1;
+    }
+    for (int i = 0; i < workerCount; i++) {
+      std::unique_ptr<Shard> shard = std::make_unique<Shard>();
+      shard->dispatcher = this;
+      std::string name = "CefRpcDispatch" + std::to_string(i);
+      SDL_Thread* thread = SDL_CreateThread(ShardThread, name.c_str(), shard.get());
+      if (thread == NULL) {
+        SDL_Log("Failed creating RPC dispatch thread: %s", SDL_GetError());
+        abort();
+      }
+      SDL_DetachThread(thread);
+      shards.push_back(std::move(shard));
+    }
+  }
+
+  // Returns false if the message could not be dispatched. Browser-lane
+  // messages are only queued here; their failures are logged by the worker.
+  bool Dispatch(json&& message) {
+    auto typeIt = message.find("type");
+    if (typeIt == message.end() || !typeIt->is_string()) {
+      SDL_Log("RpcDispatcher: message without a type tag");
+      return false;
+    }
+    const std::string& type = typeIt->get_ref<const std::string&>();
+    if (type == kBatchType) {
+      return DispatchBatch(message);
+    }
+
+    auto it = entries.find(type);
+    if (it == entries.end()) {
+      SDL_Log("RpcDispatcher: unknown message type '%s'", type.c_str());
+      return false;
+    }
+    const Entry& entry = it->second;
+
+    if (entry.lane == RpcLane::Browser && !shards.empty()) {
+      auto browserIdIt = message.find("browserId");
+      if (browserIdIt == message.end() || !browserIdIt->is_number_integer()) {
+        SDL_Log("RpcDispatcher: %s without a browserId", type.c_str());
+        return false;
+      }
+      int browserId = browserIdIt->get<int>();
+      ShardFor(browserId).queue.push(Item{&entry, browserId, std::move(message)});
+      return true;
+    }
+    if (entry.lane == RpcLane::Any && !shards.empty()) {
+      NextShard().queue.push(Item{&entry, 0, std::move(message)});
+      return true;
+    }
+
+    return Invoke(entry, message);
+  }
+
+  // Like Dispatch(), for a message as it came off the wire. Worker-lane
+  // messages are queued undecoded; the rest (connection-lane messages,
+  // batches and anything malformed) are decoded here.
+  bool DispatchEncoded(std::string&& payload, WireEncoding encoding) {
+    MessageEnvelope envelope;
+    if (PeekEnvelope(payload, encoding, envelope) && envelope.type != kBatchType) {
+      auto it = entries.find(envelope.type);
+      if (it != entries.end() && !shards.empty()) {
+        const Entry& entry = it->second;
+        if (entry.lane == RpcLane::Browser && envelope.browserId.has_value()) {
+          int browserId = envelope.browserId.value();
+          ShardFor(browserId).queue.push(
+              Item{&entry, browserId, json(), std::move(payload), encoding});
+          return true;
+        }
+        if (entry.lane == RpcLane::Any) {
+          NextShard().queue.push(Item{&entry, 0, json(), std::move(payload), encoding});
+          return true;
+        }
+      }
+    }
+
+    json message;
+    try {
+      message = DecodeMessage(payload, encoding);
+    } catch (const std::exception& e) {
+      LogUndecodable(payload, e);
+      return false;
+    }
+    return Dispatch(std::move(message));
+  }
+
+  json CollectMetrics() const {
+    json dispatched = json::array();
+    for (const std::unique_ptr<Shard>& shard : shards) {
+      dispatched.push_back(shard->dispatched.load());
+    }
+    json coalesced = json::object();
+    for (const auto& it : entries) {
+      if (it.second.merge) {
+        coalesced[it.first] = it.second.merged.load();
+      }
+    }
+    return {
+        {"workers", shards.size()},
+        {"dispatched", dispatched},
+        {"coalesced", coalesced},
+        {"batches", batches.load()},
+        {"batchedMessages", batchedMessages.load()},
+    };
+  }
+
+ private:
+  struct Entry {
+    std::string type;
+    RpcLane lane = RpcLane::Connection;
+    std::function<void(const json& message)> invoke;
+
+    // Coalesced types only.
+    std::function<std::any(const json& message)> decode;
+    std::function<void(const std::any& value)> invokeDecoded;
+    std::function<bool(std::any& pending, const std::any& next)> merge;
+    mutable std::atomic<uint64_t> merged{0};
+  };
+
+  struct Item {
+    const Entry* entry = nullptr;
+    int browserId = 0;
+    json message;
+    // Set instead of |message| for messages from DispatchEncoded().
+    std::string payload;
+    WireEncoding encoding = WireEncoding::Json;
+  };
+
+  struct PendingMessage {
+    const Entry* entry = nullptr;
+    std::any value;
+    Uint64 deadlineNs = 0;
+  };
+
+  // Owned by a single worker thread apart from |queue| and |dispatched|.
+  struct Shard {
+    RpcDispatcher* dispatcher = nullptr;
+    ThreadSafeQueue<Item> queue;
+    std::atomic<uint64_t> dispatched{0};
+    std::unordered_map<int, PendingMessage> pending;
+    std::unordered_map<int, Uint64> lastHandledNs;
+  };
+
+  Shard& ShardFor(int browserId) {
+    return *shards[static_cast<unsigned int>(browserId) % shards.size()];
+  }
+
+  Shard& NextShard() { return *shards[nextShard++ % shards.size()]; }
+
+  static void LogUndecodable(const std::string& payload, const std::exception& e) {
+    std::string preview = payload.substr(0, 256);
+    SDL_Log("RpcDispatcher: undecodable message: %s payload_preview='%s'", e.what(),
+            preview.c_str());
+  }
+
+  // Returns false if any of the contained messages could not be dispatched;
+  // the remaining ones are still dispatched.
+  bool DispatchBatch(json& batch) {
+    auto messagesIt = batch.find("messages");
+    if (messagesIt == batch.end() || !messagesIt->is_array()) {
+      SDL_Log("RpcDispatcher: Batch without a messages array");
+      return false;
+    }
+    batches++;
+    batchedMessages += messagesIt->size();
+
+    bool ok = true;
+    for (json& message : *messagesIt) {
+      auto typeIt = message.find("type");
+      if (typeIt != message.end() && *typeIt == kBatchType) {
+        SDL_Log("RpcDispatcher: nested Batch ignored");
+        ok = false;
+        continue;
+      }
+      ok = Dispatch(std::move(message)) && ok;
+    }
+    return ok;
+  }
+
+  static bool Invoke(const Entry& entry, const json& message) {
+    try {
+      entry.invoke(message);
+    } catch (const std::exception& e) {
+      SDL_Log("RpcDispatcher: %s failed: %s", entry.type.c_str(), e.what());
+      return false;
+    }
+    return true;
+  }
+
+  static void InvokeDecoded(const Entry& entry, const std::any& value) {
+    try {
+      entry.invokeDecoded(value);
+    } catch (const std::exception& e) {
+      SDL_Log("RpcDispatcher: %s failed: %s", entry.type.c_str(), e.what());
+    }
+  }
+
+  static void FlushPending(Shard& shard, int browserId, Uint64 now) {
+    auto it = shard.pending.find(browserId);
+    if (it == shard.pending.end()) {
+      return;
+    }
+    InvokeDecoded(*it->second.entry, it->second.value);
+    shard.pending.erase(it);
+    shard.lastHandledNs[browserId] = now;
+  }
+
+  static void FlushExpired(Shard& shard, Uint64 now) {
+    for (auto it = shard.pending.begin(); it != shard.pending.end();) {
+      if (it->second.deadlineNs > now) {
+        ++it;
+        continue;
+      }
+      InvokeDecoded(*it->second.entry, it->second.value);
+      shard.lastHandledNs[it->first] = now;
+      it = shard.pending.erase(it);
+    }
+  }
+
+  // Milliseconds until the earliest pending message is due, or -1.
+  static Sint32 NextFlushTimeoutMs(const Shard& shard, Uint64 now) {
+    if (shard.pending.empty()) {
+      return -1;
+    }
+    Uint64 deadline = UINT64_MAX;
+    for (const auto& it : shard.pending) {
+      deadline = std::min(deadline, it.second.deadlineNs);
+    }
+    if (deadline <= now) {
+      return 0;
+    }
+    return static_cast<Sint32>((deadline - now + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS);
+  }
+
+  void Process(Shard& shard, Item& item, Uint64 now) {
+    const Entry& entry = *item.entry;
+    if (!item.payload.empty()) {
+      try {
+        item.message = DecodeMessage(item.payload, item.encoding);
+      } catch (const std::exception& e) {
+        LogUndecodable(item.payload, e);
+        return;
+      }
+      item.payload = std::string();
+    }
+    if (entry.lane == RpcLane::Any) {
+      Invoke(entry, item.message);
+      return;
+    }
+    if (!entry.merge) {
+      // Anything else for this browser is an ordering barrier.
+      FlushPending(shard, item.browserId, now);
+      Invoke(entry, item.message);
+      return;
+    }
+
+    std::any value;
+    try {
+      value = entry.decode(item.message);
+    } catch (const std::exception& e) {
+      SDL_Log("RpcDispatcher: %s failed: %s", entry.type.c_str(), e.what());
+      return;
+    }
+
+    auto pendingIt = shard.pending.find(item.browserId);
+    if (pendingIt != shard.pending.end()) {
+      PendingMessage& pending = pendingIt->second;
+      if (pending.entry == &entry && entry.merge(pending.value, value)) {
+        entry.merged++;
+        return;
+      }
+      FlushPending(shard, item.browserId, now);
+    }
+
+    Uint64 window = coalescingWindowNs ? coalescingWindowNs(item.browserId) : 0;
+    Uint64& lastHandled = shard.lastHandledNs[item.browserId];
+    if (window == 0 || now >= lastHandled + window) {
+      InvokeDecoded(entry, value);
+      lastHandled = now;
+      return;
+    }
+    shard.pending[item.browserId] =
+        PendingMessage{&entry, std::move(value), lastHandled + window};
+  }
+
+  static int ShardThread(void* shardPtr) {
+    Shard* shard = static_cast<Shard*>(shardPtr);
+    RpcDispatcher* dispatcher = shard->dispatcher;
+    std::vector<Item> items;
+    while (true) {
+      items.clear();
+      Sint32 timeoutMs = NextFlushTimeoutMs(*shard, SDL_GetTicksNS());
+      if (timeoutMs < 0) {
+        shard->queue.pop_all(items);
+      } else {
+        Item item;
+        if (shard->queue.try_pop_for(item, timeoutMs)) {
+          items.push_back(std::move(item));
+          shard->queue.drain_into(items);
+        }
+      }
+
+      Uint64 now = SDL_GetTicksNS();
+      for (Item& item : items) {
+        dispatcher->Process(*shard, item, now);
+      }
+      FlushExpired(*shard, SDL_GetTicksNS());
+      shard->dispatched += items.size();
+    }
+    return 0;
+  }
+
+  std::unordered_map<std::string, Entry> entries;
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::function<Uint64(int browserId)> coalescingWindowNs;
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> batchedMessages{0};
+  // Only advanced by the thread calling Dispatch().
+  unsigned int nextShard = 0;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <SDL3/SDL.h>
+#include "dirty_rects.hpp"
+
+// Name for a browser's frame ring. |generation| changes whenever the ring is
+// recreated (e.g. on resize) so a client never maps a stale section.
+inline std::string SharedFrameRingName(int browserId, int generation) {
+#ifdef _WIN32
+  std::string prefix = "Local\\CefProcessRunner-" + std::to_string(GetCurrentProcessId());
+#else
+  std::string prefix = "/CefProcessRunner-" + std::to_string(getpid());
+#endif
+  return prefix + "-" + std::to_string(browserId) + "-" + std::to_string(generation);
+}
+
+// A ring of BGRA frame buffers in a named shared-memory section, used to
+// hand software-rendered frames to the client without sending pixels over
+// the socket. The client maps the section by name once and is then told
+// which slot holds each new frame.
+//
+// Slot k starts at k * SlotSize() and holds Height() rows of Stride() bytes,
+// optionally followed at ThumbnailOffset() by a copy of the frame scaled
+// down by ThumbnailScale().
+//
+// Only damaged pixels are copied into a slot. A slot's content is that of
+// the last frame written to it, so any damage from frames that went to
+// other slots in the meantime is also stale there. That damage is tracked
+// per slot and copied along with the frame's own.
+//
+// A slot must not be overwritten while the client still reads it. Write()
+// only picks slots that are free and marks the one it used as in use until
+// the caller Release()s it on the client's acknowledgement, which may come
+// in any order. A frame the caller stopped waiting for keeps its slot: the
+// client may still be reading it. With every slot in use, Write() fails and
+// the frame is dropped.
+//
+// Not thread safe; used from the CEF UI thread only.
+class SharedFrameRing {
+ public:
+  static constexpr int kBytesPerPixel = 4;
+
+  SharedFrameRing() = default;
+  ~SharedFrameRing() { Close(); }
+  SharedFrameRing(const SharedFrameRing&) = delete;
+  SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+  // Creates the shared section. |name| is the platform object name: a
+  // "Local\\..." file mapping name on Windows, a "/..." shm name elsewhere.
+  bool Create(const std::string& name,
+              int width,
+              int height,
+              int slotCount,
+              int thumbnailScale = 0) {
+    Close();
+    this->width = width;
+    this->height = height;
+    this->slotCount = slotCount;
+    this->thumbnailScale = thumbnailScale;
+    stride = static_cast<size_t>(width) * kBytesPerPixel;
+    thumbnailWidth = thumbnailScale > 1 ? width / thumbnailScale : 0;
+    thumbnailHeight = thumbnailScale > 1 ? height / thumbnailScale : 0;
+    thumbnailStride = static_cast<size_t>(thumbnailWidth) * kBytesPerPixel;
+    slotSize = stride * height + thumbnailStride * thumbnailHeight;
+    size_t totalSize = slotSize * slotCount;
+
+#ifdef _WIN32
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                 static_cast<DWORD>(static_cast<uint64_t>(totalSize) >> 32),
+                                 static_cast<DWORD>(totalSize), name.c_str());
+    if (mapping == nullptr) {
+      SDL_Log("SharedFrameRing: CreateFileMapping(%s) failed: %lu", name.c_str(),
+              GetLastError());
+      return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, totalSize);
+    if (view == nullptr) {
+      SDL_Log("SharedFrameRing: MapViewOfFile failed: %lu", GetLastError());
+      Close();
+      return false;
+    }
+#else
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      SDL_Log("SharedFrameRing: shm_open(%s) failed", name.c_str());
+      return false;
+    }
+    shmName = name;
+    if (ftruncate(fd, static_cast<off_t>(totalSize)) != 0) {
+      SDL_Log("SharedFrameRing: ftruncate failed");
+      close(fd);
+      Close();
+      return false;
+    }
+    void* view = mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+      SDL_Log("SharedFrameRing: mmap failed");
+      Close();
+      return false;
+    }
+#endif
+    base = static_cast<uint8_t*>(view);
+    mappedSize = totalSize;
+    this->name = name;
+
+    // Nothing has been written yet, so every slot is entirely stale.
+    staleDamage.assign(slotCount, {CefRect(0, 0, width, height)});
+    inUse.assign(slotCount, false);
+    nextSlot = 0;
+    return true;
+  }
+
+  void Close() {
+#ifdef _WIN32
+    if (base != nullptr) {
+      UnmapViewOfFile(base);
+    }
+    if (mapping != nullptr) {
+      CloseHandle(mapping);
+      mapping = nullptr;
+    }
+#else
+    if (base != nullptr) {
+      munmap(base, mappedSize);
+    }
+    if (!shmName.empty()) {
+      // The client keeps its own mapping; the name is only needed to open it.
+      shm_unlink(shmName.c_str());
+      shmName.clear();
+    }
+#endif
+    base = nullptr;
+    mappedSize = 0;
+    staleDamage.clear();
+    inUse.clear();
+  }
+
+  bool IsOpen() const { return base != nullptr; }
+  bool Matches(int width, int height) const {
+    return IsOpen() && width == this->width && height == this->height;
+  }
+
+  // The slot the next Write() goes to, or -1 while every slot is in use.
+  // Free slots are taken in turn, starting after the last one written.
+  int FreeSlot() const {
+    for (int i = 0; i < slotCount; i++) {
+      int slot = (nextSlot + i) % slotCount;
+      if (!inUse[slot]) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  // Copies the damaged parts of |pixels| (tightly packed BGRA rows of the
+  // ring's size) into a free slot, marks it in use and returns its index.
+  // If there is no free slot it copies nothing and returns -1; the frame's
+  // damage is then stale in every slot. |damage| must already be clipped to
+  // the frame. |copied| receives the rects actually copied, i.e. the
+  // frame's damage plus the slot's stale damage.
+  int Write(const void* pixels,
+            const std::vector<CefRect>& damage,
+            size_t maxRects,
+            std::vector<CefRect>& copied) {
+    int slot = FreeSlot();
+    if (slot < 0) {
+      copied.clear();
+      Drop(damage, maxRects);
+      return -1;
+    }
+    inUse[slot] = true;
+    nextSlot = (slot + 1) % slotCount;
+
+    std::vector<CefRect>& stale = staleDamage[slot];
+    stale.insert(stale.end(), damage.begin(), damage.end());
+    copied = SimplifyDirtyRects(stale, CefRect(0, 0, width, height), maxRects);
+    stale.clear();
+
+    const uint8_t* src = static_cast<const uint8_t*>(pixels);
+    uint8_t* dst = base + slotSize * slot;
+    for (const CefRect& rect : copied) {
+      size_t offset = rect.y * stride + static_cast<size_t>(rect.x) * kBytesPerPixel;
+      size_t rowBytes = static_cast<size_t>(rect.width) * kBytesPerPixel;
+      for (int row = 0; row < rect.height; row++) {
+        memcpy(dst + offset, src + offset, rowBytes);
+        offset += stride;
+      }
+    }
+
+    AddStaleDamage(damage, maxRects, slot);
+    return slot;
+  }
+
+  // Records the damage of a frame that is not written, so the next frame
+  // written to any slot still copies it.
+  void Drop(const std::vector<CefRect>& damage, size_t maxRects) {
+    AddStaleDamage(damage, maxRects, -1);
+  }
+
+  // Frees a slot once the client is done with the frame written to it.
+  void Release(int slot) {
+    if (slot >= 0 && slot < slotCount) {
+      inUse[slot] = false;
+    }
+  }
+
+  // Frees every slot, for when the client that held them is gone.
+  void ReleaseAll() { inUse.assign(slotCount, false); }
+
+  int SlotsInUse() const {
+    return static_cast<int>(std::count(inUse.begin(), inUse.end(), true));
+  }
+
+  uint8_t* SlotPixels(int slot) { return base + slotSize * slot; }
+  uint8_t* SlotThumbnail(int slot) { return SlotPixels(slot) + ThumbnailOffset(); }
+
+  const std::string& Name() const { return name; }
+  int Width() const { return width; }
+  int Height() const { return height; }
+  int SlotCount() const { return slotCount; }
+  size_t Stride() const { return stride; }
+  size_t SlotSize() const { return slotSize; }
+  int ThumbnailScale() const { return thumbnailScale; }
+  size_t ThumbnailOffset() const { return stride * height; }
+  int ThumbnailWidth() const { return thumbnailWidth; }
+  int ThumbnailHeight() const { return thumbnailHeight; }
+  size_t ThumbnailStride() const { return thumbnailStride; }
+
+ private:
+  // Adds |damage| to the stale damage of every slot but |except|.
+  void AddStaleDamage(const std::vector<CefRect>& damage, size_t maxRects, int except) {
+    for (int slot = 0; slot < slotCount; slot++) {
+      if (slot == except) {
+        continue;
+      }
+      std::vector<CefRect>& stale = staleDamage[slot];
+      stale.insert(stale.end(), damage.begin(), damage.end());
+      if (stale.size() > maxRects * 4) {
+        stale = SimplifyDirtyRects(stale, CefRect(0, 0, width, height), maxRects);
+      }
+    }
+  }
+
+  std::string name;
+#ifdef _WIN32
+  HANDLE mapping = nullptr;
+#else
+  std::string shmName;
+#endif
+  uint8_t* base = nullptr;
+  size_t mappedSize = 0;
+  int width = 0;
+  int height = 0;
+  int slotCount = 0;
+  size_t stride = 0;
+  size_t slotSize = 0;
+  int thumbnailScale = 0;
+  int thumbnailWidth = 0;
+  int thumbnailHeight = 0;
+  size_t thumbnailStride = 0;
+  int nextSlot = 0;
+  std::vector<std::vector<CefRect>> staleDamage;
+  std::vector<bool> inUse;
+};
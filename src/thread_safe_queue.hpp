@@ -1,12 +1,23 @@
 #pragma once
 
-#include <queue>
-#include <SDL3/sdl.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <SDL3/SDL.h>
 
+// Multi-producer, single-consumer queue.
+//
+// Producers link nodes in with a single atomic exchange (Vyukov's MPSC
+// queue), so push never takes a lock unless the consumer is asleep. The
+// consumer only falls back to the mutex/condition pair when the queue is
+// empty and it has to block. Every pop must come from the same thread.
 template <typename T>
 class ThreadSafeQueue {
  public:
-  ThreadSafeQueue() {
+  ThreadSafeQueue() : head(new Node()), tail(head.load()), waiting(false) {
     mtx = SDL_CreateMutex();
     cv = SDL_CreateCondition();
     if (!mtx || !cv) {
@@ -16,64 +27,118 @@ class ThreadSafeQueue {
   }
 
   ~ThreadSafeQueue() {
+    while (tail) {
+      Node* next = tail->next.load(std::memory_order_relaxed);
+      delete tail;
+      tail = next;
+    }
     SDL_DestroyMutex(mtx);
     SDL_DestroyCondition(cv);
   }
 
   // Push item into queue (non-blocking)
-  void push(const T& val) {
-    SDL_LockMutex(mtx);
-    q.push(val);
-    SDL_SignalCondition(cv);  // wake one waiting thread
-    SDL_UnlockMutex(mtx);
-  }
+  void push(const T& val) { link(new Node(val)); }
+
+  void push(T&& val) { link(new Node(std::move(val))); }
 
   // Blocking pop: waits until an item is available
   T pop() {
-    SDL_LockMutex(mtx);
-    while (q.empty()) {
-      SDL_WaitCondition(cv, mtx);  // releases mtx + waits, then reacquires mtx
+    T val;
+    while (!try_pop(val)) {
+      wait(-1);
     }
-    T val = q.front();
-    q.pop();
-    SDL_UnlockMutex(mtx);
     return val;
   }
 
   // Non-blocking pop, returns false if queue was empty
   bool try_pop(T& out) {
-    SDL_LockMutex(mtx);
-    if (q.empty()) {
-      SDL_UnlockMutex(mtx);
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (!next) {
       return false;
     }
-    out = q.front();
-    q.pop();
-    SDL_UnlockMutex(mtx);
+    out = std::move(*next->value);
+    next->value.reset();
+    delete tail;
+    tail = next;
+    return true;
+  }
+
+  // Pop that waits up to timeoutMS for an item, returns false on timeout
+  bool try_pop_for(T& out, Sint32 timeoutMS) {
+    Uint64 deadline = SDL_GetTicks() + timeoutMS;
+    while (!try_pop(out)) {
+      Uint64 now = SDL_GetTicks();
+      if (now >= deadline) {
+        return false;
+      }
+      wait(static_cast<Sint32>(deadline - now));
+    }
     return true;
   }
 
+  // Non-blocking batch pop: moves up to |max| items onto the end of |out|
+  // and returns how many were moved.
+  size_t drain_into(std::vector<T>& out, size_t max = SIZE_MAX) {
+    size_t count = 0;
+    T val;
+    while (count < max && try_pop(val)) {
+      out.push_back(std::move(val));
+      count++;
+    }
+    return count;
+  }
+
+  // Blocking batch pop: waits until at least one item is available, then
+  // moves everything currently queued onto the end of |out|.
+  size_t pop_all(std::vector<T>& out) {
+    out.push_back(pop());
+    return 1 + drain_into(out);
+  }
+
  private:
-  SDL_Mutex* mtx;
-  SDL_Condition* cv;
-  std::queue<T> q;
-};
+  struct Node {
+    Node() : next(nullptr) {}
+    explicit Node(const T& val) : next(nullptr), value(val) {}
+    explicit Node(T&& val) : next(nullptr), value(std::move(val)) {}
 
-// Per-request synchronization entry
-struct ResponseEntry {
-  SDL_Mutex* mutex = nullptr;
-  SDL_Condition* cond = nullptr;
-  std::string payload;
-  bool ready = false;
+    std::atomic<Node*> next;
+    std::optional<T> value;
+  };
 
-  ResponseEntry() {
-    mutex = SDL_CreateMutex();
-    cond = SDL_CreateCondition();
+  void link(Node* node) {
+    Node* prev = head.exchange(node, std::memory_order_acq_rel);
+    // The consumer cannot see |node| until this store. Both it and the load
+    // of |waiting| are seq_cst so that either the consumer sees the node
+    // before sleeping or we see it waiting and wake it.
+    prev->next.store(node, std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_seq_cst)) {
+      SDL_LockMutex(mtx);
+      SDL_SignalCondition(cv);  // wake the waiting consumer
+      SDL_UnlockMutex(mtx);
+    }
   }
-  ~ResponseEntry() {
-    if (cond)
-      SDL_DestroyCondition(cond);
-    if (mutex)
-      SDL_DestroyMutex(mutex);
+
+  // Sleeps until a producer links a node or the timeout (-1 for none)
+  // expires. May return spuriously.
+  void wait(Sint32 timeoutMS) {
+    SDL_LockMutex(mtx);
+    waiting.store(true, std::memory_order_seq_cst);
+    if (!tail->next.load(std::memory_order_seq_cst)) {
+      if (timeoutMS < 0) {
+        SDL_WaitCondition(cv, mtx);  // releases mtx + waits, then reacquires mtx
+      } else {
+        SDL_WaitConditionTimeout(cv, mtx, timeoutMS);
+      }
+    }
+    waiting.store(false, std::memory_order_relaxed);
+    SDL_UnlockMutex(mtx);
   }
-};
\ No newline at end of file
+
+  // Producers append at |head|; the consumer owns |tail|, a drained node
+  // whose successor holds the oldest queued item.
+  std::atomic<Node*> head;
+  Node* tail;
+  std::atomic<bool> waiting;
+  SDL_Mutex* mtx;
+  SDL_Condition* cv;
+};
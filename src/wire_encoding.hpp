@@ -0,0 +1,555 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Payload encoding used for the frames on the RPC socket. Every connection
+// starts out as JSON; a client can ask for one of the binary encodings in its
+// InitializeRequest, which then applies to every later frame in both
+// directions.
+enum class WireEncoding {
+  Json,
+  Cbor,
+  MessagePack,
+};
+
+inline const char* WireEncodingToString(WireEncoding encoding) {
+  switch (encoding) {
+    case WireEncoding::Json:
+      return "json";
+    case WireEncoding::Cbor:
+      return "cbor";
+    case WireEncoding::MessagePack:
+      return "msgpack";
+    default:
+      return "json";
+  }
+}
+
+inline std::optional<WireEncoding> WireEncodingFromString(
+    const std::string& name) {
+  if (name == "json") {
+    return WireEncoding::Json;
+  }
+  if (name == "cbor") {
+    return WireEncoding::Cbor;
+  }
+  if (name == "msgpack") {
+    return WireEncoding::MessagePack;
+  }
+  return std::nullopt;
+}
+
+// Picks the first encoding in the client's preference list that the runner
+// understands, falling back to JSON.
+inline WireEncoding NegotiateWireEncoding(
+    const std::vector<std::string>& clientEncodings) {
+  for (const std::string& name : clientEncodings) {
+    std::optional<WireEncoding> encoding = WireEncodingFromString(name);
+    if (encoding.has_value()) {
+      return encoding.value();
+    }
+  }
+  return WireEncoding::Json;
+}
+
+inline std::string EncodeMessage(const json& message, WireEncoding encoding) {
+  std::string payload;
+  switch (encoding) {
+    case WireEncoding::Cbor:
+      json::to_cbor(message, payload);
+      break;
+    case WireEncoding::MessagePack:
+      json::to_msgpack(message, payload);
+      break;
+    case WireEncoding::Json:
+    default:
+      payload = message.dump();
+      break;
+  }
+  return payload;
+}
+
+// Throws nlohmann::json::parse_error for malformed payloads in any encoding.
+inline json DecodeMessage(const std::string& payload, WireEncoding encoding) {
+  switch (encoding) {
+    case WireEncoding::Cbor:
+      return json::from_cbor(payload);
+    case WireEncoding::MessagePack:
+      return json::from_msgpack(payload);
+    case WireEncoding::Json:
+    default:
+      return json::parse(payload);
+  }
+}
+
+// The routing fields of an incoming message.
+struct MessageEnvelope {
+  std::string type;
+  std::optional<int> browserId;
+};
+
+// The JSON fast path of PeekEnvelope(): skips over values without parsing
+// them. It does not validate what it skips, so a malformed message can get
+// through to the full decode, which rejects it. Returns false whenever it is
+// not sure (no "type" seen, or one with escapes), so the caller can fall
+// back to a real parse.
+inline bool PeekJsonEnvelope(const std::string& payload, MessageEnvelope& envelope) {
+  const size_t size = payload.size();
+  auto skipSpace = [&](size_t i) {
+    while (i < size && (payload[i] == ' ' || payload[i] == '\t' || payload[i] == '\n' ||
+                        payload[i] == '\r')) {
+      i++;
+    }
+    return i;
+  };
+  // From an opening quote to just past the closing one: the first quote not
+  // escaped by an odd number of backslashes.
+  auto skipString = [&](size_t i) {
+    const char* data = payload.data();
+    for (i++;;) {
+      const void* quote = memchr(data + i, '"', size - i);
+      if (quote == nullptr) {
+        return std::string::npos;
+      }
+      size_t end = static_cast<const char*>(quote) - data;
+      size_t backslashes = 0;
+      while (end - backslashes > i && data[end - backslashes - 1] == '\\') {
+        backslashes++;
+      }
+      if (backslashes % 2 == 0) {
+        return end + 1;
+      }
+      i = end + 1;
+    }
+  };
+  auto skipValue = [&](size_t i) {
+    if (payload[i] == '"') {
+      return skipString(i);
+    }
+    int depth = 0;
+    while (i < size) {
+      char c = payload[i];
+      if (c == '"') {
+        i = skipString(i);
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        depth++;
+      } else if (c == '}' || c == ']') {
+        if (depth == 0) {
+          break;
+        }
+        depth--;
+      } else if (c == ',' && depth == 0) {
+        break;
+      }
+      i++;
+    }
+    return i;
+  };
+
+  bool hasType = false;
+  size_t i = skipSpace(0);
+  if (i >= size || payload[i] != '{') {
+    return false;
+  }
+  i = skipSpace(i + 1);
+  while (i < size && payload[i] == '"') {
+    size_t keyEnd = skipString(i);
+    if (keyEnd == std::string::npos) {
+      return false;
+    }
+    size_t keyStart = i + 1;
+    size_t keyLength = keyEnd - 1 - keyStart;
+    i = skipSpace(keyEnd);
+    if (i >= size || payload[i] != ':') {
+      return false;
+    }
+    i = skipSpace(i + 1);
+    if (i >= size) {
+      return false;
+    }
+
+    size_t valueEnd = skipValue(i);
+    if (valueEnd == std::string::npos) {
+      return false;
+    }
+    if (payload.compare(keyStart, keyLength, "type") == 0 && payload[i] == '"') {
+      envelope.type.assign(payload, i + 1, valueEnd - i - 2);
+      if (envelope.type.find('\\') != std::string::npos) {
+        return false;
+      }
+      hasType = true;
+    } else if (payload.compare(keyStart, keyLength, "browserId") == 0) {
+      // A plain integer in int range; anything else leaves it unset.
+      size_t digits = i + (payload[i] == '-' ? 1 : 0);
+      int64_t value = 0;
+      size_t j = digits;
+      while (j < valueEnd && j - digits < 11 && payload[j] >= '0' && payload[j] <= '9') {
+        value = value * 10 + (payload[j] - '0');
+        j++;
+      }
+      value = digits > i ? -value : value;
+      if (j > digits && skipSpace(j) == valueEnd && value >= INT_MIN && value <= INT_MAX) {
+        envelope.browserId = static_cast<int>(value);
+      }
+    }
+    if (hasType && envelope.browserId.has_value()) {
+      return true;
+    }
+
+    i = skipSpace(valueEnd);
+    if (i < size && payload[i] == ',') {
+      i = skipSpace(i + 1);
+    }
+  }
+  return hasType;
+}
+
+// Reads only the top-level "type" and "browserId" of an encoded message,
+// without building the message, and stops as soon as it has both. Returns
+// false if the payload is not an object with a string "type" (malformed
+// payloads included); a "browserId" that is not an int is left unset. This
+// lets the reader route a message cheaply and leave the full decode to the
+// thread that handles it.
+inline bool PeekEnvelope(const std::string& payload,
+                         WireEncoding encoding,
+                         MessageEnvelope& envelope) {
+  class Sax : public nlohmann::json_sax<json> {
+   public:
+    explicit Sax(MessageEnvelope& envelope) : envelope(envelope) {}
+
+    bool null() override { return Value(); }
+    bool boolean(bool) override { return Value(); }
+    bool number_integer(number_integer_t value) override {
+      if (depth == 1 && field == Field::BrowserId && value >= INT_MIN && value <= INT_MAX) {
+        envelope.browserId = static_cast<int>(value);
+      }
+      return Value();
+    }
+    bool number_unsigned(number_unsigned_t value) override {
+      if (depth == 1 && field == Field::BrowserId && value <= INT_MAX) {
+        envelope.browserId = static_cast<int>(value);
+      }
+      return Value();
+    }
+    bool number_float(number_float_t, const string_t&) override { return Value(); }
+    bool string(string_t& value) override {
+      if (depth == 1 && field == Field::Type) {
+        envelope.type = std::move(value);
+        hasType = true;
+      }
+      return Value();
+    }
+    bool binary(binary_t&) override { return Value(); }
+    bool start_object(std::size_t) override {
+      depth++;
+      return true;
+    }
+    bool key(string_t& name) override {
+      if (depth == 1) {
+        field = name == "type"        ? Field::Type
+                : name == "browserId" ? Field::BrowserId
+                                      : Field::Other;
+      }
+      return true;
+    }
+    bool end_object() override {
+      --depth;
+      return Value();
+    }
+    bool start_array(std::size_t) override {
+      // A top-level array is not a message.
+      return depth++ > 0;
+    }
+    bool end_array() override {
+      --depth;
+      return Value();
+    }
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override {
+      failed = true;
+      return false;
+    }
+
+    // Stops the parse once both fields are known.
+    bool Value() {
+      if (depth == 1) {
+        field = Field::Other;
+      }
+      return !(hasType && envelope.browserId.has_value());
+    }
+    MessageEnvelope& envelope;
+    // The top-level key whose value comes next.
+    enum class Field { Other, Type, BrowserId } field = Field::Other;
+    int depth = 0;
+    bool hasType = false;
+    bool failed = false;
+  };
+
+  envelope = MessageEnvelope();
+  if (encoding == WireEncoding::Json && PeekJsonEnvelope(payload, envelope)) {
+    return true;
+  }
+  envelope = MessageEnvelope();
+  Sax sax(envelope);
+  switch (encoding) {
+    case WireEncoding::Cbor:
+      json::sax_parse(payload, &sax, json::input_format_t::cbor);
+      break;
+    case WireEncoding::MessagePack:
+      json::sax_parse(payload, &sax, json::input_format_t::msgpack);
+      break;
+    case WireEncoding::Json:
+    default:
+      json::sax_parse(payload, &sax);
+      break;
+  }
+  return !sax.failed && sax.hasType;
+}
+
+// An encoded message waiting in the outgoing queue.
+struct OutgoingMessage {
+  std::string payload;
+  WireEncoding encoding = WireEncoding::Json;
+  // The connection the message was encoded for; see
+  // BrowserProcessHandler::connectionGeneration.
+  uint64_t connection = 0;
+  // Set on the InitializeResponse: the frames after it use this encoding
+  // and batching mode.
+  std::optional<WireEncoding> switchEncoding;
+  bool switchBatching = false;
+};
+
+// What the client expects of the next frame written on a connection.
+struct WireState {
+  uint64_t connection = 0;
+  WireEncoding encoding = WireEncoding::Json;
+  bool batching = false;
+};
+
+// A Batch frame is {"type": "Batch", "messages": [...]} in the connection's
+// encoding. All three encodings allow already-encoded messages to be placed
+// one after another behind an array header, so the writer can build the
+// envelope without decoding anything: header, then each payload with
+// BatchSeparator() between them, then BatchFooter().
+inline std::string EncodeBatchHeader(size_t count, WireEncoding encoding) {
+  std::string header;
+  switch (encoding) {
+    case WireEncoding::Cbor: {
+      // map(2) "type": "Batch", "messages": array(count)
+      header.append("\xA2\x64type\x65" "Batch\x68messages", 21);
+      if (count < 24) {
+        header.push_back(static_cast<char>(0x80 + count));
+      } else if (count <= 0xFF) {
+        header.push_back('\x98');
+        header.push_back(static_cast<char>(count));
+      } else if (count <= 0xFFFF) {
+        header.push_back('\x99');
+        header.push_back(static_cast<char>(count >> 8));
+        header.push_back(static_cast<char>(count));
+      } else {
+        header.push_back('\x9A');
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          header.push_back(static_cast<char>(count >> shift));
+        }
+      }
+      break;
+    }
+    case WireEncoding::MessagePack: {
+      // fixmap(2) "type": "Batch", "messages": array(count)
+      header.append("\x82\xA4type\xA5" "Batch\xA8messages", 21);
+      if (count < 16) {
+        header.push_back(static_cast<char>(0x90 + count));
+      } else if (count <= 0xFFFF) {
+        header.push_back('\xDC');
+        header.push_back(static_cast<char>(count >> 8));
+        header.push_back(static_cast<char>(count));
+      } else {
+        header.push_back('\xDD');
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          header.push_back(static_cast<char>(count >> shift));
+        }
+      }
+      break;
+    }
+    case WireEncoding::Json:
+    default:
+      header = "{\"type\":\"Batch\",\"messages\":[";
+      break;
+  }
+  return header;
+}
+
+inline const char* BatchSeparator(WireEncoding encoding) {
+  return encoding == WireEncoding::Json ? "," : "";
+}
+
+inline const char* BatchFooter(WireEncoding encoding) {
+  return encoding == WireEncoding::Json ? "]}" : "";
+}
+
+// Appends one length-prefixed frame to |buffer|.
+inline void AppendFrame(std::vector<uint8_t>& buffer, const std::string& payload) {
+  uint32_t len = static_cast<uint32_t>(payload.size());
+  size_t offset = buffer.size();
+  buffer.resize(offset + 4 + payload.size());
+  memcpy(buffer.data() + offset, &len, 4);
+  if (!payload.empty()) {
+    memcpy(buffer.data() + offset + 4, payload.data(), payload.size());
+  }
+}
+
+// Appends one length-prefixed Batch frame carrying the messages in
+// [first, last), which must all share the same encoding.
+inline void AppendBatchFrame(std::vector<uint8_t>& buffer,
+                             const OutgoingMessage* first,
+                             const OutgoingMessage* last) {
+  WireEncoding encoding = first->encoding;
+  std::string header = EncodeBatchHeader(last - first, encoding);
+  const char* separator = BatchSeparator(encoding);
+  const char* footer = BatchFooter(encoding);
+  size_t separatorLen = strlen(separator);
+  size_t footerLen = strlen(footer);
+
+  size_t payloadLen = header.size() + footerLen;
+  for (const OutgoingMessage* msg = first; msg != last; ++msg) {
+    payloadLen += msg->payload.size() + (msg != first ? separatorLen : 0);
+  }
+
+  uint32_t len = static_cast<uint32_t>(payloadLen);
+  size_t offset = buffer.size();
+  buffer.resize(offset + 4 + payloadLen);
+  uint8_t* out = buffer.data() + offset;
+  memcpy(out, &len, 4);
+  out += 4;
+  memcpy(out, header.data(), header.size());
+  out += header.size();
+  for (const OutgoingMessage* msg = first; msg != last; ++msg) {
+    if (msg != first) {
+      memcpy(out, separator, separatorLen);
+      out += separatorLen;
+    }
+    memcpy(out, msg->payload.data(), msg->payload.size());
+    out += msg->payload.size();
+  }
+  memcpy(out, footer, footerLen);
+}
+
+// Re-encodes a message queued in another encoding than the one its frame
+// goes out in, which only happens to messages queued around an encoding
+// switch. Returns false if the payload does not decode.
+inline bool Transcode(OutgoingMessage& message, WireEncoding encoding) {
+  if (message.encoding == encoding) {
+    return true;
+  }
+  try {
+    message.payload = EncodeMessage(DecodeMessage(message.payload, message.encoding), encoding);
+  } catch (const json::exception&) {
+    return false;
+  }
+  message.encoding = encoding;
+  return true;
+}
+
+// Removes the messages queued for a connection other than |connection| and
+// returns how many there were. That includes everything queued while no
+// client was connected: closing a connection and accepting the next one
+// each move the connection on, so such messages are dropped rather than
+// delivered to whichever client connects next.
+inline size_t DiscardStale(std::vector<OutgoingMessage>& messages, uint64_t connection) {
+  size_t kept = 0;
+  for (OutgoingMessage& message : messages) {
+    if (message.connection != connection) {
+      continue;
+    }
+    if (&message != &messages[kept]) {
+      messages[kept] = std::move(message);
+    }
+    kept++;
+  }
+  size_t discarded = messages.size() - kept;
+  messages.resize(kept);
+  return discarded;
+}
+
+struct FramingCounts {
+  int frames = 0;
+  int batchFrames = 0;
+  int batchedMessages = 0;
+  // Messages that could not be re-encoded, and were dropped.
+  int undecodable = 0;
+};
+
+// Frames |messages| for the client on |connection| and appends them to
+// |buffer|. |state| is what that client expects of the next frame, or is
+// for another connection, in which case the connection is new and starts
+// out in unbatched JSON. Returns the state after the last frame.
+//
+// Every message goes out in the encoding in effect at its position in the
+// stream, re-encoded if it was queued in another one; runs of messages
+// become one Batch frame while batching is on. A message carrying a switch
+// always gets its own frame, and the switch applies from the next one on,
+// so the client reads the InitializeResponse in the old mode and
+// everything after it in the new one, whichever thread queued it and
+// whenever.
+inline WireState FrameOutgoing(std::vector<OutgoingMessage>& messages,
+                               uint64_t connection,
+                               WireState state,
+                               std::vector<uint8_t>& buffer,
+                               FramingCounts& counts) {
+  if (state.connection != connection) {
+    state = WireState{connection};
+  }
+
+  // Bring every message into the encoding of its position first, so runs
+  // are only cut at switches.
+  WireEncoding encoding = state.encoding;
+  size_t kept = 0;
+  for (OutgoingMessage& message : messages) {
+    if (!Transcode(message, encoding)) {
+      counts.undecodable++;
+      continue;
+    }
+    if (message.switchEncoding.has_value()) {
+      encoding = message.switchEncoding.value();
+    }
+    if (&message != &messages[kept]) {
+      messages[kept] = std::move(message);
+    }
+    kept++;
+  }
+  messages.resize(kept);
+
+  OutgoingMessage* end = messages.data() + messages.size();
+  for (OutgoingMessage* run = messages.data(); run != end;) {
+    OutgoingMessage* runEnd = run + 1;
+    if (state.batching && !run->switchEncoding.has_value()) {
+      while (runEnd != end && !runEnd->switchEncoding.has_value()) {
+        ++runEnd;
+      }
+    }
+    if (runEnd - run > 1) {
+      AppendBatchFrame(buffer, run, runEnd);
+      counts.batchFrames++;
+      counts.batchedMessages += static_cast<int>(runEnd - run);
+    } else {
+      AppendFrame(buffer, run->payload);
+    }
+    counts.frames++;
+    if (run->switchEncoding.has_value()) {
+      state.encoding = run->switchEncoding.value();
+      state.batching = run->switchBatching;
+    }
+    run = runEnd;
+  }
+  return state;
+}
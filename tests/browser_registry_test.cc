@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "browser_registry.hpp"
+#include "test.h"
+
+// The registry only stores the references, so these tests register null
+// browsers and check the bookkeeping around them.
+
+TEST(BrowserRegistryTracksIds) {
+  BrowserRegistry registry;
+  registry.Add(3, nullptr);
+  registry.Add(1, nullptr);
+  registry.Add(2, nullptr);
+  std::vector<int> ids = registry.Ids();
+  std::sort(ids.begin(), ids.end());
+  CHECK((ids == std::vector<int>{1, 2, 3}));
+
+  CHECK(registry.Remove(2));
+  CHECK(!registry.Remove(2));
+  CHECK(!registry.Remove(42));
+  CHECK(!registry.Get(42));
+
+  json metrics = registry.CollectMetrics();
+  CHECK_EQ(metrics["live"].get<int>(), 2);
+  CHECK_EQ(metrics["created"].get<int>(), 3);
+  CHECK_EQ(metrics["closed"].get<int>(), 1);
+}
+
+// Browsers come and go on one thread while several others look them up, as
+// the UI thread and the dispatch workers do.
+TEST(BrowserRegistryHandlesConcurrentChurn) {
+  const int kCycles = 10000;
+  const int kReaders = 4;
+  BrowserRegistry registry;
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> lookups{0};
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaders; r++) {
+    readers.emplace_back([&registry, &done, &lookups, r] {
+      uint64_t count = 0;
+      for (int id = r; !done.load(); id = (id + 7) % 64) {
+        registry.Get(id);
+        if (id == 0) {
+          registry.Ids();
+        }
+        count++;
+      }
+      lookups += count;
+    });
+  }
+
+  for (int cycle = 0; cycle < kCycles; cycle++) {
+    int id = cycle % 64;
+    registry.Add(id, nullptr);
+    if (cycle >= 32) {
+      CHECK(registry.Remove((cycle - 32) % 64));
+    }
+  }
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+
+  CHECK(lookups.load() > 0);
+  json metrics = registry.CollectMetrics();
+  CHECK_EQ(metrics["live"].get<int>(), 32);
+  CHECK_EQ(metrics["created"].get<int>(), kCycles);
+  CHECK_EQ(metrics["closed"].get<int>(), kCycles - 32);
+}
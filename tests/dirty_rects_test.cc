@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "dirty_rects.hpp"
+#include "test.h"
+
+namespace {
+
+bool SameRect(const CefRect& a, const CefRect& b) {
+  return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+bool Contains(const CefRect& outer, const CefRect& inner) {
+  return SameRect(dirty_rects::Intersection(outer, inner), inner);
+}
+
+bool Covered(const std::vector<CefRect>& rects, const CefRect& rect) {
+  for (const CefRect& candidate : rects) {
+    if (Contains(candidate, rect)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether every pixel of |inputs| inside |bounds| is covered by |outputs|.
+bool CoversDamage(const std::vector<CefRect>& outputs,
+                  const std::vector<CefRect>& inputs,
+                  const CefRect& bounds) {
+  for (const CefRect& input : inputs) {
+    CefRect clipped = dirty_rects::Intersection(input, bounds);
+    for (int y = clipped.y; y < clipped.y + clipped.height; y++) {
+      for (int x = clipped.x; x < clipped.x + clipped.width; x++) {
+        if (!Covered(outputs, CefRect(x, y, 1, 1))) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool AnyOverlap(const std::vector<CefRect>& rects) {
+  for (size_t i = 0; i < rects.size(); i++) {
+    for (size_t j = i + 1; j < rects.size(); j++) {
+      if (dirty_rects::Overlaps(rects[i], rects[j])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST(DirtyRectsClipsAndDropsEmpty) {
+  CefRect bounds(0, 0, 100, 100);
+  std::vector<CefRect> out = SimplifyDirtyRects(
+      {CefRect(-10, -10, 20, 20), CefRect(50, 50, 0, 10), CefRect(200, 0, 5, 5)}, bounds, 8);
+  CHECK_EQ(out.size(), 1u);
+  CHECK(SameRect(out[0], CefRect(0, 0, 10, 10)));
+  CHECK(SimplifyDirtyRects({}, bounds, 8).empty());
+}
+
+TEST(DirtyRectsMergesOverlapping) {
+  std::vector<CefRect> out = SimplifyDirtyRects(
+      {CefRect(0, 0, 10, 10), CefRect(5, 5, 10, 10), CefRect(50, 50, 5, 5)}, CefRect(), 8);
+  CHECK_EQ(out.size(), 2u);
+  CHECK(Covered(out, CefRect(0, 0, 15, 15)));
+  CHECK(Covered(out, CefRect(50, 50, 5, 5)));
+}
+
+TEST(DirtyRectsMergesCheapestPairFirst) {
+  // The two close rects cost little to merge; the far one stays separate.
+  std::vector<CefRect> out = SimplifyDirtyRects(
+      {CefRect(0, 0, 10, 10), CefRect(11, 0, 10, 10), CefRect(500, 500, 10, 10)},
+      CefRect(), 2);
+  CHECK_EQ(out.size(), 2u);
+  CHECK(Covered(out, CefRect(0, 0, 21, 10)));
+  CHECK(Covered(out, CefRect(500, 500, 10, 10)));
+}
+
+TEST(DirtyRectsCollapsesLargeListsToBoundingBox) {
+  std::vector<CefRect> rects;
+  for (int i = 0; i < 100; i++) {
+    rects.push_back(CefRect(i * 3, i * 2, 2, 2));
+  }
+  std::vector<CefRect> out = SimplifyDirtyRects(rects, CefRect(), 8);
+  CHECK_EQ(out.size(), 1u);
+  CHECK(SameRect(out[0], CefRect(0, 0, 99 * 3 + 2, 99 * 2 + 2)));
+}
+
+// Random damage: the result stays within the limit, never overlaps and
+// still covers every damaged pixel.
+TEST(DirtyRectsRandomDamageStaysCovered) {
+  std::mt19937 random(42);
+  CefRect bounds(0, 0, 120, 80);
+  for (int round = 0; round < 300; round++) {
+    std::vector<CefRect> rects;
+    int count = 1 + random() % 20;
+    for (int i = 0; i < count; i++) {
+      rects.push_back(CefRect(static_cast<int>(random() % 140) - 10,
+                              static_cast<int>(random() % 100) - 10,
+                              static_cast<int>(random() % 30),
+                              static_cast<int>(random() % 30)));
+    }
+    size_t maxRects = 1 + random() % 6;
+    std::vector<CefRect> out = SimplifyDirtyRects(rects, bounds, maxRects);
+    CHECK(out.size() <= maxRects);
+    CHECK(!AnyOverlap(out));
+    CHECK(CoversDamage(out, rects, bounds));
+    for (const CefRect& rect : out) {
+      CHECK(Contains(bounds, rect));
+    }
+  }
+}
+
+TEST(TileHashGridDropsUnchangedTiles) {
+  const int width = 200;
+  const int height = 130;
+  const size_t stride = width * 4;
+  std::vector<uint8_t> pixels(stride * height, 7);
+  std::vector<CefRect> full = {CefRect(0, 0, width, height)};
+  TileHashGrid grid;
+  uint64_t unchanged = 0;
+
+  // Everything is new the first time.
+  std::vector<CefRect> out = grid.Filter(pixels.data(), stride, width, height, full, 8, unchanged);
+  CHECK(CoversDamage(out, full, full[0]));
+  CHECK_EQ(unchanged, 0u);
+  grid.Commit();
+
+  // Repainting identical content reports nothing.
+  out = grid.Filter(pixels.data(), stride, width, height, full, 8, unchanged);
+  CHECK(out.empty());
+  CHECK_EQ(unchanged, 12u);
+
+  // Only the tile holding the changed pixel is left, clipped to the damage.
+  pixels[static_cast<size_t>(70) * stride + 130 * 4] = 9;
+  unchanged = 0;
+  out = grid.Filter(pixels.data(), stride, width, height, {CefRect(100, 60, 100, 70)}, 8,
+                    unchanged);
+  CHECK_EQ(out.size(), 1u);
+  CHECK(SameRect(out[0], CefRect(128, 64, 64, 64)));
+
+  // Without a Commit() the change is reported again.
+  out = grid.Filter(pixels.data(), stride, width, height, full, 8, unchanged);
+  CHECK_EQ(out.size(), 1u);
+  grid.Commit();
+  out = grid.Filter(pixels.data(), stride, width, height, full, 8, unchanged);
+  CHECK(out.empty());
+}
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "frame_reader.hpp"
+#include "test.h"
+
+namespace {
+
+std::string MakePayload(size_t size, char seed) {
+  std::string payload(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    payload[i] = static_cast<char>(seed + i * 31);
+  }
+  return payload;
+}
+
+void AppendFrame(std::string& wire, const std::string& payload) {
+  uint32_t length = static_cast<uint32_t>(payload.size());
+  wire.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  wire.append(payload);
+}
+
+// Feeds |wire| to |reader| in reads of at most |chunk| bytes (as a socket
+// would), collecting every frame that becomes complete.
+std::vector<std::string> Feed(FrameReader& reader, const std::string& wire, size_t chunk) {
+  std::vector<std::string> frames;
+  std::string_view frame;
+  size_t offset = 0;
+  while (offset < wire.size()) {
+    size_t bytes = std::min({chunk, reader.WritableSize(), wire.size() - offset});
+    memcpy(reader.WritePtr(), wire.data() + offset, bytes);
+    reader.Commit(bytes);
+    offset += bytes;
+    while (reader.Next(frame) == FrameReader::Status::Frame) {
+      frames.emplace_back(frame);
+    }
+  }
+  return frames;
+}
+
+double NsPerFrame(std::chrono::steady_clock::duration elapsed, size_t frames) {
+  return std::chrono::duration<double, std::nano>(elapsed).count() / frames;
+}
+
+}  // namespace
+
+TEST(FrameReaderReassemblesByteSizedReads) {
+  std::vector<std::string> payloads = {MakePayload(1, 'a'), MakePayload(0, 'b'),
+                                       MakePayload(300, 'c'), MakePayload(70000, 'd')};
+  std::string wire;
+  for (const std::string& payload : payloads) {
+    AppendFrame(wire, payload);
+  }
+  FrameReader reader(64);
+  CHECK(Feed(reader, wire, 1) == payloads);
+  CHECK_EQ(reader.BufferedSize(), 0u);
+}
+
+TEST(FrameReaderSplitsCoalescedReads) {
+  std::vector<std::string> payloads;
+  std::string wire;
+  for (int i = 0; i < 1000; i++) {
+    payloads.push_back(MakePayload(i % 97, static_cast<char>(i)));
+    AppendFrame(wire, payloads.back());
+  }
+  FrameReader reader;
+  CHECK(Feed(reader, wire, wire.size()) == payloads);
+  CHECK_EQ(reader.BufferedSize(), 0u);
+}
+
+TEST(FrameReaderHandlesRandomSplitPoints) {
+  std::mt19937 random(1234);
+  std::vector<std::string> payloads;
+  std::string wire;
+  for (int i = 0; i < 500; i++) {
+    payloads.push_back(MakePayload(random() % 5000, static_cast<char>(i)));
+    AppendFrame(wire, payloads.back());
+  }
+  FrameReader reader(256);
+  std::vector<std::string> frames;
+  std::string_view frame;
+  size_t offset = 0;
+  while (offset < wire.size()) {
+    size_t bytes = std::min<size_t>({1 + random() % 9000, reader.WritableSize(),
+                                     wire.size() - offset});
+    memcpy(reader.WritePtr(), wire.data() + offset, bytes);
+    reader.Commit(bytes);
+    offset += bytes;
+    while (reader.Next(frame) == FrameReader::Status::Frame) {
+      frames.emplace_back(frame);
+    }
+  }
+  CHECK(frames == payloads);
+}
+
+TEST(FrameReaderKeepsPartialFrameUntilComplete) {
+  std::string wire;
+  AppendFrame(wire, MakePayload(100, 'x'));
+  FrameReader reader;
+  std::string_view frame;
+  memcpy(reader.WritePtr(), wire.data(), 50);
+  reader.Commit(50);
+  CHECK(reader.Next(frame) == FrameReader::Status::NeedMore);
+  CHECK_EQ(reader.BufferedSize(), 50u);
+  memcpy(reader.WritePtr(), wire.data() + 50, wire.size() - 50);
+  reader.Commit(wire.size() - 50);
+  CHECK(reader.Next(frame) == FrameReader::Status::Frame);
+  CHECK(frame == MakePayload(100, 'x'));
+  CHECK(reader.Next(frame) == FrameReader::Status::NeedMore);
+}
+
+// A frame's view survives until the next call, even when the frame was
+// large enough that the buffer is given back once it has been consumed.
+TEST(FrameReaderViewOutlivesConsumedFrame) {
+  std::string payload = MakePayload(1 << 20, 'v');
+  std::string wire;
+  AppendFrame(wire, payload);
+  AppendFrame(wire, MakePayload(3, 'w'));
+  FrameReader reader(64);
+  size_t offset = 0;
+  while (offset < wire.size()) {
+    size_t bytes = std::min(reader.WritableSize(), wire.size() - offset);
+    memcpy(reader.WritePtr(), wire.data() + offset, bytes);
+    reader.Commit(bytes);
+    offset += bytes;
+  }
+  std::string_view frame;
+  CHECK(reader.Next(frame) == FrameReader::Status::Frame);
+  CHECK(frame == payload);
+  CHECK(reader.Next(frame) == FrameReader::Status::Frame);
+  CHECK(frame == MakePayload(3, 'w'));
+  CHECK(reader.Next(frame) == FrameReader::Status::NeedMore);
+  CHECK_EQ(reader.BufferedSize(), 0u);
+}
+
+TEST(FrameReaderRejectsOversizedFrames) {
+  FrameReader reader;
+  uint32_t length = FrameReader::kMaxFrameSize + 1;
+  memcpy(reader.WritePtr(), &length, sizeof(length));
+  reader.Commit(sizeof(length));
+  std::string_view frame;
+  CHECK(reader.Next(frame) == FrameReader::Status::Oversized);
+}
+
+TEST(FrameReaderResetDropsBufferedBytes) {
+  std::string wire;
+  AppendFrame(wire, MakePayload(10, 'r'));
+  FrameReader reader;
+  memcpy(reader.WritePtr(), wire.data(), 7);
+  reader.Commit(7);
+  reader.Reset();
+  CHECK_EQ(reader.BufferedSize(), 0u);
+  CHECK(Feed(reader, wire, wire.size()) == std::vector<std::string>{MakePayload(10, 'r')});
+}
+
+// Not a pass/fail check: reports the cost per frame of the two pathological
+// read patterns, one byte per read and every frame in a single read.
+TEST(FrameReaderPathologicalReadTiming) {
+  std::string wire;
+  const size_t frameCount = 20000;
+  for (size_t i = 0; i < frameCount; i++) {
+    AppendFrame(wire, MakePayload(64, static_cast<char>(i)));
+  }
+  for (size_t chunk : {size_t(1), wire.size()}) {
+    FrameReader reader;
+    auto start = std::chrono::steady_clock::now();
+    size_t frames = Feed(reader, wire, chunk).size();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK_EQ(frames, frameCount);
+    printf("  %s reads: %.0f ns/frame\n", chunk == 1 ? "1-byte" : "coalesced",
+           NsPerFrame(elapsed, frameCount));
+  }
+}
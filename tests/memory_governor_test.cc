@@ -0,0 +1,91 @@
+#include <vector>
+
+#include "memory_governor.hpp"
+#include "test.h"
+
+namespace {
+
+const uint64_t kMiB = 1024 * 1024;
+
+MemoryGovernor::SavedPage Page(const char* url, int scrollY = 0) {
+  MemoryGovernor::SavedPage page;
+  page.url = url;
+  page.scrollY = scrollY;
+  return page;
+}
+
+}  // namespace
+
+TEST(MemoryGovernorDisabledWithoutBudget) {
+  MemoryGovernor governor;
+  governor.Track(1, 0);
+  governor.SetVisible(1, false, 10);
+  governor.RecordSample(1, 100, 900 * kMiB, Page("https://a"));
+  CHECK(governor.SelectVictims().empty());
+}
+
+// Hidden browsers are hibernated least recently visible first, and only
+// until the estimate fits the budget.
+TEST(MemoryGovernorHibernatesLeastRecentlyVisible) {
+  MemoryGovernor governor;
+  governor.Configure(250 * kMiB);
+  for (int id = 1; id <= 4; id++) {
+    governor.Track(id, 0);
+    governor.RecordSample(id, 100 + id, 100 * kMiB, Page("https://page", id));
+  }
+  // 3 is hidden first, then 1; 2 stays visible; 4 has never been hidden.
+  governor.SetVisible(3, false, 10);
+  governor.SetVisible(1, false, 20);
+  governor.SetVisible(2, true, 30);
+
+  std::vector<int> victims = governor.SelectVictims();
+  CHECK((victims == std::vector<int>{3, 1}));
+
+  std::optional<MemoryGovernor::SavedPage> page = governor.Hibernate(3);
+  CHECK(page.has_value() && page->url == "https://page" && page->scrollY == 3);
+  CHECK(governor.IsHibernated(3));
+  CHECK(!governor.Hibernate(3).has_value());
+  // Hibernated browsers no longer count, so one more is enough.
+  CHECK((governor.SelectVictims() == std::vector<int>{1}));
+
+  page = governor.Wake(3);
+  CHECK(page.has_value() && page->scrollY == 3);
+  CHECK(!governor.IsHibernated(3));
+  CHECK(!governor.Wake(3).has_value());
+
+  json metrics = governor.CollectMetrics();
+  CHECK_EQ(metrics["hibernations"].get<int>(), 1);
+  CHECK_EQ(metrics["restores"].get<int>(), 1);
+  CHECK_EQ(metrics["estimatedBytesReclaimed"].get<uint64_t>(), 100 * kMiB);
+}
+
+// Browsers in one renderer process are each charged an equal share.
+TEST(MemoryGovernorSplitsSharedProcesses) {
+  MemoryGovernor governor;
+  governor.Configure(100 * kMiB);
+  for (int id = 1; id <= 3; id++) {
+    governor.Track(id, 0);
+    governor.RecordSample(id, 7, 300 * kMiB, Page("https://shared"));
+  }
+  CHECK_EQ(governor.CollectMetrics()["estimatedBytes"].get<uint64_t>(), 300 * kMiB);
+  governor.SetVisible(1, false, 10);
+  governor.SetVisible(2, false, 20);
+  CHECK((governor.SelectVictims() == std::vector<int>{1, 2}));
+
+  // The process's memory is forgotten with its last browser.
+  governor.Forget(1);
+  governor.Forget(2);
+  CHECK_EQ(governor.CollectMetrics()["estimatedBytes"].get<uint64_t>(), 300 * kMiB);
+  governor.Forget(3);
+  CHECK_EQ(governor.CollectMetrics()["estimatedBytes"].get<uint64_t>(), 0u);
+}
+
+TEST(MemoryGovernorSkipsPagesWithoutSamples) {
+  MemoryGovernor governor;
+  governor.Configure(1);
+  governor.Track(1, 0);
+  governor.SetVisible(1, false, 10);
+  CHECK(governor.SelectVictims().empty());
+  CHECK(!governor.SetVisible(2, false, 10));
+  CHECK(governor.IsVisible(2));
+}
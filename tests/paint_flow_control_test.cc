@@ -0,0 +1,69 @@
+#include "paint_flow_control.hpp"
+#include "test.h"
+
+namespace {
+
+const Uint64 kTimeoutNs = 100;
+
+UUID MakeId(unsigned long n) {
+  UUID id = {};
+  id.Data1 = n;
+  return id;
+}
+
+}  // namespace
+
+TEST(PaintFlowControlDropsBeyondWindow) {
+  PaintFlowControl flowControl;
+  flowControl.Configure(2, kTimeoutNs);
+  CHECK(flowControl.TryBegin(1, MakeId(1), 0) == PaintFlowControl::Admission::Send);
+  CHECK(flowControl.TryBegin(1, MakeId(2), 0) == PaintFlowControl::Admission::Send);
+  CHECK(flowControl.TryBegin(1, MakeId(3), 0) == PaintFlowControl::Admission::DropFirst);
+  CHECK(flowControl.TryBegin(1, MakeId(4), 0) == PaintFlowControl::Admission::Drop);
+  // Another browser has its own window.
+  CHECK(flowControl.TryBegin(2, MakeId(5), 0) == PaintFlowControl::Admission::Send);
+
+  // Acknowledged out of order; the first one owes the repaint.
+  bool repaint = false;
+  CHECK(flowControl.Complete(MakeId(2), 10, repaint) == 1);
+  CHECK(repaint);
+  CHECK(flowControl.Complete(MakeId(1), 10, repaint) == 1);
+  CHECK(!repaint);
+  CHECK(!flowControl.Complete(MakeId(1), 10, repaint).has_value());
+  CHECK(!flowControl.Complete(MakeId(99), 10, repaint).has_value());
+}
+
+// A timed-out frame leaves the window, but its late acknowledgement still
+// names the browser so the frame's ring slot can be freed.
+TEST(PaintFlowControlReportsLateAcknowledgements) {
+  PaintFlowControl flowControl;
+  flowControl.Configure(1, kTimeoutNs);
+  CHECK(flowControl.TryBegin(1, MakeId(1), 0) == PaintFlowControl::Admission::Send);
+  CHECK(flowControl.TryBegin(1, MakeId(2), kTimeoutNs) == PaintFlowControl::Admission::Send);
+
+  bool repaint = false;
+  CHECK(flowControl.Complete(MakeId(1), kTimeoutNs + 1, repaint) == 1);
+  CHECK(flowControl.Complete(MakeId(2), kTimeoutNs + 1, repaint) == 1);
+  json metrics = flowControl.CollectMetrics();
+  CHECK_EQ(metrics["timedOut"].get<int>(), 1);
+  CHECK_EQ(metrics["lateAcked"].get<int>(), 1);
+  CHECK_EQ(metrics["acked"].get<int>(), 1);
+}
+
+TEST(PaintFlowControlForgetsOldExpiredFrames) {
+  PaintFlowControl flowControl;
+  flowControl.Configure(1, kTimeoutNs);
+  const unsigned long kFrames = PaintFlowControl::kMaxExpiredFrames + 10;
+  for (unsigned long n = 1; n <= kFrames; n++) {
+    CHECK(flowControl.TryBegin(1, MakeId(n), n * kTimeoutNs) ==
+          PaintFlowControl::Admission::Send);
+  }
+  bool repaint = false;
+  // The oldest are forgotten; the rest are still known.
+  CHECK(!flowControl.Complete(MakeId(1), kFrames * kTimeoutNs, repaint).has_value());
+  CHECK(flowControl.Complete(MakeId(kFrames - 1), kFrames * kTimeoutNs, repaint) == 1);
+
+  flowControl.RemoveBrowser(1);
+  CHECK(!flowControl.Complete(MakeId(kFrames - 2), kFrames * kTimeoutNs, repaint).has_value());
+  CHECK(!flowControl.Complete(MakeId(kFrames), kFrames * kTimeoutNs, repaint).has_value());
+}
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "response_table.hpp"
+#include "test.h"
+
+namespace {
+
+UUID MakeId(unsigned long n) {
+  UUID id = {};
+  id.Data1 = n;
+  id.Data4[7] = static_cast<unsigned char>(n * 31);
+  return id;
+}
+
+// Runs |threads| waiters, each making |roundTrips| blocking requests that a
+// single responder thread answers, as the reader thread answers the UI
+// thread. Returns the number of responses that did not match their request.
+int RunRoundTrips(ResponseTable& table, int threads, int roundTrips) {
+  std::atomic<bool> done{false};
+  std::vector<std::atomic<unsigned long>> outstanding(threads);
+  std::thread responder([&] {
+    while (!done.load()) {
+      for (int t = 0; t < threads; t++) {
+        unsigned long n = outstanding[t].exchange(0);
+        if (n != 0) {
+          table.Complete(MakeId(n), json{{"n", n}});
+        }
+      }
+    }
+  });
+
+  std::atomic<int> mismatched{0};
+  std::vector<std::thread> waiters;
+  for (int t = 0; t < threads; t++) {
+    waiters.emplace_back([&, t] {
+      for (int i = 1; i <= roundTrips; i++) {
+        unsigned long n = static_cast<unsigned long>(t) * roundTrips + i;
+        table.Expect(MakeId(n));
+        outstanding[t] = n;
+        std::optional<json> response = table.Wait(MakeId(n), 5000);
+        if (!response || (*response)["n"] != n) {
+          mismatched++;
+        }
+      }
+    });
+  }
+  for (std::thread& waiter : waiters) {
+    waiter.join();
+  }
+  done = true;
+  responder.join();
+  return mismatched.load();
+}
+
+}  // namespace
+
+TEST(ResponseTableDeliversToWaiter) {
+  ResponseTable table;
+  UUID id = MakeId(1);
+  table.Expect(id);
+  CHECK(table.Complete(id, json{{"ok", true}}));
+  std::optional<json> response = table.Wait(id, 1000);
+  CHECK(response.has_value() && (*response)["ok"] == true);
+  // The id is forgotten once collected.
+  CHECK(!table.Complete(id, json{}));
+  CHECK(!table.Wait(id, 0).has_value());
+}
+
+TEST(ResponseTableTimesOutAndCancels) {
+  ResponseTable table;
+  UUID id = MakeId(2);
+  table.Expect(id);
+  CHECK(!table.Wait(id, 10).has_value());
+
+  table.Expect(MakeId(3));
+  CHECK(table.Cancel(MakeId(3)));
+  CHECK(!table.Cancel(MakeId(3)));
+  CHECK(!table.Wait(MakeId(3), 1000).has_value());
+  // A late response to a request nobody waits for any more.
+  CHECK(!table.Complete(id, json{}));
+
+  json metrics = table.CollectMetrics();
+  CHECK_EQ(metrics["timeouts"].get<int>(), 1);
+  CHECK_EQ(metrics["cancelled"].get<int>(), 1);
+  CHECK_EQ(metrics["unmatched"].get<int>(), 1);
+  CHECK_EQ(metrics["pending"].get<int>(), 0);
+}
+
+// Every concurrent waiter gets its own response, and the slot pool is
+// bounded by the requests in flight rather than the number made.
+TEST(ResponseTableConcurrentRoundTrips) {
+  const int kThreads = 8;
+  const int kRoundTrips = 2000;
+  ResponseTable table;
+  CHECK_EQ(RunRoundTrips(table, kThreads, kRoundTrips), 0);
+  json metrics = table.CollectMetrics();
+  CHECK_EQ(metrics["completed"].get<int>(), kThreads * kRoundTrips);
+  CHECK(metrics["pooledSlots"].get<size_t>() <= kThreads * ResponseTable::kShardCount);
+  CHECK_EQ(metrics["pending"].get<int>(), 0);
+}
+
+// Not a pass/fail check: reports the cost of a round trip as the number of
+// concurrent waiters grows.
+TEST(ResponseTableContention) {
+  for (int threads : {1, 8, 32, 64}) {
+    const int roundTrips = 20000 / threads;
+    ResponseTable table;
+    auto start = std::chrono::steady_clock::now();
+    CHECK_EQ(RunRoundTrips(table, threads, roundTrips), 0);
+    double elapsedUs =
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+            .count();
+    printf("  %d waiters: %.1f us/round trip, %d pooled slots\n", threads,
+           elapsedUs / (threads * roundTrips),
+           table.CollectMetrics()["pooledSlots"].get<int>());
+  }
+}
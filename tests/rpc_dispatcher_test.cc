@@ -0,0 +1,396 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "rpc_dispatcher.hpp"
+#include "test.h"
+
+namespace {
+
+struct OrderedMessage {
+  static constexpr const char* kType = "OrderedMessage";
+  int browserId = 0;
+  int sequence = 0;
+};
+
+inline void from_json(const json& j, OrderedMessage& m) {
+  j.at("browserId").get_to(m.browserId);
+  j.at("sequence").get_to(m.sequence);
+}
+
+struct MoveMessage {
+  static constexpr const char* kType = "MoveMessage";
+  int browserId = 0;
+  int x = 0;
+  int count = 1;
+};
+
+inline void from_json(const json& j, MoveMessage& m) {
+  j.at("browserId").get_to(m.browserId);
+  j.at("x").get_to(m.x);
+}
+
+json Ordered(int browserId, int sequence) {
+  return {{"type", OrderedMessage::kType}, {"browserId", browserId}, {"sequence", sequence}};
+}
+
+json Move(int browserId, int x) {
+  return {{"type", MoveMessage::kType}, {"browserId", browserId}, {"x", x}};
+}
+
+// Waits until |done| returns true or five seconds pass.
+template <typename Done>
+bool WaitFor(Done done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+// Per-browser record of the handled sequence numbers. Each browser is only
+// touched by the worker that owns it.
+struct OrderLog {
+  explicit OrderLog(int browsers) : next(browsers), outOfOrder(browsers) {}
+
+  void Record(const OrderedMessage& message) {
+    if (message.sequence != next[message.browserId]) {
+      outOfOrder[message.browserId]++;
+    }
+    next[message.browserId] = message.sequence + 1;
+    handled++;
+  }
+
+  std::vector<int> next;
+  std::vector<int> outOfOrder;
+  std::atomic<int> handled{0};
+};
+
+// The dispatch workers never exit, so dispatchers (and whatever their
+// handlers capture) are kept alive until the process ends.
+RpcDispatcher* NewDispatcher() {
+  static std::vector<RpcDispatcher*>* dispatchers = new std::vector<RpcDispatcher*>();
+  dispatchers->push_back(new RpcDispatcher());
+  return dispatchers->back();
+}
+
+}  // namespace
+
+// Several threads dispatch interleaved traffic for many browsers. Every
+// browser's messages must be handled exactly once and in order, and the
+// browsers must be spread across all workers.
+TEST(RpcDispatcherKeepsPerBrowserOrderUnderLoad) {
+  const int kBrowsers = 64;
+  const int kMessagesPerBrowser = 2000;
+  const int kProducers = 4;
+  const int kWorkers = 8;
+
+  OrderLog* log = new OrderLog(kBrowsers);
+  RpcDispatcher* dispatcher = NewDispatcher();
+  dispatcher->Register<OrderedMessage>(
+      [log](const OrderedMessage& message) { log->Record(message); }, RpcLane::Browser);
+  dispatcher->Start(kWorkers);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> producers;
+  std::atomic<int> rejected{0};
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([dispatcher, p, &rejected] {
+      // Each producer owns the browsers congruent to it, so the order it
+      // dispatches in is the order they must be handled in.
+      for (int sequence = 0; sequence < kMessagesPerBrowser; sequence++) {
+        for (int browserId = p; browserId < kBrowsers; browserId += kProducers) {
+          if (!dispatcher->Dispatch(Ordered(browserId, sequence))) {
+            rejected++;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  const int total = kBrowsers * kMessagesPerBrowser;
+  CHECK(WaitFor([log, total] { return log->handled.load() == total; }));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  CHECK_EQ(rejected.load(), 0);
+  CHECK_EQ(log->handled.load(), total);
+  for (int browserId = 0; browserId < kBrowsers; browserId++) {
+    CHECK_EQ(log->outOfOrder[browserId], 0);
+    CHECK_EQ(log->next[browserId], kMessagesPerBrowser);
+  }
+
+  // Workers count a group of messages after handling all of it.
+  auto dispatchedCounts = [dispatcher] {
+    std::vector<uint64_t> counts;
+    json metrics = dispatcher->CollectMetrics();
+    for (const json& count : metrics["dispatched"]) {
+      counts.push_back(count.get<uint64_t>());
+    }
+    return counts;
+  };
+  CHECK(WaitFor([&] {
+    uint64_t dispatched = 0;
+    for (uint64_t count : dispatchedCounts()) {
+      dispatched += count;
+    }
+    return dispatched == static_cast<uint64_t>(total);
+  }));
+  std::vector<uint64_t> counts = dispatchedCounts();
+  CHECK_EQ(counts.size(), static_cast<size_t>(kWorkers));
+  for (uint64_t count : counts) {
+    CHECK(count > 0);
+  }
+  printf("  %d messages over %d workers: %.0f ns/message\n", total, kWorkers,
+         std::chrono::duration<double, std::nano>(elapsed).count() / total);
+}
+
+TEST(RpcDispatcherRunsConnectionLaneInline) {
+  RpcDispatcher* dispatcher = NewDispatcher();
+  std::thread::id handledOn;
+  dispatcher->Register<OrderedMessage>(
+      [&handledOn](const OrderedMessage&) { handledOn = std::this_thread::get_id(); });
+  dispatcher->Start(2);
+  CHECK(dispatcher->Dispatch(Ordered(1, 0)));
+  CHECK(handledOn == std::this_thread::get_id());
+}
+
+TEST(RpcDispatcherRejectsMalformedMessages) {
+  RpcDispatcher* dispatcher = NewDispatcher();
+  int handled = 0;
+  dispatcher->Register<OrderedMessage>([&handled](const OrderedMessage&) { handled++; });
+  dispatcher->RegisterRaw(
+      "Throws", [](const json&) { throw std::runtime_error("handler failed"); });
+  dispatcher->Start(1);
+
+  CHECK(!dispatcher->Dispatch(json{{"browserId", 1}}));
+  CHECK(!dispatcher->Dispatch(json{{"type", 5}}));
+  CHECK(!dispatcher->Dispatch(json{{"type", "Unknown"}}));
+  // Decoding and handler failures are contained.
+  CHECK(!dispatcher->Dispatch(json{{"type", OrderedMessage::kType}, {"browserId", 1}}));
+  CHECK(!dispatcher->Dispatch(json{{"type", "Throws"}}));
+  CHECK(dispatcher->Dispatch(Ordered(1, 0)));
+  CHECK_EQ(handled, 1);
+}
+
+// Browser-lane messages need a browser to pick a worker.
+TEST(RpcDispatcherRejectsBrowserLaneWithoutBrowser) {
+  RpcDispatcher* dispatcher = NewDispatcher();
+  dispatcher->Register<MoveMessage>([](const MoveMessage&) {}, RpcLane::Browser);
+  dispatcher->Start(1);
+  CHECK(!dispatcher->Dispatch(json{{"type", MoveMessage::kType}, {"x", 1}}));
+  CHECK(!dispatcher->Dispatch(json{{"type", MoveMessage::kType}, {"browserId", "1"}, {"x", 1}}));
+}
+
+// Messages dispatched still encoded are decoded on the workers, in order
+// per browser; connection-lane messages are still decoded and handled
+// inline, and any-lane messages go to the workers.
+TEST(RpcDispatcherDecodesEncodedMessagesOnWorkers) {
+  const int kBrowsers = 8;
+  for (WireEncoding encoding :
+       {WireEncoding::Json, WireEncoding::Cbor, WireEncoding::MessagePack}) {
+    struct Log {
+      explicit Log(int browsers) : order(browsers) {}
+      OrderLog order;
+      std::atomic<int> onCaller{0};
+      std::atomic<int> any{0};
+      std::atomic<int> connection{0};
+    };
+    Log* log = new Log(kBrowsers);
+    std::thread::id caller = std::this_thread::get_id();
+    RpcDispatcher* dispatcher = NewDispatcher();
+    dispatcher->Register<OrderedMessage>(
+        [log, caller](const OrderedMessage& message) {
+          log->order.Record(message);
+          if (std::this_thread::get_id() == caller) {
+            log->onCaller++;
+          }
+        },
+        RpcLane::Browser);
+    dispatcher->RegisterRaw(
+        "AnyMessage",
+        [log, caller](const json&) {
+          if (std::this_thread::get_id() != caller) {
+            log->any++;
+          }
+        },
+        RpcLane::Any);
+    dispatcher->RegisterRaw("ConnectionMessage", [log, caller](const json&) {
+      if (std::this_thread::get_id() == caller) {
+        log->connection++;
+      }
+    });
+    dispatcher->Start(3);
+
+    for (int sequence = 0; sequence < 200; sequence++) {
+      for (int browserId = 0; browserId < kBrowsers; browserId++) {
+        CHECK(dispatcher->DispatchEncoded(
+            EncodeMessage(Ordered(browserId, sequence), encoding), encoding));
+      }
+      CHECK(dispatcher->DispatchEncoded(EncodeMessage({{"type", "AnyMessage"}}, encoding),
+                                        encoding));
+    }
+    CHECK(dispatcher->DispatchEncoded(EncodeMessage({{"type", "ConnectionMessage"}}, encoding),
+                                      encoding));
+    CHECK_EQ(log->connection.load(), 1);
+
+    CHECK(WaitFor([log] { return log->order.handled.load() == 200 * kBrowsers; }));
+    CHECK(WaitFor([log] { return log->any.load() == 200; }));
+    CHECK_EQ(log->onCaller.load(), 0);
+    for (int browserId = 0; browserId < kBrowsers; browserId++) {
+      CHECK_EQ(log->order.outOfOrder[browserId], 0);
+    }
+
+    // Refused like their decoded counterparts.
+    CHECK(!dispatcher->DispatchEncoded(std::string("\xFF"), encoding));
+    CHECK(!dispatcher->DispatchEncoded(
+        EncodeMessage({{"type", OrderedMessage::kType}, {"sequence", 1}}, encoding), encoding));
+    CHECK(!dispatcher->DispatchEncoded(EncodeMessage({{"type", "Unknown"}}, encoding),
+                                       encoding));
+  }
+}
+
+// Not a pass/fail check: reports throughput for 64 browsers sending
+// eval-sized messages through one reader thread, decoding everything on
+// the reader before dispatch (as the runner did) against only peeking at
+// the envelope there and decoding on the workers. The reader's share is
+// what limits scaling with more workers.
+TEST(RpcDispatcherEncodedDispatchScaling) {
+  const int kBrowsers = 64;
+  const int kMessagesPerBrowser = 200;
+  const int total = kBrowsers * kMessagesPerBrowser;
+  std::vector<std::string> payloads;
+  for (int sequence = 0; sequence < kMessagesPerBrowser; sequence++) {
+    for (int browserId = 0; browserId < kBrowsers; browserId++) {
+      json message = Ordered(browserId, sequence);
+      message["id"] = "0d9c8b7a-6f5e-4d3c-2b1a-09f8e7d6c5b4";
+      message["script"] = std::string(1024, 'x');
+      payloads.push_back(EncodeMessage(message, WireEncoding::Json));
+    }
+  }
+
+  // The reader's own work per message, without any workers competing for
+  // the cores; its inverse bounds the throughput any number of workers
+  // can reach.
+  auto readerStart = std::chrono::steady_clock::now();
+  for (const std::string& payload : payloads) {
+    CHECK(!DecodeMessage(payload, WireEncoding::Json).is_null());
+  }
+  auto decoded = std::chrono::steady_clock::now();
+  MessageEnvelope envelope;
+  for (const std::string& payload : payloads) {
+    CHECK(PeekEnvelope(payload, WireEncoding::Json, envelope));
+  }
+  auto peeked = std::chrono::steady_clock::now();
+  printf("  reader alone: decode %.0f ns/message, peek %.0f ns/message\n",
+         std::chrono::duration<double, std::nano>(decoded - readerStart).count() / total,
+         std::chrono::duration<double, std::nano>(peeked - decoded).count() / total);
+
+  for (bool decodeOnReader : {true, false}) {
+    for (int workers : {1, 2, 4, 8}) {
+      OrderLog* log = new OrderLog(kBrowsers);
+      RpcDispatcher* dispatcher = NewDispatcher();
+      dispatcher->Register<OrderedMessage>(
+          [log](const OrderedMessage& message) { log->Record(message); }, RpcLane::Browser);
+      dispatcher->Start(workers);
+
+      auto start = std::chrono::steady_clock::now();
+      for (const std::string& payload : payloads) {
+        std::string copy = payload;
+        if (decodeOnReader) {
+          dispatcher->Dispatch(DecodeMessage(copy, WireEncoding::Json));
+        } else {
+          dispatcher->DispatchEncoded(std::move(copy), WireEncoding::Json);
+        }
+      }
+      auto readerDone = std::chrono::steady_clock::now();
+      CHECK(WaitFor([log, total] { return log->handled.load() == total; }));
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      double seconds = std::chrono::duration<double>(elapsed).count();
+      printf("  %s, %d workers: %.0f k messages/s, reader %.0f ns/message\n",
+             decodeOnReader ? "decode on reader " : "decode on workers", workers,
+             total / seconds / 1000,
+             std::chrono::duration<double, std::nano>(readerDone - start).count() / total);
+    }
+  }
+  printf("  (%u hardware threads)\n", std::thread::hardware_concurrency());
+}
+
+TEST(RpcDispatcherUnpacksBatchesInOrder) {
+  const int kBrowsers = 4;
+  OrderLog* log = new OrderLog(kBrowsers);
+  RpcDispatcher* dispatcher = NewDispatcher();
+  dispatcher->Register<OrderedMessage>(
+      [log](const OrderedMessage& message) { log->Record(message); }, RpcLane::Browser);
+  dispatcher->Start(2);
+
+  json messages = json::array();
+  for (int sequence = 0; sequence < 100; sequence++) {
+    for (int browserId = 0; browserId < kBrowsers; browserId++) {
+      messages.push_back(Ordered(browserId, sequence));
+    }
+  }
+  // A nested batch is refused, but the rest of the batch still goes through.
+  messages.push_back(json{{"type", RpcDispatcher::kBatchType}, {"messages", json::array()}});
+  CHECK(!dispatcher->Dispatch(
+      json{{"type", RpcDispatcher::kBatchType}, {"messages", std::move(messages)}}));
+  CHECK(WaitFor([log] { return log->handled.load() == 400; }));
+  for (int browserId = 0; browserId < kBrowsers; browserId++) {
+    CHECK_EQ(log->outOfOrder[browserId], 0);
+    CHECK_EQ(log->next[browserId], 100);
+  }
+  json metrics = dispatcher->CollectMetrics();
+  CHECK_EQ(metrics["batches"].get<int>(), 1);
+  CHECK_EQ(metrics["batchedMessages"].get<int>(), 401);
+}
+
+// Within a coalescing window, moves merge into one pending message, and any
+// other message for the same browser flushes it first.
+TEST(RpcDispatcherCoalescesWithinWindow) {
+  struct Log {
+    std::vector<MoveMessage> moves;
+    std::vector<int> order;  // x of moves, -1 - sequence of ordered messages
+    std::atomic<int> handled{0};
+  };
+  Log* log = new Log();
+  RpcDispatcher* dispatcher = NewDispatcher();
+  dispatcher->RegisterCoalesced<MoveMessage>(
+      [log](const MoveMessage& move) {
+        log->moves.push_back(move);
+        log->order.push_back(move.x);
+        log->handled++;
+      },
+      [](MoveMessage& pending, const MoveMessage& next) {
+        pending.x = next.x;
+        pending.count += next.count;
+        return true;
+      });
+  dispatcher->Register<OrderedMessage>(
+      [log](const OrderedMessage& message) {
+        log->order.push_back(-1 - message.sequence);
+        log->handled++;
+      },
+      RpcLane::Browser);
+  dispatcher->SetCoalescingWindow([](int) { return Uint64(10) * SDL_NS_PER_SECOND; });
+  dispatcher->Start(1);
+
+  // The first move is handled right away; the next 99 merge.
+  for (int x = 1; x <= 100; x++) {
+    CHECK(dispatcher->Dispatch(Move(7, x)));
+  }
+  CHECK(dispatcher->Dispatch(Ordered(7, 0)));
+  CHECK(WaitFor([log] { return log->handled.load() == 3; }));
+
+  CHECK_EQ(log->moves.size(), 2u);
+  CHECK_EQ(log->moves[0].count, 1);
+  CHECK_EQ(log->moves[1].count, 99);
+  CHECK((log->order == std::vector<int>{1, 100, -1}));
+  CHECK_EQ(dispatcher->CollectMetrics()["coalesced"][MoveMessage::kType].get<int>(), 98);
+}
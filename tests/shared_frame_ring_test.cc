@@ -0,0 +1,143 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "shared_frame_ring.hpp"
+#include "test.h"
+#include "thread_safe_queue.hpp"
+
+namespace {
+
+const int kWidth = 64;
+const int kHeight = 40;
+
+// Each test maps its own section, named like the runner's.
+std::string RingName() {
+  static int generation = 0;
+  return SharedFrameRingName(-1, ++generation);
+}
+
+std::vector<uint8_t> Frame(uint8_t value) {
+  return std::vector<uint8_t>(static_cast<size_t>(kWidth) * kHeight * 4, value);
+}
+
+bool SlotHolds(SharedFrameRing& ring, int slot, const std::vector<uint8_t>& frame) {
+  return memcmp(ring.SlotPixels(slot), frame.data(), frame.size()) == 0;
+}
+
+}  // namespace
+
+TEST(SharedFrameRingWritesOnlyFreeSlots) {
+  SharedFrameRing ring;
+  CHECK(ring.Create(RingName(), kWidth, kHeight, 3));
+  std::vector<uint8_t> frame = Frame(1);
+  std::vector<CefRect> copied;
+  int first = ring.Write(frame.data(), {}, 8, copied);
+  int second = ring.Write(frame.data(), {}, 8, copied);
+  int third = ring.Write(frame.data(), {}, 8, copied);
+  CHECK(first != second && second != third && first != third);
+  CHECK_EQ(ring.SlotsInUse(), 3);
+
+  // Full: the frame is dropped and nothing is copied.
+  CHECK_EQ(ring.FreeSlot(), -1);
+  CHECK_EQ(ring.Write(frame.data(), {CefRect(0, 0, 4, 4)}, 8, copied), -1);
+  CHECK(copied.empty());
+
+  // Acknowledged out of order, the freed slot is the one reused.
+  ring.Release(second);
+  CHECK_EQ(ring.Write(frame.data(), {}, 8, copied), second);
+  CHECK_EQ(ring.FreeSlot(), -1);
+
+  ring.ReleaseAll();
+  CHECK_EQ(ring.SlotsInUse(), 0);
+}
+
+// Frames released in random order, with some held for a long time as a
+// client that stopped acknowledging would: every slot written still holds
+// its whole frame, not just the damage copied into it.
+TEST(SharedFrameRingSlotsHoldWholeFrames) {
+  const int kSlots = 4;
+  SharedFrameRing ring;
+  CHECK(ring.Create(RingName(), kWidth, kHeight, kSlots));
+  std::mt19937 random(7);
+  std::vector<uint8_t> frame = Frame(0);
+  std::vector<int> held;
+  int dropped = 0;
+
+  for (int i = 1; i <= 500; i++) {
+    CefRect damage(static_cast<int>(random() % kWidth), static_cast<int>(random() % kHeight),
+                   1 + static_cast<int>(random() % 16), 1 + static_cast<int>(random() % 16));
+    damage = dirty_rects::Intersection(damage, CefRect(0, 0, kWidth, kHeight));
+    for (int y = damage.y; y < damage.y + damage.height; y++) {
+      memset(&frame[(static_cast<size_t>(y) * kWidth + damage.x) * 4],
+             static_cast<uint8_t>(i), static_cast<size_t>(damage.width) * 4);
+    }
+
+    std::vector<CefRect> copied;
+    int slot = ring.Write(frame.data(), {damage}, 8, copied);
+    if (slot < 0) {
+      dropped++;
+    } else {
+      CHECK(SlotHolds(ring, slot, frame));
+      held.push_back(slot);
+    }
+
+    // Acknowledge a random held frame most of the time.
+    if (!held.empty() && random() % 4 != 0) {
+      size_t index = random() % held.size();
+      ring.Release(held[index]);
+      held.erase(held.begin() + index);
+    }
+    CHECK_EQ(ring.SlotsInUse(), static_cast<int>(held.size()));
+  }
+  CHECK(dropped > 0);
+}
+
+// Not a pass/fail check: reports the frames per second the ring sustains at
+// 1080p with three slots. A second thread stands in for the client: it takes
+// each slot written, copies the frame out as an upload would and
+// acknowledges it; the painting side frees acknowledged slots and writes the
+// next frame as soon as one is free.
+TEST(SharedFrameRingClientStandIn1080p) {
+  const int kFrameWidth = 1920;
+  const int kFrameHeight = 1080;
+  const int kFrames = 300;
+  std::vector<uint8_t> frame(static_cast<size_t>(kFrameWidth) * kFrameHeight * 4, 0x80);
+
+  for (int damagePercent : {100, 10}) {
+    SharedFrameRing ring;
+    CHECK(ring.Create(RingName(), kFrameWidth, kFrameHeight, 3));
+    ThreadSafeQueue<int> written;
+    ThreadSafeQueue<int> acknowledged;
+    std::thread client([&] {
+      std::vector<uint8_t> upload(frame.size());
+      for (int i = 0; i < kFrames; i++) {
+        int slot = written.pop();
+        memcpy(upload.data(), ring.SlotPixels(slot), upload.size());
+        acknowledged.push(slot);
+      }
+    });
+
+    CefRect damage(0, 0, kFrameWidth, kFrameHeight * damagePercent / 100);
+    std::vector<CefRect> copied;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kFrames; i++) {
+      int slot;
+      while (acknowledged.try_pop(slot)) {
+        ring.Release(slot);
+      }
+      if (ring.FreeSlot() < 0) {
+        ring.Release(acknowledged.pop());
+      }
+      written.push(ring.Write(frame.data(), {damage}, 8, copied));
+    }
+    client.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    printf("  %d%% damage: %.0f fps\n", damagePercent, kFrames / seconds);
+  }
+}
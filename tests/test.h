@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// A minimal test registry, so the portable parts of the runner can be tested
+// without pulling in a test framework.
+//
+//   TEST(FrameReaderSplitsFrames) {
+//     CHECK(condition);
+//     CHECK_EQ(actual, expected);
+//   }
+struct TestCase {
+  const char* name;
+  void (*run)();
+};
+
+inline std::vector<TestCase>& TestRegistry() {
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+inline int& TestFailureCount() {
+  static int failures = 0;
+  return failures;
+}
+
+struct TestRegistrar {
+  TestRegistrar(const char* name, void (*run)()) { TestRegistry().push_back({name, run}); }
+};
+
+inline void ReportTestFailure(const char* file, int line, const char* expression) {
+  fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, expression);
+  TestFailureCount()++;
+}
+
+#define TEST(name)                                       \
+  static void name();                                    \
+  static TestRegistrar name##Registrar(#name, &name);    \
+  static void name()
+
+#define CHECK(condition)                                    \
+  do {                                                      \
+    if (!(condition)) {                                     \
+      ReportTestFailure(__FILE__, __LINE__, #condition);    \
+    }                                                       \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) CHECK((actual) == (expected))
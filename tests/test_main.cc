@@ -0,0 +1,22 @@
+#include <cstdio>
+#include <cstring>
+
+#include "test.h"
+
+// Runs every registered test, or only those whose name contains argv[1].
+int main(int argc, char** argv) {
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+  int run = 0;
+  for (const TestCase& test : TestRegistry()) {
+    if (filter && !strstr(test.name, filter)) {
+      continue;
+    }
+    int failuresBefore = TestFailureCount();
+    printf("[ RUN  ] %s\n", test.name);
+    test.run();
+    printf("[ %s ] %s\n", TestFailureCount() == failuresBefore ? " OK " : "FAIL", test.name);
+    run++;
+  }
+  printf("%d tests, %d failed checks\n", run, TestFailureCount());
+  return TestFailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+#include "thread_safe_queue.hpp"
+
+namespace {
+
+struct Item {
+  int producer = 0;
+  int sequence = 0;
+};
+
+// Runs |producers| threads pushing |perProducer| items each while this
+// thread pops with |popper|, and checks every item arrives exactly once and
+// in order per producer.
+template <typename Popper>
+void RunProducers(int producers, int perProducer, Popper popper) {
+  ThreadSafeQueue<Item> queue;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&queue, p, perProducer] {
+      for (int i = 0; i < perProducer; i++) {
+        queue.push(Item{p, i});
+      }
+    });
+  }
+
+  std::vector<int> next(producers, 0);
+  bool ordered = true;
+  int total = producers * perProducer;
+  for (int received = 0; received < total;) {
+    std::vector<Item> items;
+    popper(queue, items);
+    for (const Item& item : items) {
+      if (item.sequence != next[item.producer]) {
+        ordered = false;
+      }
+      next[item.producer] = item.sequence + 1;
+    }
+    received += static_cast<int>(items.size());
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  CHECK(ordered);
+  for (int p = 0; p < producers; p++) {
+    CHECK_EQ(next[p], perProducer);
+  }
+  Item extra;
+  CHECK(!queue.try_pop(extra));
+}
+
+// The std::queue-behind-a-mutex queue that ThreadSafeQueue replaced, kept
+// as the baseline for the throughput comparison.
+template <typename T>
+class MutexQueue {
+ public:
+  MutexQueue() : mtx(SDL_CreateMutex()), cv(SDL_CreateCondition()) {}
+  ~MutexQueue() {
+    SDL_DestroyMutex(mtx);
+    SDL_DestroyCondition(cv);
+  }
+
+  void push(const T& val) {
+    SDL_LockMutex(mtx);
+    q.push(val);
+    SDL_SignalCondition(cv);
+    SDL_UnlockMutex(mtx);
+  }
+
+  T pop() {
+    SDL_LockMutex(mtx);
+    while (q.empty()) {
+      SDL_WaitCondition(cv, mtx);
+    }
+    T val = q.front();
+    q.pop();
+    SDL_UnlockMutex(mtx);
+    return val;
+  }
+
+ private:
+  SDL_Mutex* mtx;
+  SDL_Condition* cv;
+  std::queue<T> q;
+};
+
+// Pushes |perProducer| items from each of |producers| threads and pops them
+// all on this thread with |popAll|, which returns how many it popped.
+// Returns items per second.
+template <typename Queue, typename PopAll>
+double MeasureThroughput(int producers, int perProducer, PopAll popAll) {
+  Queue queue;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&queue, perProducer] {
+      for (int i = 0; i < perProducer; i++) {
+        queue.push(static_cast<uint64_t>(i));
+      }
+    });
+  }
+  size_t received = 0;
+  while (received < static_cast<size_t>(producers) * perProducer) {
+    received += popAll(queue);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return received / std::chrono::duration<double>(elapsed).count();
+}
+
+}  // namespace
+
+TEST(ThreadSafeQueuePopKeepsPerProducerOrder) {
+  RunProducers(4, 100000, [](ThreadSafeQueue<Item>& queue, std::vector<Item>& items) {
+    items.push_back(queue.pop());
+  });
+}
+
+TEST(ThreadSafeQueuePopAllKeepsPerProducerOrder) {
+  RunProducers(8, 50000, [](ThreadSafeQueue<Item>& queue, std::vector<Item>& items) {
+    queue.pop_all(items);
+  });
+}
+
+TEST(ThreadSafeQueueTimedPopKeepsPerProducerOrder) {
+  RunProducers(4, 50000, [](ThreadSafeQueue<Item>& queue, std::vector<Item>& items) {
+    Item item;
+    if (queue.try_pop_for(item, 1)) {
+      items.push_back(item);
+    }
+  });
+}
+
+// A consumer asleep in pop() must be woken by a push from another thread.
+TEST(ThreadSafeQueueWakesBlockedConsumer) {
+  ThreadSafeQueue<int> queue;
+  for (int round = 0; round < 1000; round++) {
+    std::thread producer([&queue, round] {
+      if (round % 2) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+      queue.push(round);
+    });
+    CHECK_EQ(queue.pop(), round);
+    producer.join();
+  }
+}
+
+TEST(ThreadSafeQueueTimedPopTimesOut) {
+  ThreadSafeQueue<int> queue;
+  int value = 0;
+  auto start = std::chrono::steady_clock::now();
+  CHECK(!queue.try_pop_for(value, 20));
+  CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+  queue.push(7);
+  CHECK(queue.try_pop_for(value, 20));
+  CHECK_EQ(value, 7);
+}
+
+TEST(ThreadSafeQueueDrainIntoRespectsLimit) {
+  ThreadSafeQueue<int> queue;
+  for (int i = 0; i < 10; i++) {
+    queue.push(i);
+  }
+  std::vector<int> out;
+  CHECK_EQ(queue.drain_into(out, 4), 4u);
+  CHECK_EQ(queue.drain_into(out), 6u);
+  CHECK_EQ(queue.drain_into(out), 0u);
+  CHECK((out == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
+
+// Items left in the queue are destroyed with it.
+TEST(ThreadSafeQueueDestroysQueuedItems) {
+  std::shared_ptr<int> tracked = std::make_shared<int>(0);
+  {
+    ThreadSafeQueue<std::shared_ptr<int>> queue;
+    for (int i = 0; i < 100; i++) {
+      queue.push(tracked);
+    }
+    std::shared_ptr<int> popped;
+    CHECK(queue.try_pop(popped));
+  }
+  CHECK_EQ(tracked.use_count(), 1);
+}
+
+// Not a pass/fail check: reports push-to-pop throughput with several
+// producers, the writer thread's load, for ThreadSafeQueue popping one item
+// or everything queued at a time and for the mutex queue it replaced.
+TEST(ThreadSafeQueueMultiProducerThroughput) {
+  const int perProducer = 200000;
+  for (int producers : {1, 4, 8}) {
+    double mutexQueue = MeasureThroughput<MutexQueue<uint64_t>>(
+        producers, perProducer, [](MutexQueue<uint64_t>& queue) {
+          queue.pop();
+          return size_t{1};
+        });
+    double pop = MeasureThroughput<ThreadSafeQueue<uint64_t>>(
+        producers, perProducer, [](ThreadSafeQueue<uint64_t>& queue) {
+          queue.pop();
+          return size_t{1};
+        });
+    std::vector<uint64_t> items;
+    double popAll = MeasureThroughput<ThreadSafeQueue<uint64_t>>(
+        producers, perProducer, [&items](ThreadSafeQueue<uint64_t>& queue) {
+          items.clear();
+          return queue.pop_all(items);
+        });
+    printf("  %d producers: mutex queue %.1f, pop() %.1f, pop_all() %.1f M items/s\n",
+           producers, mutexQueue / 1e6, pop / 1e6, popAll / 1e6);
+  }
+}
+
+// Not a pass/fail check: reports how long a queued message waits before the
+// consumer picks it up, for the old server loop (drain with try_pop, then
+// SDL_Delay(1)) and for the writer thread blocking in pop().
+TEST(ThreadSafeQueuePickupLatency) {
+  using Clock = std::chrono::steady_clock;
+  const int rounds = 200;
+  for (bool polling : {true, false}) {
+    ThreadSafeQueue<Clock::time_point> queue;
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    std::thread consumer([&queue, &latencies, polling, rounds] {
+      Clock::time_point queued;
+      while (static_cast<int>(latencies.size()) < rounds) {
+        if (polling) {
+          if (!queue.try_pop(queued)) {
+            SDL_Delay(1);
+            continue;
+          }
+        } else {
+          queued = queue.pop();
+        }
+        latencies.push_back(
+            std::chrono::duration<double, std::micro>(Clock::now() - queued).count());
+      }
+    });
+    for (int i = 0; i < rounds; i++) {
+      // Spread the pushes over the consumer's sleep.
+      std::this_thread::sleep_for(std::chrono::microseconds(300 + 37 * (i % 20)));
+      queue.push(Clock::now());
+    }
+    consumer.join();
+    std::sort(latencies.begin(), latencies.end());
+    printf("  %s: median %.1f us, p99 %.1f us\n",
+           polling ? "try_pop + SDL_Delay(1)" : "blocking pop()",
+           latencies[rounds / 2], latencies[rounds * 99 / 100]);
+  }
+}
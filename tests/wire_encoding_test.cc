@@ -0,0 +1,312 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test.h"
+#include "wire_encoding.hpp"
+
+namespace {
+
+const WireEncoding kEncodings[] = {WireEncoding::Json, WireEncoding::Cbor,
+                                   WireEncoding::MessagePack};
+
+json SampleMessage(int i) {
+  return {{"type", "MouseMoveEvent"},
+          {"browserId", i},
+          {"x", i * 3},
+          {"y", -i},
+          {"scale", i / 4.0},
+          {"text", std::string(i % 40, 'z')},
+          {"flags", {i % 2 == 0, nullptr, "s"}}};
+}
+
+// Builds a Batch frame the way the writer does, from already-encoded
+// payloads.
+std::string EncodeBatch(const std::vector<json>& messages, WireEncoding encoding) {
+  std::string batch = EncodeBatchHeader(messages.size(), encoding);
+  for (size_t i = 0; i < messages.size(); i++) {
+    if (i > 0) {
+      batch += BatchSeparator(encoding);
+    }
+    batch += EncodeMessage(messages[i], encoding);
+  }
+  batch += BatchFooter(encoding);
+  return batch;
+}
+
+}  // namespace
+
+TEST(WireEncodingRoundTrips) {
+  for (WireEncoding encoding : kEncodings) {
+    for (int i = 0; i < 50; i++) {
+      json message = SampleMessage(i);
+      CHECK(DecodeMessage(EncodeMessage(message, encoding), encoding) == message);
+    }
+  }
+}
+
+TEST(WireEncodingNamesRoundTrip) {
+  for (WireEncoding encoding : kEncodings) {
+    CHECK(WireEncodingFromString(WireEncodingToString(encoding)) == encoding);
+  }
+  CHECK(!WireEncodingFromString("bson").has_value());
+}
+
+TEST(WireEncodingNegotiatesFirstKnown) {
+  CHECK(NegotiateWireEncoding({}) == WireEncoding::Json);
+  CHECK(NegotiateWireEncoding({"bson", "msgpack", "cbor"}) == WireEncoding::MessagePack);
+  CHECK(NegotiateWireEncoding({"bson"}) == WireEncoding::Json);
+}
+
+TEST(WireEncodingRejectsMalformedPayloads) {
+  for (WireEncoding encoding : kEncodings) {
+    std::string payload = EncodeMessage(SampleMessage(3), encoding);
+    payload.resize(payload.size() / 2);
+    bool threw = false;
+    try {
+      DecodeMessage(payload, encoding);
+    } catch (const json::parse_error&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+}
+
+// The hand-built envelope must decode to the same thing as encoding the
+// whole batch, across every array header size the encodings have.
+TEST(WireEncodingBatchEnvelopeDecodes) {
+  for (WireEncoding encoding : kEncodings) {
+    for (size_t count : {1, 2, 15, 16, 23, 24, 255, 256, 65535, 65536}) {
+      std::vector<json> messages;
+      for (size_t i = 0; i < count; i++) {
+        messages.push_back(json{{"i", i}});
+      }
+      json decoded = DecodeMessage(EncodeBatch(messages, encoding), encoding);
+      CHECK(decoded["type"] == "Batch");
+      CHECK(decoded["messages"] == json(messages));
+    }
+  }
+}
+
+// Real messages, not just small maps, survive being placed in the envelope.
+TEST(WireEncodingBatchEnvelopeKeepsMessages) {
+  std::vector<json> messages;
+  for (int i = 0; i < 40; i++) {
+    messages.push_back(SampleMessage(i));
+  }
+  json batch = {{"type", "Batch"}, {"messages", messages}};
+  for (WireEncoding encoding : kEncodings) {
+    CHECK(DecodeMessage(EncodeBatch(messages, encoding), encoding) == batch);
+  }
+}
+
+TEST(WireEncodingPeeksEnvelope) {
+  for (WireEncoding encoding : kEncodings) {
+    MessageEnvelope envelope;
+    // Fields nested deeper than the top level are not the envelope's.
+    json message = {{"args", {{"type", "Nested"}, {"browserId", 9}}},
+                    {"browserId", 42},
+                    {"type", "EvalJavaScriptRequest"}};
+    CHECK(PeekEnvelope(EncodeMessage(message, encoding), encoding, envelope));
+    CHECK_EQ(envelope.type, std::string("EvalJavaScriptRequest"));
+    CHECK(envelope.browserId == 42);
+
+    CHECK(PeekEnvelope(EncodeMessage({{"type", "GetMetricsRequest"}}, encoding), encoding,
+                       envelope));
+    CHECK(!envelope.browserId.has_value());
+    CHECK(PeekEnvelope(EncodeMessage({{"type", "A"}, {"browserId", "1"}}, encoding), encoding,
+                       envelope));
+    CHECK(!envelope.browserId.has_value());
+    CHECK(PeekEnvelope(EncodeMessage({{"type", "A"}, {"browserId", -3}}, encoding), encoding,
+                       envelope));
+    CHECK(envelope.browserId == -3);
+
+    CHECK(!PeekEnvelope(EncodeMessage({{"browserId", 1}}, encoding), encoding, envelope));
+    CHECK(!PeekEnvelope(EncodeMessage({{"type", 5}}, encoding), encoding, envelope));
+    CHECK(!PeekEnvelope(EncodeMessage(json::array({"type", "A"}), encoding), encoding,
+                        envelope));
+    CHECK(!PeekEnvelope(std::string("\xFF"), encoding, envelope));
+  }
+
+  // JSON is scanned by hand: escaped quotes, nesting and whitespace in the
+  // values skipped must not throw it off, and an escaped type is still read
+  // right.
+  MessageEnvelope envelope;
+  CHECK(PeekEnvelope(
+      " { \"script\" : \"a\\\"}b\\\\\" , \"args\":[{\"browserId\":1},\"]\"],"
+      "\"browserId\" : 12 , \"type\":\"Eval\" }",
+      WireEncoding::Json, envelope));
+  CHECK_EQ(envelope.type, std::string("Eval"));
+  CHECK(envelope.browserId == 12);
+  CHECK(PeekEnvelope("{\"browserId\":1.5,\"type\":\"A\\u0042\"}", WireEncoding::Json, envelope));
+  CHECK_EQ(envelope.type, std::string("AB"));
+  CHECK(!envelope.browserId.has_value());
+  CHECK(PeekEnvelope("{\"browserId\":99999999999,\"type\":\"A\"}", WireEncoding::Json, envelope));
+  CHECK(!envelope.browserId.has_value());
+}
+
+namespace {
+
+OutgoingMessage Queued(const json& message, WireEncoding encoding, uint64_t connection = 1) {
+  return OutgoingMessage{EncodeMessage(message, encoding), encoding, connection};
+}
+
+// Splits a buffer of [len][payload] frames.
+std::vector<std::string> Frames(const std::vector<uint8_t>& buffer) {
+  std::vector<std::string> frames;
+  size_t offset = 0;
+  while (offset + 4 <= buffer.size()) {
+    uint32_t len;
+    memcpy(&len, buffer.data() + offset, 4);
+    frames.emplace_back(reinterpret_cast<const char*>(buffer.data()) + offset + 4, len);
+    offset += 4 + len;
+  }
+  return frames;
+}
+
+}  // namespace
+
+// The encoding and batching switch right after the InitializeResponse,
+// whatever encoding the messages around it were queued in.
+TEST(WireEncodingFramingSwitchesAfterInitializeResponse) {
+  json initialize = {{"type", "InitializeResponse"}};
+  std::vector<OutgoingMessage> messages;
+  messages.push_back(Queued(SampleMessage(1), WireEncoding::Json));
+  messages.push_back(Queued(SampleMessage(2), WireEncoding::Json));
+  messages.push_back(Queued(initialize, WireEncoding::Json));
+  messages.back().switchEncoding = WireEncoding::Cbor;
+  messages.back().switchBatching = true;
+  // Queued before the switch was seen, and after.
+  messages.push_back(Queued(SampleMessage(3), WireEncoding::Json));
+  messages.push_back(Queued(SampleMessage(4), WireEncoding::Cbor));
+  messages.push_back(Queued(SampleMessage(5), WireEncoding::MessagePack));
+
+  std::vector<uint8_t> buffer;
+  FramingCounts counts;
+  WireState state = FrameOutgoing(messages, 1, WireState(), buffer, counts);
+  CHECK_EQ(state.connection, 1u);
+  CHECK(state.encoding == WireEncoding::Cbor);
+  CHECK(state.batching);
+  CHECK_EQ(counts.frames, 4);
+  CHECK_EQ(counts.batchFrames, 1);
+  CHECK_EQ(counts.batchedMessages, 3);
+
+  std::vector<std::string> frames = Frames(buffer);
+  CHECK_EQ(frames.size(), 4u);
+  CHECK(DecodeMessage(frames[0], WireEncoding::Json) == SampleMessage(1));
+  CHECK(DecodeMessage(frames[1], WireEncoding::Json) == SampleMessage(2));
+  CHECK(DecodeMessage(frames[2], WireEncoding::Json) == initialize);
+  json batch = DecodeMessage(frames[3], WireEncoding::Cbor);
+  CHECK((batch["messages"] == json{SampleMessage(3), SampleMessage(4), SampleMessage(5)}));
+
+  // Later writes on the connection carry on in the new mode; a new
+  // connection starts over in unbatched JSON.
+  messages.clear();
+  messages.push_back(Queued(SampleMessage(6), WireEncoding::Json));
+  buffer.clear();
+  state = FrameOutgoing(messages, 1, state, buffer, counts);
+  CHECK(DecodeMessage(Frames(buffer)[0], WireEncoding::Cbor) == SampleMessage(6));
+
+  messages.clear();
+  messages.push_back(Queued(SampleMessage(7), WireEncoding::Cbor, 2));
+  messages.push_back(Queued(SampleMessage(8), WireEncoding::Cbor, 2));
+  buffer.clear();
+  state = FrameOutgoing(messages, 2, state, buffer, counts);
+  CHECK(state.encoding == WireEncoding::Json);
+  CHECK(!state.batching);
+  frames = Frames(buffer);
+  CHECK_EQ(frames.size(), 2u);
+  CHECK(DecodeMessage(frames[1], WireEncoding::Json) == SampleMessage(8));
+}
+
+// Messages queued while no client was connected carry the generation of
+// the gap between connections, so the next client never sees them.
+TEST(WireEncodingDiscardsMessagesFromOtherConnections) {
+  std::vector<OutgoingMessage> messages;
+  messages.push_back(Queued(SampleMessage(1), WireEncoding::Json, 1));
+  messages.push_back(Queued(SampleMessage(2), WireEncoding::Json, 2));
+  messages.push_back(Queued(SampleMessage(3), WireEncoding::Json, 3));
+  messages.push_back(Queued(SampleMessage(4), WireEncoding::Json, 2));
+  messages.push_back(Queued(SampleMessage(5), WireEncoding::Json, 3));
+  // Connection 1 closed (-> 2, no client) and the next client was accepted
+  // (-> 3).
+  CHECK_EQ(DiscardStale(messages, 3), 3u);
+  CHECK_EQ(messages.size(), 2u);
+  CHECK(DecodeMessage(messages[0].payload, WireEncoding::Json) == SampleMessage(3));
+  CHECK(DecodeMessage(messages[1].payload, WireEncoding::Json) == SampleMessage(5));
+  CHECK_EQ(DiscardStale(messages, 3), 0u);
+  CHECK_EQ(messages.size(), 2u);
+}
+
+// A payload that cannot be re-encoded is dropped rather than sent in the
+// wrong encoding.
+TEST(WireEncodingFramingDropsUndecodable) {
+  std::vector<OutgoingMessage> messages;
+  messages.push_back(OutgoingMessage{"{not json", WireEncoding::Json, 1});
+  messages.push_back(Queued(SampleMessage(1), WireEncoding::Json));
+  std::vector<uint8_t> buffer;
+  FramingCounts counts;
+  FrameOutgoing(messages, 1, WireState{1, WireEncoding::MessagePack, false}, buffer, counts);
+  CHECK_EQ(counts.undecodable, 1);
+  std::vector<std::string> frames = Frames(buffer);
+  CHECK_EQ(frames.size(), 1u);
+  CHECK(DecodeMessage(frames[0], WireEncoding::MessagePack) == SampleMessage(1));
+}
+
+// Not a pass/fail check: reports size and encode/decode cost per message for
+// each encoding, over a mix of input events, paint events and eval results,
+// and the cost of only peeking at the envelope as the reader does.
+TEST(WireEncodingSizeAndTiming) {
+  std::vector<json> messages;
+  for (int i = 0; i < 300; i++) {
+    messages.push_back(SampleMessage(i));
+    messages.push_back({{"type", "AcceleratedPaintEvent"},
+                        {"id", "6b1f5b4e-2a51-4a8e-9d43-0f1c2b3a4d5e"},
+                        {"browserId", i},
+                        {"sharedTextureHandle", 0x7f0012345678 + i},
+                        {"dirtyRects", {{{"x", i}, {"y", 2 * i}, {"width", 64}, {"height", 32}}}}});
+    messages.push_back({{"type", "EvalJavaScriptResponse"},
+                        {"id", "0d9c8b7a-6f5e-4d3c-2b1a-09f8e7d6c5b4"},
+                        {"browserId", i},
+                        {"success", true},
+                        {"result", {{"values", std::vector<double>(32, i * 0.5)},
+                                    {"label", std::string(200, 'x')}}}});
+  }
+  const int kRounds = 20;
+  for (WireEncoding encoding : kEncodings) {
+    std::vector<std::string> encoded(messages.size());
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+      for (size_t i = 0; i < messages.size(); i++) {
+        encoded[i] = EncodeMessage(messages[i], encoding);
+      }
+    }
+    auto encodeEnd = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+      for (const std::string& payload : encoded) {
+        CHECK(!DecodeMessage(payload, encoding).is_null());
+      }
+    }
+    auto decodeEnd = std::chrono::steady_clock::now();
+    MessageEnvelope envelope;
+    for (int round = 0; round < kRounds; round++) {
+      for (const std::string& payload : encoded) {
+        CHECK(PeekEnvelope(payload, encoding, envelope));
+      }
+    }
+    auto peekEnd = std::chrono::steady_clock::now();
+    for (const std::string& payload : encoded) {
+      bytes += payload.size();
+    }
+    double count = static_cast<double>(messages.size()) * kRounds;
+    printf("  %-7s %6.1f bytes/message, encode %6.0f ns, decode %6.0f ns, peek %6.0f ns\n",
+           WireEncodingToString(encoding),
+           static_cast<double>(bytes) / messages.size(),
+           std::chrono::duration<double, std::nano>(encodeEnd - start).count() / count,
+           std::chrono::duration<double, std::nano>(decodeEnd - encodeEnd).count() / count,
+           std::chrono::duration<double, std::nano>(peekEnd - decodeEnd).count() / count);
+  }
+}